@@ -0,0 +1,218 @@
+// ====== Almacén de filas comprimido por bloques (books.blk) ======
+// Compartido por pack_store (escribe) e idx_server (lee).
+//
+// Formato:
+//   BlkHeader | diccionario | bloque 0 | bloque 1 | ... | directorio de bloques
+// Cada bloque descomprimido es: uint32 nrows | uint32 inicio[nrows] | filas ('\n' incluido).
+// En books.idx, un Pair.offset con el bit 63 a 1 apunta a (bloque << 16 | slot) en vez de
+// a un byte del CSV; los offsets normales siguen siendo bytes del CSV (filas añadidas después).
+//
+// El códec es el formato de bloque de LZ4 (token, literales, offset de 2 bytes, longitud
+// de coincidencia) implementado aquí porque el proyecto no depende de bibliotecas externas.
+// El diccionario (filas muestreadas de todo el CSV) actúa de prefijo: las coincidencias
+// pueden apuntar a él, lo que ayuda mucho con bloques pequeños de texto parecido.
+#ifndef BLK_STORE_H
+#define BLK_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define BLK_MAGIC "BKBLKv01"
+#define BLK_FLAG (1ull << 63)          // Pair.offset apunta a un bloque
+#define BLK_SLOT_BITS 16               // slot dentro del bloque
+#define BLK_MAX_RAW (16u << 20)        // tope de cordura para un bloque descomprimido
+#define BLK_MAX_DICT 65535u            // el offset de LZ4 es de 16 bits
+#define BLK_STORED_RAW 1u              // flags: bloque guardado sin comprimir
+
+typedef struct
+{
+    char magic[8];        // "BKBLKv01"
+    uint64_t block_count; // nº de bloques
+    uint64_t rows;        // filas almacenadas
+    uint64_t dict_offset; // diccionario
+    uint64_t dict_len;
+    uint64_t dir_offset; // directorio de bloques (BlkDirEntry[block_count])
+} BlkHeader;
+
+typedef struct
+{
+    uint64_t offset;   // posición del bloque comprimido en books.blk
+    uint32_t comp_len; // bytes en disco
+    uint32_t raw_len;  // bytes descomprimido
+    uint32_t nrows;    // filas del bloque
+    uint32_t flags;    // BLK_STORED_RAW
+} BlkDirEntry;
+
+static inline uint64_t blk_make_offset(uint64_t block, unsigned slot)
+{
+    return BLK_FLAG | (block << BLK_SLOT_BITS) | slot;
+}
+
+static inline uint64_t blk_block_of(uint64_t off)
+{
+    return (off & ~BLK_FLAG) >> BLK_SLOT_BITS;
+}
+
+static inline unsigned blk_slot_of(uint64_t off)
+{
+    return (unsigned)(off & ((1u << BLK_SLOT_BITS) - 1));
+}
+
+// ====== Códec LZ4 (formato de bloque) con prefijo de diccionario ======
+#define LZ_HASH_BITS 16
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5 // los últimos bytes siempre van como literales
+#define LZ_MFLIMIT 12      // no empieza coincidencias en los últimos 12 bytes
+
+static inline size_t lz_bound(size_t n)
+{
+    return n + n / 255 + 16;
+}
+
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static inline uint8_t *lz_put_len(uint8_t *op, size_t len)
+{
+    while (len >= 255)
+    {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// Comprime buf[dn, dn + n), donde buf[0, dn) es el diccionario. table: 1 << LZ_HASH_BITS
+// entradas de trabajo. Devuelve los bytes escritos en out (capacidad >= lz_bound(n)).
+static inline size_t lz_compress(const uint8_t *buf, size_t dn, size_t n, uint8_t *out, uint32_t *table)
+{
+    const size_t end = dn + n;
+    size_t ip = dn, anchor = dn;
+    uint8_t *op = out;
+
+    memset(table, 0xff, sizeof(uint32_t) << LZ_HASH_BITS);
+    for (size_t i = 0; i + LZ_MIN_MATCH <= dn; ++i)
+        table[lz_hash(lz_read32(buf + i))] = (uint32_t)i;
+
+    if (n > LZ_MFLIMIT)
+    {
+        const size_t mflimit = end - LZ_MFLIMIT;
+        while (ip < mflimit)
+        {
+            uint32_t h = lz_hash(lz_read32(buf + ip));
+            uint32_t cand = table[h];
+            table[h] = (uint32_t)ip;
+            if (cand == UINT32_MAX || ip - cand > 65535 || lz_read32(buf + cand) != lz_read32(buf + ip))
+            {
+                ip++;
+                continue;
+            }
+            size_t ml = LZ_MIN_MATCH;
+            while (ip + ml < end - LZ_LAST_LITERALS && buf[cand + ml] == buf[ip + ml])
+                ml++;
+
+            size_t lit = ip - anchor;
+            uint8_t *token = op++;
+            *token = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+            if (lit >= 15)
+                op = lz_put_len(op, lit - 15);
+            memcpy(op, buf + anchor, lit);
+            op += lit;
+            size_t off = ip - cand;
+            *op++ = (uint8_t)(off & 0xff);
+            *op++ = (uint8_t)(off >> 8);
+            size_t m = ml - LZ_MIN_MATCH;
+            *token |= (uint8_t)(m >= 15 ? 15 : m);
+            if (m >= 15)
+                op = lz_put_len(op, m - 15);
+
+            // Se indexa una posición intermedia para encadenar coincidencias cercanas
+            if (ip + ml - 2 < mflimit)
+                table[lz_hash(lz_read32(buf + ip + ml - 2))] = (uint32_t)(ip + ml - 2);
+            ip += ml;
+            anchor = ip;
+        }
+    }
+
+    // Literales finales
+    size_t lit = end - anchor;
+    uint8_t *token = op++;
+    *token = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+    if (lit >= 15)
+        op = lz_put_len(op, lit - 15);
+    memcpy(op, buf + anchor, lit);
+    op += lit;
+    return (size_t)(op - out);
+}
+
+// Descomprime src en dst[dn, dn + raw_len), con dst[0, dn) ya conteniendo el diccionario.
+// Devuelve 0 si produce exactamente raw_len bytes sin salirse de los límites, -1 si no.
+static inline int lz_decompress(const uint8_t *src, size_t sn, uint8_t *dst, size_t dn, size_t raw_len)
+{
+    const uint8_t *ip = src, *iend = src + sn;
+    size_t op = dn;
+    const size_t oend = dn + raw_len;
+
+    while (ip < iend)
+    {
+        unsigned token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15)
+        {
+            unsigned b;
+            do
+            {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > (size_t)(iend - ip) || lit > oend - op)
+            return -1;
+        memcpy(dst + op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip >= iend)
+            break; // última secuencia: sólo literales
+
+        if (iend - ip < 2)
+            return -1;
+        size_t off = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t ml = token & 15;
+        if (ml == 15)
+        {
+            unsigned b;
+            do
+            {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                ml += b;
+            } while (b == 255);
+        }
+        ml += LZ_MIN_MATCH;
+        if (off == 0 || off > op || ml > oend - op)
+            return -1;
+        // Copia byte a byte: la coincidencia puede solaparse con la salida
+        const uint8_t *m = dst + op - off;
+        for (size_t i = 0; i < ml; ++i)
+            dst[op + i] = m[i];
+        op += ml;
+    }
+    return op == oend ? 0 : -1;
+}
+
+#endif
@@ -7,9 +7,15 @@
 #include <ctype.h>
 #include <inttypes.h>
 #include <errno.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "idx_crc.h"
+#include "idx_dense.h"
 
 #define TABLE_SIZE 1000
 #define LINE_BUF   131072  // 128 KB
+#define PART_BATCH 256     // pares que junta cada bucket antes de escribirlos a su temporal
 
 typedef struct {
     uint64_t id;
@@ -17,7 +23,7 @@ typedef struct {
 } Pair;
 
 typedef struct {
-    char     magic[8];          // "BKIDXv01"
+    char     magic[8];          // "BKIDXv02" (v01: sin tabla de checksums)
     uint64_t table_size;        // 1000
     uint64_t total_entries;     // N
 } Header;
@@ -32,16 +38,24 @@ static inline unsigned hash_id(uint64_t id) {
     return (unsigned)((id * 2654435761UL) % TABLE_SIZE);
 }
 
+static inline double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
 static void rstrip(char *s) {
     size_t n = strlen(s);
     while (n && (s[n-1]=='\n' || s[n-1]=='\r')) s[--n] = '\0';
 }
 
+// Por id y, con ids repetidos, por posición en el CSV (la última fila es la vigente)
 static int cmp_pair_id(const void *a, const void *b) {
     const Pair *pa = (const Pair*)a, *pb = (const Pair*)b;
     if (pa->id < pb->id) return -1;
     if (pa->id > pb->id) return  1;
-    return 0;
+    uint64_t oa = pa->offset & ~IDX_DEAD, ob = pb->offset & ~IDX_DEAD;
+    return (oa > ob) - (oa < ob);
 }
 
 static int parse_id_first_field(const char *line, uint64_t *out_id) {
@@ -71,12 +85,19 @@ static int parse_id_first_field(const char *line, uint64_t *out_id) {
 
 int main(int argc, char **argv) {
     if (argc < 3) {
-        fprintf(stderr, "Uso: %s <books_validos.csv> <books.idx>\n", argv[0]);
+        fprintf(stderr, "Uso: %s <books_validos.csv> <books.idx> [--dense-min=F]\n"
+                        "  --dense-min=F  genera <books.idx>.dense si al menos F de los ids del rango\n"
+                        "                 existen (%.2f; 0 = nunca)\n", argv[0], DENSE_MIN_FILL);
         return EXIT_FAILURE;
     }
 
     const char *csv_path = argv[1];
     const char *idx_path = argv[2];
+    double dense_min = DENSE_MIN_FILL;
+    for (int i = 3; i < argc; ++i) {
+        if (strncmp(argv[i], "--dense-min=", 12) == 0) dense_min = atof(argv[i] + 12);
+        else { fprintf(stderr, "Opción desconocida: %s\n", argv[i]); return EXIT_FAILURE; }
+    }
 
     // 1) Abrir CSV
     FILE *csv = fopen(csv_path, "r");
@@ -89,7 +110,16 @@ int main(int argc, char **argv) {
         snprintf(tmpname, sizeof(tmpname), "bucket_%03d.tmp", i);
         tmp[i] = fopen(tmpname, "wb+");
         if (!tmp[i]) { perror("No se pudo crear tmp bucket"); return EXIT_FAILURE; }
+        setvbuf(tmp[i], NULL, _IONBF, 0);  // el lote de cada bucket hace de búfer
     }
+    Pair (*part)[PART_BATCH] = malloc(TABLE_SIZE * sizeof(*part));
+    unsigned part_n[TABLE_SIZE] = {0};
+    if (!part) { perror("sin memoria"); return EXIT_FAILURE; }
+
+    // Tiempos por fase: scan (leer/parsear CSV), partition (escribir los lotes a temporales),
+    // sort (cargar y ordenar cada bucket) y write (volcar buckets y directorio)
+    double t_start = now_s();
+    double t_partition = 0.0, t_sort = 0.0, t_write = 0.0;
 
     // 3) Recorrer CSV y distribuir (id, offset)
     char *line = (char*)malloc(LINE_BUF);
@@ -102,6 +132,7 @@ int main(int argc, char **argv) {
     }
 
     uint64_t total_entries = 0;
+    uint64_t min_id = UINT64_MAX, max_id = 0;
     off_t offset = 0;
 
     for (;;) {
@@ -111,56 +142,84 @@ int main(int argc, char **argv) {
 
         if (line[0] == '\0') continue;
 
+        // "-<id>" sola en su línea: borrado hecho por DEL en el servidor (anula las filas
+        // anteriores del id). Una fila cuyo primer campo empiece por '-' no lo es: se salta.
+        int tomb = line[0] == '-' && line[1] && strspn(line + 1, "0123456789") == strlen(line + 1);
+        if (line[0] == '-' && !tomb) continue;
         uint64_t id = 0;
-        if (!parse_id_first_field(line, &id)) {
+        if (!parse_id_first_field(line + tomb, &id)) {
             // En teoría ya está limpio; si algo raro aparece, lo saltamos.
             continue;
         }
 
-        Pair p = { id, (uint64_t)offset };
+        Pair p = { id, (uint64_t)offset | (tomb ? IDX_DEAD : 0) };
         unsigned b = hash_id(id);
-        if (fwrite(&p, sizeof(Pair), 1, tmp[b]) != 1) {
-            perror("fwrite temp bucket");
-            return EXIT_FAILURE;
+        part[b][part_n[b]++] = p;
+        if (part_n[b] == PART_BATCH) {
+            double tp = now_s();
+            if (fwrite(part[b], sizeof(Pair), PART_BATCH, tmp[b]) != PART_BATCH) {
+                perror("fwrite temp bucket");
+                return EXIT_FAILURE;
+            }
+            t_partition += now_s() - tp;
+            part_n[b] = 0;
         }
+        if (tomb) continue;
         total_entries++;
         // (Opcional) progreso: cada 1e6 líneas
         // if ((total_entries % 1000000ULL)==0) fprintf(stderr, "Progreso: %llu\n", (unsigned long long)total_entries);
     }
 
+    uint64_t csv_bytes = (uint64_t)ftello(csv);
     free(line);
     fclose(csv);
+    double t_scan_end = now_s();
+    double t_scan = (t_scan_end - t_start) - t_partition;
+
+    // Los lotes a medias de cada bucket
+    for (int i=0; i<TABLE_SIZE; ++i)
+        if (part_n[i] && fwrite(part[i], sizeof(Pair), part_n[i], tmp[i]) != part_n[i]) {
+            perror("fwrite temp bucket");
+            return EXIT_FAILURE;
+        }
+    free(part);
+    t_partition += now_s() - t_scan_end;
 
     // 4) Preparar archivo final .idx (header + directorio)
     FILE *idx = fopen(idx_path, "wb+");
     if (!idx) { perror("No se pudo crear índice"); return EXIT_FAILURE; }
 
     Header hdr = {0};
-    memcpy(hdr.magic, "BKIDXv01", 8);
+    memcpy(hdr.magic, IDX_MAGIC_V2, 8);
     hdr.table_size    = TABLE_SIZE;
     hdr.total_entries = total_entries;
 
     if (fwrite(&hdr, sizeof(Header), 1, idx) != 1) { perror("write header"); return EXIT_FAILURE; }
 
-    // Directorio (placeholders)
+    // Directorio y tabla de checksums (placeholders)
     DirEntry *dir = (DirEntry*)calloc(TABLE_SIZE, sizeof(DirEntry));
-    if (!dir) { perror("sin memoria dir"); return EXIT_FAILURE; }
+    uint32_t *crc = (uint32_t*)calloc(1, IDX_CRC_BYTES(TABLE_SIZE));
+    if (!dir || !crc) { perror("sin memoria dir"); return EXIT_FAILURE; }
     long dir_pos = ftell(idx);
-    if (fwrite(dir, sizeof(DirEntry), TABLE_SIZE, idx) != (size_t)TABLE_SIZE) {
+    if (fwrite(dir, sizeof(DirEntry), TABLE_SIZE, idx) != (size_t)TABLE_SIZE ||
+        fwrite(crc, 1, IDX_CRC_BYTES(TABLE_SIZE), idx) != IDX_CRC_BYTES(TABLE_SIZE)) {
         perror("write dir placeholders"); return EXIT_FAILURE;
     }
 
     // 5) Para cada bucket: ordenar por id y escribir bloque; registrar offset y count
+    uint64_t live_entries = 0;
     for (int i=0; i<TABLE_SIZE; ++i) {
         // tamaño en pares
+        double ts = now_s();
         if (fflush(tmp[i]) != 0) { perror("fflush tmp"); return EXIT_FAILURE; }
         if (fseeko(tmp[i], 0, SEEK_END) != 0) { perror("seek end tmp"); return EXIT_FAILURE; }
         off_t sz = ftello(tmp[i]);
         uint64_t count = (uint64_t)(sz / (off_t)sizeof(Pair));
-        dir[i].bucket_count = count;
+        dir[i].bucket_count = 0;
 
         if (count == 0) { // bucket vacío
             // dejar offset=0, count=0
+            t_sort += now_s() - ts;
             continue;
         }
 
@@ -172,22 +231,80 @@ int main(int argc, char **argv) {
         if (rd != (size_t)count) { perror("fread tmp"); return EXIT_FAILURE; }
 
         qsort(buf, (size_t)count, sizeof(Pair), cmp_pair_id);
+        // Ids repetidos (UPDATE en el servidor): sólo la última fila; sin el id si fue borrado
+        uint64_t kept = 0;
+        for (uint64_t k = 0; k < count; ++k)
+            if ((k + 1 == count || buf[k + 1].id != buf[k].id) && !(buf[k].offset & IDX_DEAD))
+                buf[kept++] = buf[k];
+        count = kept;
+        dir[i].bucket_count = count;
+        live_entries += count;
+        // Rango de los ids vivos (el bucket está ordenado) para decidir la tabla densa
+        if (count && buf[0].id < min_id) min_id = buf[0].id;
+        if (count && buf[count - 1].id > max_id) max_id = buf[count - 1].id;
+        double tw = now_s();
+        t_sort += tw - ts;
 
         dir[i].bucket_offset = (uint64_t)ftello(idx);
+        crc[i] = crc32c(0, buf, (size_t)count * sizeof(Pair));
         if (fwrite(buf, sizeof(Pair), (size_t)count, idx) != (size_t)count) {
             perror("write bucket"); return EXIT_FAILURE;
         }
         free(buf);
+        t_write += now_s() - tw;
     }
 
-    // 6) Reescribir directorio con offsets reales
-    if (fseeko(idx, dir_pos, SEEK_SET) != 0) { perror("seek dir"); return EXIT_FAILURE; }
-    if (fwrite(dir, sizeof(DirEntry), TABLE_SIZE, idx) != (size_t)TABLE_SIZE) {
+    // Ids densos: además del índice por hash, tabla directa <books.idx>.dense (ver idx_dense.h).
+    // Se decide con los ids vivos, ya sin filas sustituidas ni borradas, y se llena releyendo
+    // los buckets escritos. Si no lo son se borra la que hubiera de un índice anterior.
+    double tw = now_s();
+    char dense_path[4096];
+    snprintf(dense_path, sizeof(dense_path), "%s.dense", idx_path);
+    uint64_t slots = 0;
+    DenseHeader *dense = NULL;
+    if (dense_plan(min_id, max_id, live_entries, dense_min, &slots)) {
+        dense = dense_create(dense_path, min_id, slots);
+        if (!dense) { perror("No se pudo crear la tabla densa"); return EXIT_FAILURE; }
+        if (fflush(idx) != 0) { perror("fflush idx"); return EXIT_FAILURE; }
+        Pair chunk[4096];
+        for (int i=0; i<TABLE_SIZE; ++i) {
+            uint64_t left = dir[i].bucket_count;
+            if (left && fseeko(idx, (off_t)dir[i].bucket_offset, SEEK_SET) != 0) { perror("seek bucket"); return EXIT_FAILURE; }
+            while (left) {
+                size_t n = left < 4096 ? (size_t)left : 4096;
+                if (fread(chunk, sizeof(Pair), n, idx) != n) { perror("read bucket"); return EXIT_FAILURE; }
+                for (size_t k = 0; k < n; ++k) {
+                    uint64_t s = chunk[k].id - min_id;
+                    dense_offsets(dense)[s] = chunk[k].offset;
+                    dense_bits(dense)[s >> 6] |= 1ull << (s & 63);
+                    dense->count++;
+                }
+                left -= n;
+            }
+        }
+    } else {
+        remove(dense_path);
+    }
+
+    // 6) Reescribir cabecera (entradas vivas), directorio con offsets reales y checksums
+    total_entries = hdr.total_entries = live_entries;
+    crc[TABLE_SIZE] = idx_header_crc(&hdr, sizeof(hdr), dir, TABLE_SIZE * sizeof(DirEntry), crc, TABLE_SIZE);
+    if (fseeko(idx, 0, SEEK_SET) != 0) { perror("seek header"); return EXIT_FAILURE; }
+    if (fwrite(&hdr, sizeof(Header), 1, idx) != 1 || ftello(idx) != dir_pos ||
+        fwrite(dir, sizeof(DirEntry), TABLE_SIZE, idx) != (size_t)TABLE_SIZE ||
+        fwrite(crc, 1, IDX_CRC_BYTES(TABLE_SIZE), idx) != IDX_CRC_BYTES(TABLE_SIZE)) {
         perror("rewrite dir"); return EXIT_FAILURE;
     }
     fflush(idx);
     fclose(idx);
     free(dir);
+    free(crc);
+    if (dense) {
+        dense->csv_end = csv_bytes;
+        if (msync(dense, dense_file_bytes(slots), MS_SYNC) != 0) { perror("msync dense"); return EXIT_FAILURE; }
+        munmap(dense, dense_file_bytes(slots));
+    }
+    t_write += now_s() - tw;
 
     // 7) Cerrar y borrar temporales
     for (int i=0; i<TABLE_SIZE; ++i) {
@@ -197,11 +314,29 @@ int main(int argc, char **argv) {
         remove(name);
     }
 
+    double t_total = now_s() - t_start;
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+
     fprintf(stderr,
             "OK: índice creado '%s'\n"
             "  buckets      : %d\n"
-            "  total entries: %" PRIu64 "\n",
-            idx_path, TABLE_SIZE, total_entries);
+            "  total entries: %" PRIu64 "\n"
+            "  tiempo total : %.3f s (%.0f filas/s, %.1f MB/s)\n"
+            "  fase scan    : %.3f s\n"
+            "  fase partic. : %.3f s\n"
+            "  fase sort    : %.3f s\n"
+            "  fase write   : %.3f s\n"
+            "  RSS máximo   : %ld KB\n"
+            "  tabla densa  : %s\n",
+            idx_path, TABLE_SIZE, total_entries,
+            t_total, t_total > 0 ? (double)total_entries / t_total : 0.0,
+            t_total > 0 ? (double)csv_bytes / 1e6 / t_total : 0.0,
+            t_scan, t_partition, t_sort, t_write,
+            ru.ru_maxrss, dense ? dense_path : "no");
+    if (dense)
+        fprintf(stderr, "  ranuras      : %" PRIu64 " desde id %" PRIu64 " (%.1f%% ocupadas)\n",
+                slots, min_id, 100.0 * (double)total_entries / (double)slots);
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,302 @@
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TABLE_SIZE 1000
+#define DESC_MAX   8192 // tope de longitud de la descripción
+
+// Cabecera idéntica a books_validos.csv (22 columnas)
+static const char *CSV_HEADER =
+    "Id,RatingDistTotal,RatingDist5,PublishDay,Name,PublishMonth,RatingDist4,RatingDist1,"
+    "RatingDist2,CountsOfReview,Authors,RatingDist3,PublishYear,source_file,Publisher,"
+    "Language,ISBN,Description,Rating,pagesNumber,Count of text reviews,PagesNumber\n";
+
+// Vocabulario para títulos, autores y descripciones (sin comas: el CSV no usa comillas)
+static const char *WORDS[] = {
+    "the", "of", "and", "a", "to", "in", "is", "story", "life", "world", "love", "war",
+    "history", "secret", "night", "house", "journey", "family", "king", "city", "river",
+    "dark", "light", "time", "new", "lost", "last", "first", "heart", "mind", "science",
+    "guide", "complete", "art", "young", "old", "man", "woman", "children", "road", "sea",
+    "book", "tale", "garden", "stone", "fire", "shadow", "dream", "truth", "power", "game",
+    "with", "from", "an", "her", "his", "their", "who", "that", "this", "was", "novel",
+    "author", "reader", "classic", "edition", "volume", "series", "mystery", "adventure"};
+#define NWORDS (sizeof(WORDS) / sizeof(WORDS[0]))
+
+static const char *FIRST[] = {"John", "Mary", "Ana", "Luis", "Peter", "Jane", "Carlos", "Laura",
+                              "David", "Sofia", "James", "Emma", "Jorge", "Lucia", "Paul"};
+static const char *LAST[] = {"Smith", "Garcia", "Brown", "Rojas", "Miller", "Lopez", "Wilson",
+                             "Martin", "Taylor", "Gomez", "Clark", "Diaz", "Lewis", "Moreno"};
+static const char *PUBLISHERS[] = {"Penguin Books", "Vintage", "HarperCollins", "Random House",
+                                   "Back Bay Books", "Tor Books", "Oxford University Press",
+                                   "Simon & Schuster", "Scholastic", "Bantam"};
+static const char *LANGS[] = {"eng", "eng", "eng", "eng", "spa", "fre", "ger", "en-US", "en-GB", ""};
+
+typedef enum
+{
+    IDS_SEQ,      // 1..N en orden
+    IDS_SHUFFLED, // permutación de 1..N
+    IDS_SPARSE,   // crecientes con huecos aleatorios
+    IDS_SKEWED    // una fracción cae siempre en el mismo bucket
+} IdDist;
+
+typedef enum
+{
+    DESC_FIXED,
+    DESC_UNIFORM,
+    DESC_LOGNORMAL
+} DescDist;
+
+// ====== PRNG (xorshift64*) ======
+static uint64_t g_rng = 0x9E3779B97F4A7C15ull;
+
+static inline uint64_t rng_next(void)
+{
+    uint64_t x = g_rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    g_rng = x;
+    return x * 2685821657736338717ull;
+}
+
+static inline double rng_unit(void)
+{
+    return (double)(rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline uint64_t rng_range(uint64_t lo, uint64_t hi)
+{
+    return lo + rng_next() % (hi - lo + 1);
+}
+
+// Normal estándar (Box-Muller)
+static double rng_normal(void)
+{
+    double u1 = rng_unit(), u2 = rng_unit();
+    if (u1 < 1e-300)
+        u1 = 1e-300;
+    return sqrt(-2.0 * log(u1)) * cos(6.283185307179586 * u2);
+}
+
+static uint64_t gcd_u64(uint64_t a, uint64_t b)
+{
+    while (b)
+    {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Escribe n palabras aleatorias separadas por espacio; devuelve bytes escritos
+static size_t put_words(char *dst, size_t cap, size_t max_len)
+{
+    size_t len = 0;
+    while (len < max_len)
+    {
+        const char *w = WORDS[rng_next() % NWORDS];
+        size_t wl = strlen(w);
+        if (len + wl + 1 >= cap || len + wl > max_len)
+            break;
+        if (len)
+            dst[len++] = ' ';
+        memcpy(dst + len, w, wl);
+        len += wl;
+    }
+    dst[len] = '\0';
+    return len;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Uso: %s <salida.csv> <filas> [opciones]\n"
+            "Opciones:\n"
+            "  --ids=seq|shuffled|sparse[:hueco]|skewed[:fracción]   distribución de ids (shuffled)\n"
+            "  --desc=fixed:N|uniform:MIN:MAX|lognormal:MEDIA        longitud de Description (lognormal:450)\n"
+            "  --seed=N                                              semilla (1)\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *out_path = argv[1];
+    uint64_t rows = strtoull(argv[2], NULL, 10);
+
+    IdDist ids = IDS_SHUFFLED;
+    double sparse_gap = 8.0;  // hueco medio entre ids consecutivos (sparse)
+    double skew_frac = 0.2;   // fracción de ids que caen en el bucket caliente (skewed)
+    DescDist desc = DESC_LOGNORMAL;
+    size_t desc_a = 450, desc_b = 0;
+    uint64_t seed = 1;
+
+    for (int i = 3; i < argc; ++i)
+    {
+        const char *a = argv[i];
+        if (strcmp(a, "--ids=seq") == 0)
+            ids = IDS_SEQ;
+        else if (strcmp(a, "--ids=shuffled") == 0)
+            ids = IDS_SHUFFLED;
+        else if (strncmp(a, "--ids=sparse", 12) == 0)
+        {
+            ids = IDS_SPARSE;
+            if (a[12] == ':')
+                sparse_gap = atof(a + 13);
+        }
+        else if (strncmp(a, "--ids=skewed", 12) == 0)
+        {
+            ids = IDS_SKEWED;
+            if (a[12] == ':')
+                skew_frac = atof(a + 13);
+        }
+        else if (sscanf(a, "--desc=fixed:%zu", &desc_a) == 1)
+            desc = DESC_FIXED;
+        else if (sscanf(a, "--desc=uniform:%zu:%zu", &desc_a, &desc_b) == 2)
+            desc = DESC_UNIFORM;
+        else if (sscanf(a, "--desc=lognormal:%zu", &desc_a) == 1)
+            desc = DESC_LOGNORMAL;
+        else if (strncmp(a, "--seed=", 7) == 0)
+            seed = strtoull(a + 7, NULL, 10);
+        else
+        {
+            fprintf(stderr, "Opción desconocida: %s\n", a);
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (rows == 0 || sparse_gap < 1.0 || skew_frac < 0.0 || skew_frac > 1.0 ||
+        (desc == DESC_UNIFORM && desc_b < desc_a))
+    {
+        fprintf(stderr, "Parámetros fuera de rango\n");
+        return EXIT_FAILURE;
+    }
+    g_rng ^= seed * 0xBF58476D1CE4E5B9ull;
+    if (g_rng == 0)
+        g_rng = 1;
+
+    FILE *out = fopen(out_path, "w");
+    if (!out)
+    {
+        perror("No se pudo crear CSV");
+        return EXIT_FAILURE;
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+    fputs(CSV_HEADER, out);
+
+    // Permutación de 1..N sin tabla: i -> (i * paso + base) mod N con paso coprimo con N
+    uint64_t perm_step = 1, perm_base = 0;
+    if (ids == IDS_SHUFFLED && rows > 1)
+    {
+        perm_step = rng_range(rows / 3 + 1, rows - 1) | 1;
+        while (gcd_u64(perm_step, rows) != 1)
+            perm_step++;
+        perm_base = rng_next() % rows;
+    }
+    // skewed: los ids calientes son ≡ HOT (mod TABLE_SIZE) y comparten bucket
+    // (h(id) = id * 2654435761 mod 1000 sólo depende de id mod 1000 mientras no desborde)
+    const uint64_t HOT = 7;
+    uint64_t hot_next = HOT, cold_next = 0, sparse_next = 0;
+
+    char *descbuf = (char *)malloc(DESC_MAX + 1);
+    char name[128];
+    if (!descbuf)
+    {
+        perror("sin memoria");
+        return EXIT_FAILURE;
+    }
+
+    uint64_t bytes = strlen(CSV_HEADER);
+    for (uint64_t i = 0; i < rows; ++i)
+    {
+        uint64_t id;
+        switch (ids)
+        {
+        case IDS_SEQ:
+            id = i + 1;
+            break;
+        case IDS_SHUFFLED:
+            id = ((i * perm_step + perm_base) % rows) + 1;
+            break;
+        case IDS_SPARSE:
+            sparse_next += 1 + (uint64_t)(-log(1.0 - rng_unit()) * (sparse_gap - 1.0));
+            id = sparse_next;
+            break;
+        default:
+            if (rng_unit() < skew_frac)
+            {
+                id = hot_next;
+                hot_next += TABLE_SIZE;
+            }
+            else
+            {
+                do
+                    cold_next++;
+                while (cold_next % TABLE_SIZE == HOT);
+                id = cold_next;
+            }
+            break;
+        }
+
+        size_t dlen;
+        if (desc == DESC_FIXED)
+            dlen = desc_a;
+        else if (desc == DESC_UNIFORM)
+            dlen = (size_t)rng_range(desc_a, desc_b);
+        else
+        {
+            // Lognormal con sigma 0.8 y media desc_a: mu = ln(media) - sigma^2/2
+            double v = exp(log((double)desc_a) - 0.32 + 0.8 * rng_normal());
+            dlen = (size_t)v;
+        }
+        if (dlen > DESC_MAX)
+            dlen = DESC_MAX;
+        put_words(descbuf, DESC_MAX + 1, dlen);
+        put_words(name, sizeof(name), (size_t)rng_range(8, 40));
+
+        unsigned r1 = (unsigned)rng_range(0, 5000), r2 = (unsigned)rng_range(0, 5000);
+        unsigned r3 = (unsigned)rng_range(0, 5000), r4 = (unsigned)rng_range(0, 5000);
+        unsigned r5 = (unsigned)rng_range(0, 5000);
+        unsigned total = r1 + r2 + r3 + r4 + r5;
+        unsigned pages = (unsigned)rng_range(40, 1200);
+
+        int n = fprintf(out,
+                        "%" PRIu64 ",total:%u,5:%u,%u,%s,%u,4:%u,1:%u,2:%u,%u,%s %s,3:%u,%u,"
+                        "book%" PRIu64 "k-%" PRIu64 "k.csv,%s,%s,%010" PRIu64 ",%s,%.2f,%u,%u,%s\n",
+                        id, total, r5, (unsigned)rng_range(1, 28), name, (unsigned)rng_range(1, 12),
+                        r4, r1, r2, (unsigned)rng_range(0, 900),
+                        FIRST[rng_next() % (sizeof(FIRST) / sizeof(FIRST[0]))],
+                        LAST[rng_next() % (sizeof(LAST) / sizeof(LAST[0]))],
+                        r3, (unsigned)rng_range(1900, 2021),
+                        (i / 100000) * 100, (i / 100000 + 1) * 100,
+                        PUBLISHERS[rng_next() % (sizeof(PUBLISHERS) / sizeof(PUBLISHERS[0]))],
+                        LANGS[rng_next() % (sizeof(LANGS) / sizeof(LANGS[0]))],
+                        (uint64_t)(rng_next() % 10000000000ull), descbuf, 1.0 + 4.0 * rng_unit(), pages,
+                        (unsigned)rng_range(0, 900), (rng_next() & 1) ? "" : "0");
+        if (n < 0)
+        {
+            perror("write csv");
+            return EXIT_FAILURE;
+        }
+        bytes += (uint64_t)n;
+    }
+
+    free(descbuf);
+    if (fclose(out) != 0)
+    {
+        perror("close csv");
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "OK: %" PRIu64 " filas, %.1f MB en '%s'\n", rows, (double)bytes / 1e6, out_path);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,945 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "idx_shm.h"
+
+// ====== Estructuras del índice (mismo formato que build_index / idx_server) ======
+typedef struct
+{
+    uint64_t id;
+    uint64_t offset;
+} Pair;
+
+typedef struct
+{
+    char magic[8];          // "BKIDXv01" o "BKIDXv02"
+    uint64_t table_size;    // 1000
+    uint64_t total_entries; // N
+} Header;
+
+typedef struct
+{
+    uint64_t bucket_offset; // desplazamiento en books.idx
+    uint64_t bucket_count;  // nº de pares
+} DirEntry;
+
+// Línea que cierra la ficha de un GET con resultado
+#define CARD_END "----------------------------------------"
+#define RESP_BUF 65536
+
+// ====== Configuración ======
+typedef enum
+{
+    DIST_UNIFORM,
+    DIST_ZIPF,
+    DIST_TRACE
+} Dist;
+
+typedef struct
+{
+    const char *host;
+    int port;
+    const char *idx_path;
+    int conns;          // conexiones totales
+    int threads;        // hilos que las reparten
+    double duration_s;  // duración de la medición
+    double rate;        // peticiones/s totales (0 = lazo cerrado)
+    double add_frac;    // fracción de ADD (0..1)
+    Dist dist;
+    double zipf_s;      // exponente Zipf
+    const char *trace;  // fichero de ids a reproducir
+    uint64_t seed;
+    bool shm;           // GET por los anillos de memoria compartida (host = socket Unix)
+} BenchOptions;
+
+static BenchOptions g_opt = {
+    .conns = 8,
+    .threads = 2,
+    .duration_s = 10.0,
+    .rate = 0.0,
+    .add_frac = 0.0,
+    .dist = DIST_UNIFORM,
+    .zipf_s = 0.99,
+    .seed = 42,
+};
+
+// ====== Ids de la carga ======
+static uint64_t *g_ids = NULL;  // ids reales leídos del índice (o de la traza)
+static size_t g_nids = 0;
+static double *g_zipf_cdf = NULL; // CDF acumulada para Zipf (rango -> prob.)
+static uint64_t g_next_add_id = 0; // primer id libre para los ADD
+
+// ====== Histogramas log-lineales (mismo esquema que STATS en idx_server) ======
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_SLOTS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct
+{
+    uint64_t counts[HIST_SLOTS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+} Histogram;
+
+static inline unsigned hist_slot(uint64_t v)
+{
+    if (v < HIST_SUB)
+        return (unsigned)v;
+    unsigned msb = 63u - (unsigned)__builtin_clzll(v);
+    unsigned shift = msb - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (unsigned)((v >> shift) & (HIST_SUB - 1));
+}
+
+static inline uint64_t hist_slot_value(unsigned slot)
+{
+    if (slot < HIST_SUB)
+        return slot;
+    unsigned shift = slot / HIST_SUB - 1;
+    uint64_t sub = slot % HIST_SUB;
+    return ((HIST_SUB + sub + 1) << shift) - 1;
+}
+
+static void hist_record(Histogram *h, uint64_t v)
+{
+    h->counts[hist_slot(v)]++;
+    h->total++;
+    h->sum += v;
+    if (v > h->max)
+        h->max = v;
+}
+
+static void hist_merge(Histogram *dst, const Histogram *src)
+{
+    for (unsigned i = 0; i < HIST_SLOTS; ++i)
+        dst->counts[i] += src->counts[i];
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+static uint64_t hist_percentile(const Histogram *h, double q)
+{
+    if (h->total == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(q * (double)h->total + 0.5);
+    if (rank == 0)
+        rank = 1;
+    uint64_t acc = 0;
+    for (unsigned i = 0; i < HIST_SLOTS; ++i)
+    {
+        acc += h->counts[i];
+        if (acc >= rank)
+        {
+            uint64_t v = hist_slot_value(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// ====== PRNG por hilo (xorshift64*) ======
+static inline uint64_t rng_next(uint64_t *s)
+{
+    uint64_t x = *s;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *s = x;
+    return x * 2685821657736338717ull;
+}
+
+static inline double rng_unit(uint64_t *s)
+{
+    return (double)(rng_next(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// ====== Carga de ids reales desde books.idx ======
+static int load_ids_from_index(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        perror("open idx");
+        return -1;
+    }
+    Header hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+        (memcmp(hdr.magic, "BKIDXv01", 8) != 0 && memcmp(hdr.magic, "BKIDXv02", 8) != 0))
+    {
+        fprintf(stderr, "Índice inválido o versión incompatible\n");
+        fclose(f);
+        return -1;
+    }
+    DirEntry *dir = (DirEntry *)malloc(sizeof(DirEntry) * hdr.table_size);
+    if (!dir || fread(dir, sizeof(DirEntry), (size_t)hdr.table_size, f) != (size_t)hdr.table_size)
+    {
+        perror("read dir");
+        free(dir);
+        fclose(f);
+        return -1;
+    }
+
+    uint64_t total = 0;
+    for (uint64_t b = 0; b < hdr.table_size; ++b)
+        total += dir[b].bucket_count;
+    g_ids = (uint64_t *)malloc(sizeof(uint64_t) * (total ? total : 1));
+    Pair *buf = NULL;
+    size_t buf_cap = 0;
+    uint64_t max_id = 0;
+    for (uint64_t b = 0; g_ids && b < hdr.table_size; ++b)
+    {
+        size_t count = (size_t)dir[b].bucket_count;
+        if (count == 0)
+            continue;
+        if (count > buf_cap)
+        {
+            Pair *tmp = (Pair *)realloc(buf, count * sizeof(Pair));
+            if (!tmp)
+                break;
+            buf = tmp;
+            buf_cap = count;
+        }
+        if (fseeko(f, (off_t)dir[b].bucket_offset, SEEK_SET) != 0 ||
+            fread(buf, sizeof(Pair), count, f) != count)
+        {
+            perror("read bucket");
+            break;
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            g_ids[g_nids++] = buf[i].id;
+            if (buf[i].id > max_id)
+                max_id = buf[i].id;
+        }
+    }
+    free(buf);
+    free(dir);
+    fclose(f);
+    if (!g_ids || g_nids == 0)
+    {
+        fprintf(stderr, "El índice no contiene ids\n");
+        return -1;
+    }
+    // Los ADD usan ids nuevos por encima del máximo para no chocar con duplicados
+    g_next_add_id = max_id + 1;
+    return 0;
+}
+
+// ====== Carga de una traza: un id por línea (o líneas "GET <id>") ======
+static int load_ids_from_trace(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        perror("open trace");
+        return -1;
+    }
+    size_t cap = 1 << 16;
+    uint64_t *ids = (uint64_t *)malloc(cap * sizeof(uint64_t));
+    size_t n = 0;
+    char line[256];
+    while (ids && fgets(line, sizeof(line), f))
+    {
+        const char *p = line;
+        if (strncmp(p, "GET ", 4) == 0)
+            p += 4;
+        char *end = NULL;
+        uint64_t id = strtoull(p, &end, 10);
+        if (end == p)
+            continue;
+        if (n == cap)
+        {
+            uint64_t *tmp = (uint64_t *)realloc(ids, 2 * cap * sizeof(uint64_t));
+            if (!tmp)
+                break;
+            ids = tmp;
+            cap *= 2;
+        }
+        ids[n++] = id;
+    }
+    fclose(f);
+    if (!ids || n == 0)
+    {
+        fprintf(stderr, "Traza vacía: %s\n", path);
+        free(ids);
+        return -1;
+    }
+    free(g_ids);
+    g_ids = ids;
+    g_nids = n;
+    return 0;
+}
+
+// Baraja los ids para que los rangos "calientes" de Zipf no coincidan con un bucket
+static void shuffle_ids(uint64_t seed)
+{
+    uint64_t s = seed | 1;
+    for (size_t i = g_nids - 1; i > 0; --i)
+    {
+        size_t j = (size_t)(rng_next(&s) % (i + 1));
+        uint64_t t = g_ids[i];
+        g_ids[i] = g_ids[j];
+        g_ids[j] = t;
+    }
+}
+
+static int build_zipf_cdf(double s)
+{
+    g_zipf_cdf = (double *)malloc(sizeof(double) * g_nids);
+    if (!g_zipf_cdf)
+        return -1;
+    double acc = 0.0;
+    for (size_t i = 0; i < g_nids; ++i)
+    {
+        acc += 1.0 / pow((double)(i + 1), s);
+        g_zipf_cdf[i] = acc;
+    }
+    for (size_t i = 0; i < g_nids; ++i)
+        g_zipf_cdf[i] /= acc;
+    return 0;
+}
+
+// ====== Estado por conexión y por hilo ======
+typedef struct
+{
+    int fd;
+    IdxShm *shm;        // sesión de memoria compartida (--shm; fd queda en -1)
+    bool busy;          // hay una petición en vuelo
+    int kind;           // 0 = GET, 1 = ADD
+    uint64_t intended;  // instante programado (lazo abierto) o de envío
+    uint64_t sent;      // instante real de envío
+    uint64_t next_due;  // próxima petición programada (lazo abierto)
+    size_t trace_pos;   // posición en la traza (modo trace)
+    char buf[RESP_BUF];
+    size_t len;
+} Conn;
+
+typedef struct
+{
+    int index;
+    int nconns;
+    Conn *conns;
+    uint64_t rng;
+    uint64_t add_next; // siguiente id para ADD (espaciado por hilo)
+    uint64_t add_step;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    double rate_per_conn;
+    // Resultados
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t misses;
+    uint64_t net_errors;
+    Histogram lat_get;     // GET con resultado
+    Histogram lat_miss;    // GET NOTFOUND
+    Histogram lat_add;     // ADD
+    Histogram lat_all;     // todas (corregida por omisión coordinada)
+    Histogram service_all; // todas, desde el envío real
+} Worker;
+
+// Conexión al socket Unix del servidor (--unix=RUTA); -1 si falla
+static int connect_unix(const char *path)
+{
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sa.sun_path))
+    {
+        fprintf(stderr, "Ruta de socket Unix demasiado larga\n");
+        return -1;
+    }
+    strcpy(sa.sun_path, path);
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    if (connect(s, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+    {
+        perror("connect");
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+static int connect_server(const char *host, int port)
+{
+    // Un host que empieza por '/' es la ruta del socket Unix del servidor (el puerto se ignora)
+    if (host[0] == '/')
+        return connect_unix(host);
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, host, &sa.sin_addr) != 1)
+    {
+        fprintf(stderr, "IP inválida\n");
+        close(s);
+        return -1;
+    }
+    if (connect(s, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+    {
+        perror("connect");
+        close(s);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return s;
+}
+
+static uint64_t pick_id(Worker *w, Conn *c)
+{
+    switch (g_opt.dist)
+    {
+    case DIST_ZIPF:
+    {
+        double u = rng_unit(&w->rng);
+        size_t lo = 0, hi = g_nids - 1;
+        while (lo < hi)
+        {
+            size_t mid = lo + ((hi - lo) >> 1);
+            if (g_zipf_cdf[mid] < u)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return g_ids[lo];
+    }
+    case DIST_TRACE:
+    {
+        uint64_t id = g_ids[c->trace_pos];
+        c->trace_pos = (c->trace_pos + 1) % g_nids;
+        return id;
+    }
+    default:
+        return g_ids[rng_next(&w->rng) % g_nids];
+    }
+}
+
+// Envía la siguiente petición por la conexión (GET o ADD según add_frac)
+static int send_request(Worker *w, Conn *c, uint64_t intended)
+{
+    char cmd[256];
+    int n;
+    if (g_opt.add_frac > 0.0 && rng_unit(&w->rng) < g_opt.add_frac)
+    {
+        // Fila corta de 22 campos: cabe en la línea de comando del servidor
+        uint64_t id = w->add_next;
+        w->add_next += w->add_step;
+        n = snprintf(cmd, sizeof(cmd),
+                     "ADD %" PRIu64 ",total:0,5:0,1,idx_bench,1,4:0,1:0,2:0,0,idx_bench,3:0,2025,"
+                     "idx_bench,idx_bench,eng,0,,0.0,0,0,\n",
+                     id);
+        c->kind = 1;
+    }
+    else
+    {
+        n = snprintf(cmd, sizeof(cmd), "GET %" PRIu64 "\n", pick_id(w, c));
+        c->kind = 0;
+    }
+    c->intended = intended;
+    c->sent = now_ns();
+    c->len = 0;
+    if (send(c->fd, cmd, (size_t)n, MSG_NOSIGNAL) != n)
+        return -1;
+    c->busy = true;
+    return 0;
+}
+
+// Devuelve 1 si en c->buf hay una respuesta completa; deja en *status su tipo
+// (0 = OK, 1 = NOTFOUND, 2 = ERR)
+static int response_complete(Conn *c, int *status)
+{
+    char *nl = memchr(c->buf, '\n', c->len);
+    if (!nl)
+        return 0;
+    size_t first = (size_t)(nl - c->buf);
+    if (first == 2 && memcmp(c->buf, "OK", 2) == 0)
+    {
+        // Ficha de GET: termina en la línea de guiones
+        c->buf[c->len] = '\0';
+        if (!strstr(c->buf, "\n" CARD_END "\n"))
+            return 0;
+        *status = 0;
+        return 1;
+    }
+    if (strncmp(c->buf, "NOTFOUND", 8) == 0)
+        *status = 1;
+    else if (strncmp(c->buf, "OK", 2) == 0)
+        *status = 0;
+    else
+        *status = 2;
+    return 1;
+}
+
+static void complete_request(Worker *w, Conn *c, int status, uint64_t done)
+{
+    uint64_t lat = done - c->intended;
+    if (c->kind == 1)
+        hist_record(&w->lat_add, lat);
+    else if (status == 1)
+        hist_record(&w->lat_miss, lat);
+    else
+        hist_record(&w->lat_get, lat);
+    hist_record(&w->lat_all, lat);
+    hist_record(&w->service_all, done - c->sent);
+    w->requests++;
+    if (status == 1)
+        w->misses++;
+    if (status == 2)
+        w->errors++;
+    c->busy = false;
+}
+
+static void *worker_main(void *arg)
+{
+    Worker *w = (Worker *)arg;
+    bool open_loop = w->rate_per_conn > 0.0;
+    uint64_t period = open_loop ? (uint64_t)(1e9 / w->rate_per_conn) : 0;
+    struct pollfd *pfds = (struct pollfd *)calloc((size_t)w->nconns, sizeof(struct pollfd));
+    if (!pfds)
+        return NULL;
+
+    // Todos los hilos arrancan en el mismo instante
+    uint64_t t = now_ns();
+    if (t < w->start_ns)
+    {
+        struct timespec ts = {(time_t)((w->start_ns - t) / 1000000000ull), (long)((w->start_ns - t) % 1000000000ull)};
+        nanosleep(&ts, NULL);
+    }
+
+    // Desfasa el arranque de cada conexión para no enviar todas a la vez
+    for (int i = 0; i < w->nconns; ++i)
+        w->conns[i].next_due = w->start_ns + (open_loop ? period * (uint64_t)i / (uint64_t)w->nconns : 0);
+
+    for (;;)
+    {
+        uint64_t now = now_ns();
+        bool stopping = now >= w->end_ns;
+        int inflight = 0;
+        uint64_t wake = UINT64_MAX;
+
+        for (int i = 0; i < w->nconns; ++i)
+        {
+            Conn *c = &w->conns[i];
+            if (c->fd < 0)
+                continue;
+            if (!c->busy && !stopping)
+            {
+                if (!open_loop)
+                {
+                    if (send_request(w, c, now_ns()) != 0)
+                    {
+                        w->net_errors++;
+                        close(c->fd);
+                        c->fd = -1;
+                        continue;
+                    }
+                }
+                else if (now >= c->next_due)
+                {
+                    // Lazo abierto: la latencia se mide desde el instante programado,
+                    // aunque la conexión haya quedado ocupada más allá de él
+                    // (corrección de omisión coordinada).
+                    uint64_t due = c->next_due;
+                    c->next_due += period;
+                    if (send_request(w, c, due) != 0)
+                    {
+                        w->net_errors++;
+                        close(c->fd);
+                        c->fd = -1;
+                        continue;
+                    }
+                }
+                else if (c->next_due < wake)
+                {
+                    wake = c->next_due;
+                }
+            }
+            if (c->busy)
+                inflight++;
+        }
+        if (stopping && inflight == 0)
+            break;
+
+        int nfds = 0;
+        for (int i = 0; i < w->nconns; ++i)
+        {
+            pfds[i].fd = (w->conns[i].fd >= 0 && w->conns[i].busy) ? w->conns[i].fd : -1;
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+            if (pfds[i].fd >= 0)
+                nfds++;
+        }
+        // Espera con resolución de ns hasta la próxima petición programada
+        uint64_t timeout_ns = 100000000ull;
+        if (wake != UINT64_MAX)
+        {
+            uint64_t t = now_ns();
+            timeout_ns = wake > t ? wake - t : 0;
+        }
+        if (stopping)
+        {
+            // Espera como máximo 2 s a las respuestas pendientes
+            if (now > w->end_ns + 2000000000ull)
+                break;
+            timeout_ns = 100000000ull;
+        }
+        if (nfds == 0 && wake == UINT64_MAX && !stopping)
+            break; // todas las conexiones cayeron
+        struct timespec tmo = {(time_t)(timeout_ns / 1000000000ull), (long)(timeout_ns % 1000000000ull)};
+        if (ppoll(pfds, (nfds_t)w->nconns, &tmo, NULL) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("ppoll");
+            break;
+        }
+
+        for (int i = 0; i < w->nconns; ++i)
+        {
+            if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            Conn *c = &w->conns[i];
+            ssize_t r = recv(c->fd, c->buf + c->len, RESP_BUF - 1 - c->len, 0);
+            if (r <= 0)
+            {
+                w->net_errors++;
+                close(c->fd);
+                c->fd = -1;
+                c->busy = false;
+                continue;
+            }
+            c->len += (size_t)r;
+            int status = 0;
+            if (response_complete(c, &status) || c->len >= RESP_BUF - 1)
+                complete_request(w, c, status, now_ns());
+        }
+    }
+    free(pfds);
+    return NULL;
+}
+
+// ====== Lazo cerrado por memoria compartida (--shm) ======
+// Los anillos no tienen descriptor que vigilar con poll: cada hilo envía un GET por cada una
+// de sus sesiones y después recoge las respuestas en orden, así que cada sesión lleva
+// siempre una petición en vuelo, como una conexión en lazo cerrado.
+static void *shm_worker_main(void *arg)
+{
+    Worker *w = (Worker *)arg;
+    char *reply = (char *)malloc(IDX_SHM_MAX_REPLY);
+    if (!reply)
+        return NULL;
+
+    uint64_t t = now_ns();
+    if (t < w->start_ns)
+    {
+        struct timespec ts = {(time_t)((w->start_ns - t) / 1000000000ull), (long)((w->start_ns - t) % 1000000000ull)};
+        nanosleep(&ts, NULL);
+    }
+
+    while (now_ns() < w->end_ns)
+    {
+        int live = 0;
+        for (int i = 0; i < w->nconns; ++i)
+        {
+            Conn *c = &w->conns[i];
+            if (!c->shm)
+                continue;
+            char cmd[48];
+            snprintf(cmd, sizeof(cmd), "GET %" PRIu64, pick_id(w, c));
+            c->kind = 0;
+            c->intended = c->sent = now_ns();
+            if (idx_shm_send(c->shm, cmd) != 0)
+            {
+                w->net_errors++;
+                idx_shm_close(c->shm);
+                c->shm = NULL;
+                continue;
+            }
+            c->busy = true;
+            live++;
+        }
+        if (live == 0)
+            break; // todas las sesiones cayeron
+        for (int i = 0; i < w->nconns; ++i)
+        {
+            Conn *c = &w->conns[i];
+            if (!c->shm || !c->busy)
+                continue;
+            ssize_t n = idx_shm_recv(c->shm, reply, IDX_SHM_MAX_REPLY);
+            if (n < 0 && n != -2)
+            {
+                w->net_errors++;
+                idx_shm_close(c->shm);
+                c->shm = NULL;
+                c->busy = false;
+                continue;
+            }
+            int status = 2;
+            if (n >= 8 && memcmp(reply, "NOTFOUND", 8) == 0)
+                status = 1;
+            else if (n >= 2 && memcmp(reply, "OK", 2) == 0)
+                status = 0;
+            complete_request(w, c, status, now_ns());
+        }
+    }
+    free(reply);
+    return NULL;
+}
+
+// ====== Salida JSON ======
+static void print_hist_json(const char *name, const Histogram *h, bool last)
+{
+    printf("    \"%s\": {\"count\": %" PRIu64 ", \"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, "
+           "\"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}%s\n",
+           name, h->total, h->total ? (double)h->sum / (double)h->total / 1e3 : 0.0,
+           (double)hist_percentile(h, 0.50) / 1e3, (double)hist_percentile(h, 0.90) / 1e3,
+           (double)hist_percentile(h, 0.99) / 1e3, (double)hist_percentile(h, 0.999) / 1e3,
+           (double)h->max / 1e3, last ? "" : ",");
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Uso: %s <host|/ruta.sock> <port> <books.idx> [opciones]\n"
+            "Opciones:\n"
+            "  --conns=N          conexiones totales (8)\n"
+            "  --threads=M        hilos que reparten las conexiones (2)\n"
+            "  --duration=S       segundos de medición (10)\n"
+            "  --rate=R           peticiones/s totales en lazo abierto (0 = lazo cerrado)\n"
+            "  --dist=uniform|zipf[:s]|trace:FICHERO   distribución de ids (uniform)\n"
+            "  --add-frac=F       fracción de ADD entre 0 y 1 (0)\n"
+            "  --seed=N           semilla del generador (42)\n"
+            "  --shm              GET por memoria compartida (host = socket Unix; lazo cerrado, sin ADD)\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    g_opt.host = argv[1];
+    g_opt.port = atoi(argv[2]);
+    g_opt.idx_path = argv[3];
+
+    for (int i = 4; i < argc; ++i)
+    {
+        const char *a = argv[i];
+        if (strncmp(a, "--conns=", 8) == 0)
+            g_opt.conns = atoi(a + 8);
+        else if (strncmp(a, "--threads=", 10) == 0)
+            g_opt.threads = atoi(a + 10);
+        else if (strncmp(a, "--duration=", 11) == 0)
+            g_opt.duration_s = atof(a + 11);
+        else if (strncmp(a, "--rate=", 7) == 0)
+            g_opt.rate = atof(a + 7);
+        else if (strncmp(a, "--add-frac=", 11) == 0)
+            g_opt.add_frac = atof(a + 11);
+        else if (strncmp(a, "--seed=", 7) == 0)
+            g_opt.seed = strtoull(a + 7, NULL, 10);
+        else if (strcmp(a, "--shm") == 0)
+            g_opt.shm = true;
+        else if (strcmp(a, "--dist=uniform") == 0)
+            g_opt.dist = DIST_UNIFORM;
+        else if (strncmp(a, "--dist=zipf", 11) == 0)
+        {
+            g_opt.dist = DIST_ZIPF;
+            if (a[11] == ':')
+                g_opt.zipf_s = atof(a + 12);
+        }
+        else if (strncmp(a, "--dist=trace:", 13) == 0)
+        {
+            g_opt.dist = DIST_TRACE;
+            g_opt.trace = a + 13;
+        }
+        else
+        {
+            fprintf(stderr, "Opción desconocida: %s\n", a);
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (g_opt.conns < 1 || g_opt.threads < 1 || g_opt.duration_s <= 0.0 ||
+        g_opt.add_frac < 0.0 || g_opt.add_frac > 1.0)
+    {
+        fprintf(stderr, "Parámetros fuera de rango\n");
+        return EXIT_FAILURE;
+    }
+    // Los anillos sólo atienden GET y se negocian por el socket Unix
+    if (g_opt.shm && (g_opt.host[0] != '/' || g_opt.rate > 0.0 || g_opt.add_frac > 0.0))
+    {
+        fprintf(stderr, "--shm necesita la ruta del socket Unix como host, sin --rate ni --add-frac\n");
+        return EXIT_FAILURE;
+    }
+    if (g_opt.threads > g_opt.conns)
+        g_opt.threads = g_opt.conns;
+
+    // Ids reales del índice (también fijan el primer id libre para ADD)
+    if (load_ids_from_index(g_opt.idx_path) != 0)
+        return EXIT_FAILURE;
+    if (g_opt.dist == DIST_TRACE && load_ids_from_trace(g_opt.trace) != 0)
+        return EXIT_FAILURE;
+    if (g_opt.dist == DIST_ZIPF)
+    {
+        shuffle_ids(g_opt.seed);
+        if (build_zipf_cdf(g_opt.zipf_s) != 0)
+        {
+            perror("sin memoria zipf");
+            return EXIT_FAILURE;
+        }
+    }
+    fprintf(stderr, "idx_bench: %zu ids, %d %s, %d hilos, %s\n", g_nids, g_opt.conns,
+            g_opt.shm ? "sesiones shm" : "conexiones", g_opt.threads, g_opt.rate > 0.0 ? "lazo abierto" : "lazo cerrado");
+
+    // Reparte las conexiones entre los hilos
+    Worker *workers = (Worker *)calloc((size_t)g_opt.threads, sizeof(Worker));
+    Conn *conns = (Conn *)calloc((size_t)g_opt.conns, sizeof(Conn));
+    if (!workers || !conns)
+    {
+        perror("sin memoria");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < g_opt.conns; ++i)
+    {
+        conns[i].fd = -1;
+        if (g_opt.shm)
+        {
+            conns[i].shm = idx_shm_connect(g_opt.host);
+            if (!conns[i].shm)
+            {
+                perror("idx_shm_connect");
+                return EXIT_FAILURE;
+            }
+        }
+        else if ((conns[i].fd = connect_server(g_opt.host, g_opt.port)) < 0)
+            return EXIT_FAILURE;
+        conns[i].trace_pos = (g_nids * (size_t)i) / (size_t)g_opt.conns;
+    }
+
+    uint64_t start = now_ns() + 50000000ull; // 50 ms para arrancar los hilos
+    uint64_t end = start + (uint64_t)(g_opt.duration_s * 1e9);
+    int assigned = 0;
+    for (int t = 0; t < g_opt.threads; ++t)
+    {
+        Worker *w = &workers[t];
+        int n = g_opt.conns / g_opt.threads + (t < g_opt.conns % g_opt.threads ? 1 : 0);
+        w->index = t;
+        w->conns = &conns[assigned];
+        w->nconns = n;
+        assigned += n;
+        w->rng = (g_opt.seed + 1) * 0x9E3779B97F4A7C15ull + (uint64_t)t;
+        w->add_next = g_next_add_id + (uint64_t)t;
+        w->add_step = (uint64_t)g_opt.threads;
+        w->start_ns = start;
+        w->end_ns = end;
+        w->rate_per_conn = g_opt.rate > 0.0 ? g_opt.rate / (double)g_opt.conns : 0.0;
+    }
+
+    pthread_t *th = (pthread_t *)calloc((size_t)g_opt.threads, sizeof(pthread_t));
+    if (!th)
+    {
+        perror("sin memoria");
+        return EXIT_FAILURE;
+    }
+    for (int t = 0; t < g_opt.threads; ++t)
+        pthread_create(&th[t], NULL, g_opt.shm ? shm_worker_main : worker_main, &workers[t]);
+    for (int t = 0; t < g_opt.threads; ++t)
+        pthread_join(th[t], NULL);
+    double elapsed = (double)(now_ns() - start) / 1e9;
+    double measured = elapsed < g_opt.duration_s ? elapsed : g_opt.duration_s;
+
+    // Agrega resultados de todos los hilos
+    Worker tot;
+    memset(&tot, 0, sizeof(tot));
+    for (int t = 0; t < g_opt.threads; ++t)
+    {
+        Worker *w = &workers[t];
+        tot.requests += w->requests;
+        tot.errors += w->errors;
+        tot.misses += w->misses;
+        tot.net_errors += w->net_errors;
+        hist_merge(&tot.lat_get, &w->lat_get);
+        hist_merge(&tot.lat_miss, &w->lat_miss);
+        hist_merge(&tot.lat_add, &w->lat_add);
+        hist_merge(&tot.lat_all, &w->lat_all);
+        hist_merge(&tot.service_all, &w->service_all);
+    }
+    for (int i = 0; i < g_opt.conns; ++i)
+    {
+        if (conns[i].fd >= 0)
+        {
+            send(conns[i].fd, "QUIT\n", 5, MSG_NOSIGNAL);
+            close(conns[i].fd);
+        }
+        idx_shm_close(conns[i].shm);
+    }
+
+    const char *dist = g_opt.dist == DIST_ZIPF ? "zipf" : g_opt.dist == DIST_TRACE ? "trace" : "uniform";
+    printf("{\n");
+    printf("  \"config\": {\"host\": \"%s\", \"port\": %d, \"conns\": %d, \"threads\": %d, "
+           "\"duration_s\": %.1f, \"mode\": \"%s\", \"rate\": %.1f, \"dist\": \"%s\", "
+           "\"zipf_s\": %.3f, \"add_frac\": %.3f, \"ids\": %zu, \"transport\": \"%s\"},\n",
+           g_opt.host, g_opt.port, g_opt.conns, g_opt.threads, g_opt.duration_s,
+           g_opt.rate > 0.0 ? "open" : "closed", g_opt.rate, dist, g_opt.zipf_s,
+           g_opt.add_frac, g_nids, g_opt.shm ? "shm" : g_opt.host[0] == '/' ? "unix" : "tcp");
+    printf("  \"requests\": %" PRIu64 ",\n", tot.requests);
+    printf("  \"throughput_rps\": %.1f,\n", measured > 0 ? (double)tot.requests / measured : 0.0);
+    printf("  \"misses\": %" PRIu64 ",\n", tot.misses);
+    printf("  \"errors\": %" PRIu64 ",\n", tot.errors);
+    printf("  \"network_errors\": %" PRIu64 ",\n", tot.net_errors);
+    printf("  \"latency_us\": {\n");
+    print_hist_json("all", &tot.lat_all, false);
+    print_hist_json("get", &tot.lat_get, false);
+    print_hist_json("miss", &tot.lat_miss, false);
+    print_hist_json("add", &tot.lat_add, true);
+    printf("  },\n");
+    printf("  \"service_time_us\": {\n");
+    print_hist_json("all", &tot.service_all, true);
+    printf("  }\n");
+    printf("}\n");
+
+    free(th);
+    free(conns);
+    free(workers);
+    free(g_ids);
+    free(g_zipf_cdf);
+    return tot.net_errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,15 +1,56 @@
+#define _POSIX_C_SOURCE 200809L
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #define BUF_SIZE 16384
+// Línea que cierra la ficha de un GET en formato "card"
+#define CARD_END "----------------------------------------\n"
+
+// Conexión al socket Unix del servidor (--unix=RUTA); -1 si falla
+static int connect_unix(const char *path)
+{
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sa.sun_path))
+    {
+        fprintf(stderr, "Ruta de socket Unix demasiado larga\n");
+        return -1;
+    }
+    strcpy(sa.sun_path, path);
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    if (connect(s, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+    {
+        perror("connect");
+        close(s);
+        return -1;
+    }
+    return s;
+}
 
 int connect_server(const char *host, int port)
 {
+    // Un host que empieza por '/' es la ruta del socket Unix del servidor (el puerto se ignora)
+    if (host[0] == '/')
+        return connect_unix(host);
     // Crea un socket TCP (IPv4) para establecer conexión con el servidor
     int s = socket(AF_INET, SOCK_STREAM, 0);
     // Si no se puede crear el socket, muestra error y retorna -1
@@ -44,12 +85,457 @@ int connect_server(const char *host, int port)
     return s;
 }
 
+// ====== Lectura enmarcada de respuestas (modo interactivo) ======
+// Un solo recv puede traer media ficha o el final de otra; se acumula en un buffer
+// hasta tener la respuesta completa: una línea ("OK ...", "NOTFOUND", "ERR ...")
+// o, si la primera línea es exactamente "OK", la ficha completa hasta la línea de guiones.
+static char g_pending[BUF_SIZE * 2];
+static size_t g_pending_len = 0;
+
+static ssize_t read_reply(int sock, char *out, size_t cap)
+{
+    for (;;)
+    {
+        size_t end = 0;
+        char *nl = memchr(g_pending, '\n', g_pending_len);
+        if (nl)
+        {
+            size_t first = (size_t)(nl - g_pending) + 1;
+            if (first == 3 && memcmp(g_pending, "OK\n", 3) == 0)
+            {
+                g_pending[g_pending_len] = '\0';
+                char *term = strstr(g_pending, "\n" CARD_END);
+                if (term)
+                    end = (size_t)(term - g_pending) + 1 + strlen(CARD_END);
+            }
+            else
+                end = first;
+        }
+        // Respuesta completa (o buffer lleno): se entrega y se conserva el resto
+        if (end || g_pending_len == sizeof(g_pending) - 1)
+        {
+            if (!end)
+                end = g_pending_len;
+            size_t n = end < cap - 1 ? end : cap - 1;
+            memcpy(out, g_pending, n);
+            out[n] = '\0';
+            memmove(g_pending, g_pending + end, g_pending_len - end);
+            g_pending_len -= end;
+            return (ssize_t)n;
+        }
+        ssize_t r = recv(sock, g_pending + g_pending_len, sizeof(g_pending) - 1 - g_pending_len, 0);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return r;
+        g_pending_len += (size_t)r;
+    }
+}
+
+// ===============================================================
+// Modo por lotes: lee ids (GET) o líneas CSV (ADD) de stdin o de un archivo,
+// mantiene una ventana de W peticiones en vuelo por conexión y escribe los
+// resultados en orden de entrada como CSV o JSON (una línea por registro).
+// En JSON se pide FORMAT json: el servidor ya separa los campos (con comillas) y los
+// nombra con la cabecera del CSV, y el registro se copia tal cual.
+// ===============================================================
+
+enum
+{
+    REQ_GET,
+    REQ_ADD
+};
+enum
+{
+    ST_OK,
+    ST_NOTFOUND,
+    ST_ERR
+};
+
+typedef struct
+{
+    bool done;    // respuesta recibida, pendiente de emitir
+    int kind;     // REQ_GET / REQ_ADD
+    int status;   // ST_*
+    uint64_t id;
+    char *data;   // fila CSV (GET) o mensaje de error
+    size_t len;
+} Slot;
+
+typedef struct
+{
+    int fd;
+    char *in;       // bytes recibidos aún sin procesar
+    size_t in_len, in_cap;
+    char *out;      // comandos aún sin enviar
+    size_t out_len, out_cap;
+    size_t *fifo;   // nº de secuencia de las peticiones en vuelo (en orden)
+    int fifo_head, fifo_count;
+} BatchConn;
+
+typedef struct
+{
+    const char *input; // NULL = stdin
+    int conns;
+    int window;
+    bool json;
+} BatchOptions;
+
+static int buf_append(char **buf, size_t *len, size_t *cap, const char *src, size_t n)
+{
+    if (*len + n + 1 > *cap)
+    {
+        size_t ncap = *cap ? *cap : 4096;
+        while (ncap < *len + n + 1)
+            ncap *= 2;
+        char *tmp = (char *)realloc(*buf, ncap);
+        if (!tmp)
+            return -1;
+        *buf = tmp;
+        *cap = ncap;
+    }
+    memcpy(*buf + *len, src, n);
+    *len += n;
+    (*buf)[*len] = '\0';
+    return 0;
+}
+
+static void json_string(FILE *f, const char *s, size_t n)
+{
+    fputc('"', f);
+    for (size_t i = 0; i < n; ++i)
+    {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c == '\n')
+            fputs("\\n", f);
+        else if (c == '\r')
+            fputs("\\r", f);
+        else if (c == '\t')
+            fputs("\\t", f);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+// Escribe un resultado en stdout (y los fallos en stderr en modo CSV)
+static void emit_slot(const Slot *sl, bool json)
+{
+    const char *cmd = sl->kind == REQ_GET ? "GET" : "ADD";
+    if (!json)
+    {
+        if (sl->kind == REQ_GET && sl->status == ST_OK)
+            fwrite(sl->data, 1, sl->len, stdout);
+        else if (sl->status == ST_NOTFOUND)
+            fprintf(stderr, "NOTFOUND %" PRIu64 "\n", sl->id);
+        else if (sl->status == ST_ERR)
+            fprintf(stderr, "%s %" PRIu64 ": %.*s\n", cmd, sl->id, (int)sl->len, sl->data ? sl->data : "");
+        return;
+    }
+
+    printf("{\"cmd\":\"%s\",\"id\":%" PRIu64 ",\"status\":\"%s\"", cmd, sl->id,
+           sl->status == ST_OK ? "OK" : sl->status == ST_NOTFOUND ? "NOTFOUND" : "ERR");
+    if (sl->status == ST_ERR)
+    {
+        fputs(",\"error\":", stdout);
+        json_string(stdout, sl->data ? sl->data : "", sl->len);
+    }
+    else if (sl->kind == REQ_GET && sl->status == ST_OK)
+    {
+        // El objeto que envió el servidor (FORMAT json), sin su '\n' final
+        size_t len = sl->len;
+        while (len && (sl->data[len - 1] == '\n' || sl->data[len - 1] == '\r'))
+            len--;
+        fputs(",\"record\":", stdout);
+        fwrite(sl->data, 1, len, stdout);
+    }
+    fputs("}\n", stdout);
+}
+
+// Intenta extraer una respuesta completa del buffer de entrada de la conexión.
+// Devuelve los bytes consumidos (0 si aún está incompleta).
+static size_t parse_reply(BatchConn *c, Slot *sl)
+{
+    char *nl = memchr(c->in, '\n', c->in_len);
+    if (!nl)
+        return 0;
+    size_t first = (size_t)(nl - c->in) + 1;
+    size_t line_len = first - 1;
+    if (line_len && c->in[line_len - 1] == '\r')
+        line_len--;
+
+    if (strncmp(c->in, "NOTFOUND", 8) == 0)
+    {
+        sl->status = ST_NOTFOUND;
+        return first;
+    }
+    if (strncmp(c->in, "ERR", 3) == 0)
+    {
+        sl->status = ST_ERR;
+        sl->data = strndup(c->in, line_len);
+        sl->len = line_len;
+        return first;
+    }
+    if (sl->kind == REQ_GET && strncmp(c->in, "OK ", 3) == 0)
+    {
+        // "OK <nbytes>\n" + exactamente nbytes de fila CSV
+        size_t n = (size_t)strtoull(c->in + 3, NULL, 10);
+        if (c->in_len < first + n)
+            return 0;
+        sl->status = ST_OK;
+        sl->data = (char *)malloc(n + 1);
+        if (sl->data)
+        {
+            memcpy(sl->data, c->in + first, n);
+            sl->data[n] = '\0';
+        }
+        sl->len = sl->data ? n : 0;
+        return first + n;
+    }
+    // ADD confirmado u otra respuesta de una línea
+    sl->status = strncmp(c->in, "OK", 2) == 0 ? ST_OK : ST_ERR;
+    if (sl->status == ST_ERR)
+    {
+        sl->data = strndup(c->in, line_len);
+        sl->len = line_len;
+    }
+    return first;
+}
+
+static int run_batch(const char *host, int port, const BatchOptions *bo)
+{
+    FILE *in = bo->input ? fopen(bo->input, "r") : stdin;
+    if (!in)
+    {
+        perror("open input");
+        return EXIT_FAILURE;
+    }
+
+    // Abre las conexiones y pide respuestas enmarcadas por longitud (FORMAT csv o json)
+    BatchConn *conns = (BatchConn *)calloc((size_t)bo->conns, sizeof(BatchConn));
+    struct pollfd *pfds = (struct pollfd *)calloc((size_t)bo->conns, sizeof(struct pollfd));
+    size_t ring_cap = (size_t)bo->conns * (size_t)bo->window;
+    Slot *ring = (Slot *)calloc(ring_cap, sizeof(Slot));
+    if (!conns || !pfds || !ring)
+    {
+        perror("sin memoria");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < bo->conns; ++i)
+    {
+        BatchConn *c = &conns[i];
+        c->fd = connect_server(host, port);
+        if (c->fd < 0)
+            return EXIT_FAILURE;
+        int one = 1;
+        setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        char reply[64];
+        const char *fmt = bo->json ? "FORMAT json\n" : "FORMAT csv\n";
+        send(c->fd, fmt, strlen(fmt), 0);
+        ssize_t n = read_reply(c->fd, reply, sizeof(reply));
+        if (n <= 0 || strncmp(reply, "OK", 2) != 0)
+        {
+            fprintf(stderr, "El servidor no acepta %.*s\n", (int)strlen(fmt) - 1, fmt);
+            return EXIT_FAILURE;
+        }
+        fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+        c->fifo = (size_t *)calloc((size_t)bo->window, sizeof(size_t));
+        if (!c->fifo)
+        {
+            perror("sin memoria");
+            return EXIT_FAILURE;
+        }
+    }
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    bool eof = false;
+    size_t issued = 0, emitted = 0;
+    uint64_t n_ok = 0, n_miss = 0, n_err = 0;
+    int rr = 0; // reparto round-robin entre conexiones
+    int rc = EXIT_SUCCESS;
+
+    while (!eof || emitted < issued)
+    {
+        // 1) Encola nuevas peticiones mientras haya hueco en alguna ventana
+        //    y el búfer de reordenación no se desborde
+        while (!eof && issued - emitted < ring_cap)
+        {
+            BatchConn *c = NULL;
+            for (int k = 0; k < bo->conns; ++k)
+            {
+                BatchConn *cand = &conns[(rr + k) % bo->conns];
+                if (cand->fd >= 0 && cand->fifo_count < bo->window)
+                {
+                    c = cand;
+                    rr = (rr + k + 1) % bo->conns;
+                    break;
+                }
+            }
+            if (!c)
+                break;
+            ssize_t n = getline(&line, &line_cap, in);
+            if (n < 0)
+            {
+                eof = true;
+                break;
+            }
+            while (n && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+                line[--n] = '\0';
+            // Salta líneas vacías y la cabecera del CSV
+            if (n == 0 || strncmp(line, "Id,", 3) == 0)
+                continue;
+
+            Slot *sl = &ring[issued % ring_cap];
+            memset(sl, 0, sizeof(*sl));
+            sl->id = strtoull(line, NULL, 10);
+            // Sólo dígitos -> GET <id>; cualquier otra cosa se envía como fila CSV (ADD)
+            sl->kind = (strspn(line, "0123456789") == (size_t)n) ? REQ_GET : REQ_ADD;
+            const char *verb = sl->kind == REQ_GET ? "GET " : "ADD ";
+            if (buf_append(&c->out, &c->out_len, &c->out_cap, verb, 4) != 0 ||
+                buf_append(&c->out, &c->out_len, &c->out_cap, line, (size_t)n) != 0 ||
+                buf_append(&c->out, &c->out_len, &c->out_cap, "\n", 1) != 0)
+            {
+                perror("sin memoria");
+                return EXIT_FAILURE;
+            }
+            c->fifo[(c->fifo_head + c->fifo_count) % bo->window] = issued;
+            c->fifo_count++;
+            issued++;
+        }
+
+        // 2) Envía lo pendiente y recibe respuestas
+        int active = 0;
+        for (int i = 0; i < bo->conns; ++i)
+        {
+            BatchConn *c = &conns[i];
+            pfds[i].fd = (c->fd >= 0 && (c->fifo_count || c->out_len)) ? c->fd : -1;
+            pfds[i].events = (short)(POLLIN | (c->out_len ? POLLOUT : 0));
+            pfds[i].revents = 0;
+            if (pfds[i].fd >= 0)
+                active++;
+        }
+        if (active == 0)
+        {
+            if (emitted < issued)
+            {
+                fprintf(stderr, "Conexiones cerradas con %zu peticiones sin respuesta\n", issued - emitted);
+                rc = EXIT_FAILURE;
+            }
+            break;
+        }
+        if (poll(pfds, (nfds_t)bo->conns, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            rc = EXIT_FAILURE;
+            break;
+        }
+        for (int i = 0; i < bo->conns; ++i)
+        {
+            BatchConn *c = &conns[i];
+            if (pfds[i].fd < 0)
+                continue;
+            if ((pfds[i].revents & POLLOUT) && c->out_len)
+            {
+                ssize_t w = send(c->fd, c->out, c->out_len, MSG_NOSIGNAL);
+                if (w > 0)
+                {
+                    memmove(c->out, c->out + w, c->out_len - (size_t)w);
+                    c->out_len -= (size_t)w;
+                }
+                else if (w < 0 && errno != EAGAIN && errno != EINTR)
+                {
+                    perror("send");
+                    close(c->fd);
+                    c->fd = -1;
+                    continue;
+                }
+            }
+            if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                char tmp[BUF_SIZE];
+                ssize_t r = recv(c->fd, tmp, sizeof(tmp), 0);
+                if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR))
+                {
+                    close(c->fd);
+                    c->fd = -1;
+                    continue;
+                }
+                if (r > 0 && buf_append(&c->in, &c->in_len, &c->in_cap, tmp, (size_t)r) != 0)
+                {
+                    perror("sin memoria");
+                    return EXIT_FAILURE;
+                }
+                // Asigna cada respuesta completa a la petición más antigua en vuelo
+                size_t used;
+                while (c->fifo_count &&
+                       (used = parse_reply(c, &ring[c->fifo[c->fifo_head] % ring_cap])) > 0)
+                {
+                    ring[c->fifo[c->fifo_head] % ring_cap].done = true;
+                    c->fifo_head = (c->fifo_head + 1) % bo->window;
+                    c->fifo_count--;
+                    memmove(c->in, c->in + used, c->in_len - used);
+                    c->in_len -= used;
+                }
+            }
+        }
+
+        // 3) Emite en orden de entrada todo lo que ya esté resuelto
+        while (emitted < issued && ring[emitted % ring_cap].done)
+        {
+            Slot *sl = &ring[emitted % ring_cap];
+            emit_slot(sl, bo->json);
+            if (sl->status == ST_OK)
+                n_ok++;
+            else if (sl->status == ST_NOTFOUND)
+                n_miss++;
+            else
+                n_err++;
+            free(sl->data);
+            sl->data = NULL;
+            sl->done = false;
+            emitted++;
+        }
+    }
+
+    fflush(stdout);
+    fprintf(stderr, "Lote terminado: %" PRIu64 " OK, %" PRIu64 " NOTFOUND, %" PRIu64 " ERR\n",
+            n_ok, n_miss, n_err);
+    for (int i = 0; i < bo->conns; ++i)
+    {
+        if (conns[i].fd >= 0)
+        {
+            fcntl(conns[i].fd, F_SETFL, fcntl(conns[i].fd, F_GETFL) & ~O_NONBLOCK);
+            send(conns[i].fd, "QUIT\n", 5, MSG_NOSIGNAL);
+            close(conns[i].fd);
+        }
+        free(conns[i].in);
+        free(conns[i].out);
+        free(conns[i].fifo);
+    }
+    free(line);
+    free(ring);
+    free(pfds);
+    free(conns);
+    if (in != stdin)
+        fclose(in);
+    return (rc == EXIT_SUCCESS && n_err == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int main(int argc, char **argv)
 {
     // Verifica que el usuario haya especificado host y puerto; si no, muestra uso y sale
     if (argc < 3)
     {
-        fprintf(stderr, "Uso: %s <host> <port>\n", argv[0]);
+        fprintf(stderr,
+                "Uso: %s <host|/ruta.sock> <port> [--batch[=ARCHIVO] [--conns=C] [--window=W] [--output=csv|json]]\n",
+                argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -57,6 +543,42 @@ int main(int argc, char **argv)
     const char *host = argv[1];
     int port = atoi(argv[2]);
 
+    // Opciones del modo por lotes (sin menú)
+    bool batch = false;
+    BatchOptions bo = {NULL, 4, 32, false};
+    for (int i = 3; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--batch") == 0)
+            batch = true;
+        else if (strncmp(argv[i], "--batch=", 8) == 0)
+        {
+            batch = true;
+            bo.input = argv[i] + 8;
+        }
+        else if (strncmp(argv[i], "--conns=", 8) == 0)
+            bo.conns = atoi(argv[i] + 8);
+        else if (strncmp(argv[i], "--window=", 9) == 0)
+            bo.window = atoi(argv[i] + 9);
+        else if (strcmp(argv[i], "--output=json") == 0)
+            bo.json = true;
+        else if (strcmp(argv[i], "--output=csv") == 0)
+            bo.json = false;
+        else
+        {
+            fprintf(stderr, "Opción desconocida: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (batch)
+    {
+        if (bo.conns < 1 || bo.window < 1)
+        {
+            fprintf(stderr, "--conns y --window deben ser >= 1\n");
+            return EXIT_FAILURE;
+        }
+        return run_batch(host, port, &bo);
+    }
+
     // Intenta conectar con el servidor TCP; si falla, termina el programa
     int sock = connect_server(host, port);
     if (sock < 0)
@@ -73,6 +595,8 @@ int main(int argc, char **argv)
         printf("1. Consultar libro por ID\n");
         printf("2. Salir\n");
         printf("3. Añadir nuevo libro\n");
+        printf("4. Corregir un libro (misma línea CSV, mismo ID)\n");
+        printf("5. Borrar un libro por ID\n");
         printf("Seleccione una opción: ");
 
         // Lee la opción seleccionada; si hay entrada inválida, limpia el buffer y vuelve al menú
@@ -170,20 +694,51 @@ int main(int argc, char **argv)
 
             // Espera la respuesta del servidor después de enviar el comando ADD
             char buf[BUF_SIZE];
-            ssize_t n = recv(sock, buf, sizeof(buf) - 1, 0);
+            ssize_t n = read_reply(sock, buf, sizeof(buf));
             // Si no se recibe respuesta válida, informa error y termina la conexión
             if (n <= 0)
             {
                 printf("❌ Conexión cerrada o error.\n");
                 break;
             }
-            buf[n] = '\0';
 
             // Muestra el mensaje de respuesta del servidor (éxito o error) y vuelve al menú
             printf("\n--- RESPUESTA DEL SERVIDOR ---\n%s\n", buf);
             continue;
         }
 
+        // Corregir (UPDATE <línea>) o borrar (DEL <id>) un libro que ya existe
+        if (opcion == 4 || opcion == 5)
+        {
+            while (getchar() != '\n')
+                ; // limpiar stdin
+            if (opcion == 4)
+                printf("👉 Ingrese la línea completa corregida (mismo formato que al añadir):\n");
+            else
+                printf("Ingrese el ID del libro a borrar: ");
+            char line[4096];
+            if (!fgets(line, sizeof(line), stdin))
+            {
+                printf("Error de entrada.\n");
+                continue;
+            }
+            line[strcspn(line, "\n")] = 0; // quitar salto
+
+            char cmd[5000];
+            snprintf(cmd, sizeof(cmd), "%s %s\n", opcion == 4 ? "UPDATE" : "DEL", line);
+            send(sock, cmd, strlen(cmd), 0);
+
+            char buf[BUF_SIZE];
+            ssize_t n = read_reply(sock, buf, sizeof(buf));
+            if (n <= 0)
+            {
+                printf("❌ Conexión cerrada o error.\n");
+                break;
+            }
+            printf("\n--- RESPUESTA DEL SERVIDOR ---\n%s\n", buf);
+            continue;
+        }
+
         // Verifica que la opción seleccionada sea 1; si no lo es, muestra error y regresa al menú
         if (opcion != 1)
         {
@@ -214,15 +769,13 @@ int main(int argc, char **argv)
 
         // Espera la respuesta del servidor (ficha del libro o mensaje de error)
         char buf[BUF_SIZE];
-        ssize_t n = recv(sock, buf, sizeof(buf) - 1, 0);
+        ssize_t n = read_reply(sock, buf, sizeof(buf));
         // Si la conexión se pierde o hay error, notifica y termina la sesión
         if (n <= 0)
         {
             printf("Conexión cerrada o error.\n");
             break;
         }
-        // Finaliza la cadena recibida y muestra la respuesta formateada del servidor
-        buf[n] = '\0';
 
         // Mostrar resultado
         printf("\n--- RESPUESTA DEL SERVIDOR ---\n%s\n", buf);
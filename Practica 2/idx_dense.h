@@ -0,0 +1,131 @@
+// ====== Tabla densa de ids (<books.idx>.dense) ======
+// Compartido por build_index e idx_server (y la lee idx_verify).
+//
+// Cuando los Id ocupan casi todo un rango [min_id, max_id], buscar en un bucket de hash
+// sobra: la fila del id i está en offset[i - min_id]. build_index genera entonces, junto a
+// books.idx, un archivo mapeable en memoria:
+//   DenseHeader | uint64 bits[(slots + 63) / 64] | uint64 offset[slots]
+// bits marca las ranuras ocupadas. slots deja un margen por encima de max_id para que los ADD
+// de ids nuevos (normalmente consecutivos) caigan también en la tabla. Los ids fuera de la
+// tabla siguen en books.idx como siempre.
+//
+// El servidor resuelve un GET dentro del rango con una carga de bits y otra de offset. Un ADD
+// escribe su bucket como siempre y después la ranura (offset y luego el bit): books.idx
+// contiene todos los ids y la tabla sólo acelera las lecturas.
+// csv_end es el tamaño del CSV que la tabla refleja: si no coincide con el CSV al arrancar
+// (se editó o se añadieron filas sin ella), el servidor la ignora.
+#ifndef IDX_DENSE_H
+#define IDX_DENSE_H
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define DENSE_MAGIC "BKDNSv01"
+#define DENSE_MIN_FILL 0.5   // fracción mínima de ranuras ocupadas para generar la tabla
+#define DENSE_HEADROOM 16    // margen para ADD: slots = rango + rango / DENSE_HEADROOM
+#define DENSE_MAX_SLOTS (1ull << 32) // tope de ranuras (32 GB de offsets)
+
+typedef struct
+{
+    char magic[8];     // "BKDNSv01"
+    uint64_t min_id;   // id de la ranura 0
+    uint64_t slots;    // nº de ranuras (ids min_id .. min_id + slots - 1)
+    uint64_t count;    // ranuras ocupadas
+    uint64_t csv_end;  // bytes del CSV reflejados en la tabla
+    uint64_t reserved[3];
+} DenseHeader;
+
+static inline size_t dense_bits_words(uint64_t slots)
+{
+    return (size_t)((slots + 63) / 64);
+}
+
+static inline size_t dense_file_bytes(uint64_t slots)
+{
+    return sizeof(DenseHeader) + dense_bits_words(slots) * sizeof(uint64_t) + (size_t)slots * sizeof(uint64_t);
+}
+
+static inline uint64_t *dense_bits(DenseHeader *h)
+{
+    return (uint64_t *)(h + 1);
+}
+
+static inline uint64_t *dense_offsets(DenseHeader *h)
+{
+    return dense_bits(h) + dense_bits_words(h->slots);
+}
+
+// Decide si count ids en [min_id, max_id] son bastante densos; si lo son, deja en *slots el
+// tamaño de la tabla (con margen para ADD) y devuelve 1
+static inline int dense_plan(uint64_t min_id, uint64_t max_id, uint64_t count, double min_fill, uint64_t *slots)
+{
+    if (count == 0 || min_fill <= 0.0 || max_id < min_id)
+        return 0;
+    uint64_t range = max_id - min_id + 1;
+    if (range == 0 || range >= DENSE_MAX_SLOTS || (double)count < min_fill * (double)range)
+        return 0;
+    uint64_t n = range + range / DENSE_HEADROOM + 64;
+    *slots = n < DENSE_MAX_SLOTS ? n : DENSE_MAX_SLOTS;
+    return 1;
+}
+
+// Crea path vacío (todas las ranuras libres) con el tamaño de la tabla y lo mapea r/w;
+// devuelve la cabecera o NULL. Se libera con munmap(h, dense_file_bytes(h->slots)).
+static inline DenseHeader *dense_create(const char *path, uint64_t min_id, uint64_t slots)
+{
+    size_t bytes = dense_file_bytes(slots);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return NULL;
+    void *p = MAP_FAILED;
+    if (ftruncate(fd, (off_t)bytes) == 0)
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        unlink(path);
+        return NULL;
+    }
+    DenseHeader *h = (DenseHeader *)p;
+    memcpy(h->magic, DENSE_MAGIC, 8);
+    h->min_id = min_id;
+    h->slots = slots;
+    return h;
+}
+
+// Mapea una tabla existente (r/w si writable); NULL si no existe o no es válida.
+// *bytes recibe el tamaño mapeado.
+static inline DenseHeader *dense_map(const char *path, int writable, size_t *bytes)
+{
+    int fd = open(path, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    DenseHeader h;
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || memcmp(h.magic, DENSE_MAGIC, 8) != 0 ||
+        h.slots == 0 || h.slots > DENSE_MAX_SLOTS || size < 0 || (uint64_t)size != dense_file_bytes(h.slots))
+    {
+        close(fd);
+        return NULL;
+    }
+    void *p = mmap(NULL, (size_t)size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return NULL;
+    *bytes = (size_t)size;
+    return (DenseHeader *)p;
+}
+
+// Ranura de id (o -1 si cae fuera de la tabla)
+static inline int64_t dense_slot(const DenseHeader *h, uint64_t id)
+{
+    if (id < h->min_id || id - h->min_id >= h->slots)
+        return -1;
+    return (int64_t)(id - h->min_id);
+}
+
+#endif
@@ -0,0 +1,712 @@
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Enrutador de shards: reparte GET/ADD/UPDATE/DEL entre K procesos idx_server según
+// hash_id(id) % K (el mismo reparto que split_index) y reparte/junta los
+// comandos que tocan varios shards (MGET, FORMAT, STATS).
+
+#define TABLE_SIZE 1000
+#define MAX_SHARDS 64
+#define LINE_MAX_LEN 131072
+#define CARD_END "----------------------------------------\n"
+
+static inline unsigned hash_id(uint64_t id)
+{
+    return (unsigned)((id * 2654435761UL) % TABLE_SIZE);
+}
+
+// ====== Shards configurados (host:puerto) ======
+typedef struct
+{
+    char host[256];
+    int port;
+} ShardAddr;
+
+static ShardAddr g_shards[MAX_SHARDS];
+static int g_nshards = 0;
+
+static inline int shard_of(uint64_t id)
+{
+    return (int)(hash_id(id) % (unsigned)g_nshards);
+}
+
+// ====== Buffer creciente para respuestas ======
+typedef struct
+{
+    char *data;
+    size_t len, cap;
+} Buf;
+
+static int buf_put(Buf *b, const char *src, size_t n)
+{
+    if (b->len + n + 1 > b->cap)
+    {
+        size_t ncap = b->cap ? b->cap : 4096;
+        while (b->len + n + 1 > ncap)
+            ncap *= 2;
+        char *tmp = (char *)realloc(b->data, ncap);
+        if (!tmp)
+            return -1;
+        b->data = tmp;
+        b->cap = ncap;
+    }
+    memcpy(b->data + b->len, src, n);
+    b->len += n;
+    b->data[b->len] = '\0';
+    return 0;
+}
+
+static int buf_puts(Buf *b, const char *s)
+{
+    return buf_put(b, s, strlen(s));
+}
+
+// ====== Lector con buffer sobre un socket (cliente o backend) ======
+typedef struct
+{
+    int fd;
+    size_t start, end;
+    char buf[16384];
+} Reader;
+
+// Asegura al menos un byte disponible; 0 si el extremo cerró
+static int reader_fill(Reader *r)
+{
+    if (r->start < r->end)
+        return 1;
+    r->start = r->end = 0;
+    for (;;)
+    {
+        ssize_t n = recv(r->fd, r->buf, sizeof(r->buf), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        r->end = (size_t)n;
+        return 1;
+    }
+}
+
+// Añade a out una línea completa (con '\n'); -1 si se corta la conexión, -2 si la línea
+// pasa de max bytes (se deja de leer en cuanto se sabe, sin guardar el resto)
+static int reader_line(Reader *r, Buf *out, size_t max)
+{
+    size_t got = 0;
+    for (;;)
+    {
+        if (!reader_fill(r))
+            return -1;
+        char *nl = (char *)memchr(r->buf + r->start, '\n', r->end - r->start);
+        size_t n = nl ? (size_t)(nl - (r->buf + r->start)) + 1 : r->end - r->start;
+        got += n;
+        if (got > max)
+            return -2;
+        if (buf_put(out, r->buf + r->start, n) != 0)
+            return -1;
+        r->start += n;
+        if (nl)
+            return 0;
+    }
+}
+
+// Añade a out exactamente n bytes
+static int reader_bytes(Reader *r, Buf *out, size_t n)
+{
+    while (n > 0)
+    {
+        if (!reader_fill(r))
+            return -1;
+        size_t k = r->end - r->start;
+        if (k > n)
+            k = n;
+        if (buf_put(out, r->buf + r->start, k) != 0)
+            return -1;
+        r->start += k;
+        n -= k;
+    }
+    return 0;
+}
+
+// ====== Lectura de una respuesta completa del backend según el comando enviado ======
+enum
+{
+    RK_LINE,  // ADD, UPDATE, DEL, FORMAT: una línea
+    RK_GET,   // GET: NOTFOUND/ERR, ficha hasta CARD_END u "OK <n>" + n bytes
+    RK_STATS  // STATS: hasta "END"
+};
+
+static int read_backend_reply(Reader *r, int kind, Buf *out)
+{
+    size_t first = out->len;
+    if (reader_line(r, out, SIZE_MAX) != 0)
+        return -1;
+    const char *line = out->data + first;
+    if (kind == RK_LINE || strncmp(line, "OK", 2) != 0)
+        return 0;
+    if (kind == RK_GET)
+    {
+        // Modo csv: "OK <nbytes>\n" enmarcado por longitud
+        if (line[2] == ' ')
+            return reader_bytes(r, out, (size_t)strtoull(line + 3, NULL, 10));
+        // Modo ficha: hasta la línea de guiones
+        for (;;)
+        {
+            size_t at = out->len;
+            if (reader_line(r, out, SIZE_MAX) != 0)
+                return -1;
+            if (strcmp(out->data + at, CARD_END) == 0)
+                return 0;
+        }
+    }
+    for (;;)
+    {
+        size_t at = out->len;
+        if (reader_line(r, out, SIZE_MAX) != 0)
+            return -1;
+        if (strcmp(out->data + at, "END\n") == 0)
+            return 0;
+    }
+}
+
+static int send_all(int fd, const char *p, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return -1;
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+static int connect_to(const char *host, int port)
+{
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    char ps[16];
+    snprintf(ps, sizeof(ps), "%d", port);
+    if (getaddrinfo(host, ps, &hints, &res) != 0 || !res)
+        return -1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd >= 0)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+// ====== Sesión de un cliente: una conexión propia a cada shard ======
+typedef struct
+{
+    int client_fd;
+    Reader *client;
+    Reader *backend[MAX_SHARDS]; // NULL hasta el primer uso
+    char format[8];              // último FORMAT aceptado (los shards lo comparten; "" = card)
+} Session;
+
+static Reader *shard_conn(Session *s, int i)
+{
+    if (s->backend[i])
+        return s->backend[i];
+    int fd = connect_to(g_shards[i].host, g_shards[i].port);
+    if (fd < 0)
+        return NULL;
+    Reader *r = (Reader *)calloc(1, sizeof(Reader));
+    if (!r)
+    {
+        close(fd);
+        return NULL;
+    }
+    r->fd = fd;
+    // La sesión nueva del shard arranca en modo ficha: se replica el formato actual
+    if (s->format[0])
+    {
+        Buf tmp = {0};
+        char cmd[32];
+        int n = snprintf(cmd, sizeof(cmd), "FORMAT %s\n", s->format);
+        if (send_all(fd, cmd, (size_t)n) != 0 || read_backend_reply(r, RK_LINE, &tmp) != 0)
+        {
+            free(tmp.data);
+            close(fd);
+            free(r);
+            return NULL;
+        }
+        free(tmp.data);
+    }
+    s->backend[i] = r;
+    return r;
+}
+
+// Cierra la conexión con un shard tras un fallo (se reabre en el siguiente uso)
+static void shard_drop(Session *s, int i)
+{
+    if (s->backend[i])
+    {
+        close(s->backend[i]->fd);
+        free(s->backend[i]);
+        s->backend[i] = NULL;
+    }
+}
+
+static void shard_error(Buf *out, int i)
+{
+    char msg[64];
+    snprintf(msg, sizeof(msg), "ERR shard %d unavailable\n", i);
+    buf_puts(out, msg);
+}
+
+// Reenvía una línea a un shard y añade su respuesta a out
+static void forward_one(Session *s, int i, const char *line, int kind, Buf *out)
+{
+    Reader *r = shard_conn(s, i);
+    if (!r || send_all(r->fd, line, strlen(line)) != 0 || send_all(r->fd, "\n", 1) != 0 ||
+        read_backend_reply(r, kind, out) != 0)
+    {
+        shard_drop(s, i);
+        shard_error(out, i);
+    }
+}
+
+// Primer campo de una fila CSV como id (0 si no es numérico)
+static int parse_lead_id(const char *p, uint64_t *id)
+{
+    while (*p == ' ')
+        p++;
+    char *end = NULL;
+    errno = 0;
+    *id = strtoull(p, &end, 10);
+    return errno == 0 && end != p;
+}
+
+// Id del primer campo de una fila CSV (ADD, UPDATE), sin los espacios y comillas que el
+// servidor también quita: la fila va al shard donde luego la buscará GET
+static int parse_row_id(const char *p, uint64_t *id)
+{
+    while (*p == ' ' || *p == '"')
+        p++;
+    return parse_lead_id(p, id);
+}
+
+// ====== MGET id1 id2 ...: GET canalizados por shard, respuestas en el orden pedido ======
+static void cmd_mget(Session *s, const char *args, Buf *out)
+{
+    char *copy = strdup(args);
+    if (!copy)
+    {
+        buf_puts(out, "ERR internal\n");
+        return;
+    }
+    size_t cap = 16, n = 0;
+    char **ids = (char **)malloc(cap * sizeof(char *));
+    int *dst = (int *)malloc(cap * sizeof(int));
+    char *save = NULL;
+    for (char *tok = strtok_r(copy, " ", &save); tok && ids && dst; tok = strtok_r(NULL, " ", &save))
+    {
+        if (n == cap)
+        {
+            cap *= 2;
+            char **ni = (char **)realloc(ids, cap * sizeof(char *));
+            int *nd = (int *)realloc(dst, cap * sizeof(int));
+            if (ni)
+                ids = ni;
+            if (nd)
+                dst = nd;
+            if (!ni || !nd)
+                break;
+        }
+        uint64_t id = 0;
+        ids[n] = tok;
+        dst[n] = parse_lead_id(tok, &id) ? shard_of(id) : 0;
+        n++;
+    }
+    if (!ids || !dst || n == 0)
+    {
+        buf_puts(out, n == 0 ? "ERR missing id\n" : "ERR internal\n");
+        free(ids);
+        free(dst);
+        free(copy);
+        return;
+    }
+
+    // Una sola escritura por shard con todos sus GET
+    bool failed[MAX_SHARDS] = {false};
+    for (int i = 0; i < g_nshards; ++i)
+    {
+        Buf req = {0};
+        for (size_t j = 0; j < n; ++j)
+            if (dst[j] == i)
+            {
+                buf_puts(&req, "GET ");
+                buf_puts(&req, ids[j]);
+                buf_puts(&req, "\n");
+            }
+        if (req.len == 0)
+            continue;
+        Reader *r = shard_conn(s, i);
+        if (!r || send_all(r->fd, req.data, req.len) != 0)
+        {
+            shard_drop(s, i);
+            failed[i] = true;
+        }
+        free(req.data);
+    }
+
+    char head[48];
+    snprintf(head, sizeof(head), "OK MGET %zu\n", n);
+    buf_puts(out, head);
+    // Cada shard responde en orden FIFO: se recorren los ids en el orden pedido
+    for (size_t j = 0; j < n; ++j)
+    {
+        int i = dst[j];
+        if (failed[i] || read_backend_reply(s->backend[i], RK_GET, out) != 0)
+        {
+            if (!failed[i])
+                shard_drop(s, i);
+            failed[i] = true;
+            shard_error(out, i);
+        }
+    }
+    free(ids);
+    free(dst);
+    free(copy);
+}
+
+// ====== FORMAT: se aplica en todos los shards abiertos y se recuerda para los nuevos ======
+static void cmd_format(Session *s, const char *line, Buf *out)
+{
+    Buf reply = {0};
+    forward_one(s, 0, line, RK_LINE, &reply);
+    if (reply.data && strncmp(reply.data, "OK", 2) == 0)
+    {
+        // "OK FORMAT <nombre>\n"
+        snprintf(s->format, sizeof(s->format), "%.*s", (int)strcspn(reply.data + 10, "\n"), reply.data + 10);
+        for (int i = 1; i < g_nshards; ++i)
+            if (s->backend[i])
+            {
+                Buf tmp = {0};
+                forward_one(s, i, line, RK_LINE, &tmp);
+                free(tmp.data);
+            }
+    }
+    buf_put(out, reply.data ? reply.data : "", reply.len);
+    free(reply.data);
+}
+
+// ====== STATS: suma de contadores; medias ponderadas por nº de muestras; para percentiles,
+// máximos y uptime, el peor shard (cota superior: los histogramas no se pueden sumar aquí) ======
+typedef struct
+{
+    char key[64];
+    char text[64]; // valor no numérico (p. ej. io_backend)
+    double value;
+    double weight; // muestras acumuladas (sólo medias)
+    bool numeric;
+} StatLine;
+
+static bool stat_is_max(const char *key)
+{
+    return strstr(key, "_p50") || strstr(key, "_p99") || strstr(key, "_p999") || strstr(key, "_max") ||
+           strstr(key, "uptime") || strstr(key, "_lag");
+}
+
+static bool stat_is_mean(const char *key)
+{
+    return strstr(key, "_mean") != NULL;
+}
+
+static void cmd_stats(Session *s, Buf *out)
+{
+    StatLine *lines = NULL;
+    size_t n = 0, cap = 0;
+    char tmp[96];
+    int up = 0;
+
+    Buf per_shard = {0};
+    for (int i = 0; i < g_nshards; ++i)
+    {
+        Buf reply = {0};
+        forward_one(s, i, "STATS", RK_STATS, &reply);
+        if (!reply.data || strncmp(reply.data, "OK STATS\n", 9) != 0)
+        {
+            snprintf(tmp, sizeof(tmp), "shard%d_up 0\n", i);
+            buf_puts(&per_shard, tmp);
+            free(reply.data);
+            continue;
+        }
+        up++;
+        double last_count = 0.0; // "<h>_count" precede a "<h>_mean_us" en la salida del servidor
+        char *save = NULL;
+        for (char *l = strtok_r(reply.data + 9, "\n", &save); l; l = strtok_r(NULL, "\n", &save))
+        {
+            char key[64], val[64];
+            if (strcmp(l, "END") == 0 || sscanf(l, "%63s %63s", key, val) != 2)
+                continue;
+            char *end = NULL;
+            double v = strtod(val, &end);
+            bool numeric = end && *end == '\0';
+            if (numeric && strstr(key, "_count"))
+                last_count = v;
+            if (strcmp(key, "cmd_get") == 0)
+            {
+                snprintf(tmp, sizeof(tmp), "shard%d_cmd_get %s\n", i, val);
+                buf_puts(&per_shard, tmp);
+            }
+            size_t k = 0;
+            while (k < n && strcmp(lines[k].key, key) != 0)
+                k++;
+            if (k == n)
+            {
+                if (n == cap)
+                {
+                    cap = cap ? cap * 2 : 64;
+                    StatLine *nl = (StatLine *)realloc(lines, cap * sizeof(StatLine));
+                    if (!nl)
+                        break;
+                    lines = nl;
+                }
+                memset(&lines[n], 0, sizeof(StatLine));
+                snprintf(lines[n].key, sizeof(lines[n].key), "%s", key);
+                snprintf(lines[n].text, sizeof(lines[n].text), "%s", val);
+                lines[n].numeric = numeric;
+                lines[n].value = numeric ? v : 0.0;
+                if (numeric && stat_is_mean(key))
+                {
+                    lines[n].value = v * last_count;
+                    lines[n].weight = last_count;
+                }
+                n++;
+                continue;
+            }
+            if (!numeric || !lines[k].numeric)
+                continue;
+            if (stat_is_mean(key))
+            {
+                lines[k].value += v * last_count;
+                lines[k].weight += last_count;
+            }
+            else if (stat_is_max(key))
+                lines[k].value = v > lines[k].value ? v : lines[k].value;
+            else
+                lines[k].value += v;
+        }
+        snprintf(tmp, sizeof(tmp), "shard%d_up 1\n", i);
+        buf_puts(&per_shard, tmp);
+        free(reply.data);
+    }
+
+    // Medias ponderadas y tasa de acierto recalculada a partir de los totales
+    double gets = 0.0, misses = 0.0;
+    for (size_t k = 0; k < n; ++k)
+    {
+        if (stat_is_mean(lines[k].key))
+            lines[k].value = lines[k].weight > 0.0 ? lines[k].value / lines[k].weight : 0.0;
+        if (strcmp(lines[k].key, "cmd_get") == 0)
+            gets = lines[k].value;
+        if (strcmp(lines[k].key, "get_miss") == 0)
+            misses = lines[k].value;
+    }
+    for (size_t k = 0; k < n; ++k)
+        if (strstr(lines[k].key, "_ratio"))
+            lines[k].value = gets > 0.0 ? (gets - misses) / gets : 0.0;
+
+    buf_puts(out, "OK STATS\n");
+    snprintf(tmp, sizeof(tmp), "shards %d\nshards_up %d\n", g_nshards, up);
+    buf_puts(out, tmp);
+    for (size_t k = 0; k < n; ++k)
+    {
+        if (lines[k].numeric && lines[k].value == (double)(uint64_t)lines[k].value)
+            snprintf(tmp, sizeof(tmp), "%s %" PRIu64 "\n", lines[k].key, (uint64_t)lines[k].value);
+        else if (lines[k].numeric)
+            snprintf(tmp, sizeof(tmp), "%s %.3f\n", lines[k].key, lines[k].value);
+        else
+            snprintf(tmp, sizeof(tmp), "%s %s\n", lines[k].key, lines[k].text);
+        buf_puts(out, tmp);
+    }
+    buf_put(out, per_shard.data ? per_shard.data : "", per_shard.len);
+    buf_puts(out, "END\n");
+    free(per_shard.data);
+    free(lines);
+}
+
+// ====== Hilo por conexión de cliente ======
+static void *client_thread(void *arg)
+{
+    Session *s = (Session *)arg;
+    Buf line = {0}, out = {0};
+
+    for (;;)
+    {
+        line.len = 0;
+        int lr = reader_line(s->client, &line, LINE_MAX_LEN);
+        if (lr == -2)
+        {
+            // Sin '\n' a la vista no se puede resincronizar: se corta la conexión
+            send_all(s->client_fd, "ERR línea demasiado larga\n", strlen("ERR línea demasiado larga\n"));
+            break;
+        }
+        if (lr != 0)
+            break;
+        // Quita '\n' y '\r' finales
+        while (line.len && (line.data[line.len - 1] == '\n' || line.data[line.len - 1] == '\r'))
+            line.data[--line.len] = '\0';
+        if (strcasecmp(line.data, "QUIT") == 0)
+            break;
+
+        out.len = 0;
+        uint64_t id = 0;
+        if (strncasecmp(line.data, "GET ", 4) == 0)
+            forward_one(s, parse_lead_id(line.data + 4, &id) ? shard_of(id) : 0, line.data, RK_GET, &out);
+        else if (strncasecmp(line.data, "ADD ", 4) == 0)
+            forward_one(s, parse_row_id(line.data + 4, &id) ? shard_of(id) : 0, line.data, RK_LINE, &out);
+        else if (strncasecmp(line.data, "UPDATE ", 7) == 0)
+            forward_one(s, parse_row_id(line.data + 7, &id) ? shard_of(id) : 0, line.data, RK_LINE, &out);
+        else if (strncasecmp(line.data, "DEL ", 4) == 0)
+            forward_one(s, parse_lead_id(line.data + 4, &id) ? shard_of(id) : 0, line.data, RK_LINE, &out);
+        else if (strncasecmp(line.data, "MGET ", 5) == 0)
+            cmd_mget(s, line.data + 5, &out);
+        else if (strncasecmp(line.data, "FORMAT ", 7) == 0)
+            cmd_format(s, line.data, &out);
+        else if (strcasecmp(line.data, "STATS") == 0)
+            cmd_stats(s, &out);
+        else
+            buf_puts(&out, "ERR expected: GET <id>, MGET <id>..., ADD <csv>, UPDATE <csv>, DEL <id>, FORMAT card|csv|json or STATS\n");
+
+        if (out.len && send_all(s->client_fd, out.data, out.len) != 0)
+            break;
+    }
+
+    for (int i = 0; i < g_nshards; ++i)
+        shard_drop(s, i);
+    close(s->client_fd);
+    free(s->client);
+    free(s);
+    free(line.data);
+    free(out.data);
+    return NULL;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Uso: %s <IP> <PUERTO> <host:puerto del shard 0> [<host:puerto del shard 1> ...]\n"
+            "GET, ADD, UPDATE y DEL van al shard hash_id(id) %% K (mismo reparto que split_index).\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    const char *bind_ip = argv[1];
+    int port = atoi(argv[2]);
+    for (int i = 3; i < argc; ++i)
+    {
+        if (g_nshards == MAX_SHARDS)
+        {
+            fprintf(stderr, "Máximo %d shards\n", MAX_SHARDS);
+            return EXIT_FAILURE;
+        }
+        const char *colon = strrchr(argv[i], ':');
+        if (!colon || colon == argv[i] || (size_t)(colon - argv[i]) >= sizeof(g_shards[0].host))
+        {
+            fprintf(stderr, "Shard inválido (se espera host:puerto): %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        memcpy(g_shards[g_nshards].host, argv[i], (size_t)(colon - argv[i]));
+        g_shards[g_nshards].host[colon - argv[i]] = '\0';
+        g_shards[g_nshards].port = atoi(colon + 1);
+        g_nshards++;
+    }
+
+    int ls = socket(AF_INET, SOCK_STREAM, 0);
+    if (ls < 0)
+    {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+    int yes = 1;
+    setsockopt(ls, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, bind_ip, &addr.sin_addr) != 1 || bind(ls, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(ls, 64) < 0)
+    {
+        perror("bind/listen");
+        return EXIT_FAILURE;
+    }
+    printf("Router listo en %s:%d | %d shards\n", bind_ip, port, g_nshards);
+    fflush(stdout);
+
+    for (;;)
+    {
+        int cfd = accept(ls, NULL, NULL);
+        if (cfd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("accept");
+            break;
+        }
+        int one = 1;
+        setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        Session *s = (Session *)calloc(1, sizeof(Session));
+        Reader *r = (Reader *)calloc(1, sizeof(Reader));
+        if (!s || !r)
+        {
+            free(s);
+            free(r);
+            close(cfd);
+            continue;
+        }
+        s->client_fd = cfd;
+        r->fd = cfd;
+        s->client = r;
+        pthread_t th;
+        if (pthread_create(&th, NULL, client_thread, s) != 0)
+        {
+            close(cfd);
+            free(r);
+            free(s);
+            continue;
+        }
+        pthread_detach(th);
+    }
+    close(ls);
+    return EXIT_SUCCESS;
+}
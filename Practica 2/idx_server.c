@@ -1,20 +1,39 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE // syscall() para io_uring sin liburing
 #define _FILE_OFFSET_BITS 64
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <linux/io_uring.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "blk_store.h"
+#include "idx_crc.h"
+#include "idx_dense.h"
+#include "idx_shm.h"
+
 // ====== Estructuras del índice ======
 typedef struct
 {
@@ -24,7 +43,7 @@ typedef struct
 
 typedef struct
 {
-    char magic[8];          // "BKIDXv01"
+    char magic[8];          // "BKIDXv02" (v01: sin tabla de checksums)
     uint64_t table_size;    // 1000
     uint64_t total_entries; // N
 } Header;
@@ -35,16 +54,42 @@ typedef struct
     uint64_t bucket_count;  // nº de pares
 } DirEntry;
 
+#define TABLE_SIZE 1000 // nº de buckets del índice
+
 static inline unsigned hash_id(uint64_t id)
 {
-    return (unsigned)((id * 2654435761UL) % 1000);
+    return (unsigned)((id * 2654435761UL) % TABLE_SIZE);
 }
 
-// ====== Estado global sólo-lectura ======
-static FILE *g_idx = NULL;
+// ====== Vista del índice: archivo, header y directorio que se reemplazan juntos ======
+// REBUILD construye un índice nuevo y publica otra vista con un solo puntero (estilo RCU).
+// Los lectores la anuncian en su ranura de hazard pointer mientras la usan; la vista vieja
+// sólo se libera cuando ninguna ranura la apunta, así que las lecturas nunca se pausan.
+// Dentro de una vista, ADD cambia entradas del directorio en caliente: cada entrada lleva
+// un contador de secuencia (seqlock, ver dir_read/dir_write). VACUUM reescribe también el CSV,
+// así que la vista lleva el descriptor del CSV al que apuntan sus offsets.
+typedef struct
+{
+    FILE *idx;           // books.idx abierto r+b
+    int csv_fd;          // CSV de los offsets de esta vista (lo cierra VACUUM al retirarla)
+    Header hdr;          // header en RAM
+    DirEntry *dir;       // directorio en RAM (~16 KB)
+    unsigned *dir_seq;   // secuencia por entrada: impar mientras un ADD la modifica
+    uint32_t *bucket_crc; // v2: CRC32C por bucket, header_crc y reservado (NULL en v1)
+    unsigned char *verified; // --verify-buckets: 1 si el bucket ya se comprobó, 2 si está dañado
+    DenseHeader *dense;  // <books.idx>.dense mapeado (NULL si no hay tabla densa)
+    size_t dense_bytes;  // tamaño del mapeo
+    uint64_t generation; // 0 al arrancar, +1 por cada REBUILD
+} IndexView;
+
+// ====== Estado global ======
+static IndexView *g_view = NULL;
 static FILE *g_csv = NULL;
-static Header g_hdr;
-static DirEntry *g_dir = NULL;
+static const char *g_idx_path = NULL;
+static const char *g_csv_path = NULL;
+
+// Serializa los ADD: comprobación de duplicado, append al CSV y reescritura del bucket
+static pthread_mutex_t g_write_mu = PTHREAD_MUTEX_INITIALIZER;
 
 static volatile sig_atomic_t g_stop = 0;
 static void handle_sigint(int s)
@@ -53,255 +98,4221 @@ static void handle_sigint(int s)
     g_stop = 1;
 }
 
-// ====== Lectura robusta de línea del socket ======
-static ssize_t read_line(int fd, char *buf, size_t cap)
+// ====== Opciones de línea de comandos (--clave=valor tras los 4 posicionales) ======
+typedef struct
 {
-    size_t n = 0;
-    while (n + 1 < cap)
+    int metrics_port;     // puerto local para volcado Prometheus (0 = desactivado)
+    const char *hot_file; // conjunto caliente persistido (NULL = <books.idx>.hot)
+    int hot_interval;     // segundos entre guardados del conjunto caliente
+    double warm_rate_mb;  // MB/s máximos de precalentamiento al arrancar
+    bool io_uring;        // lecturas de GET vía anillo io_uring (si no, pread bloqueante)
+    unsigned uring_depth; // entradas del anillo (lecturas en vuelo máximas)
+    int repl_port;        // puerto del flujo de replicación para réplicas (0 = desactivado)
+    const char *follow;   // "IP:PUERTO" del primario: modo réplica de sólo lectura
+    const char *blocks;   // almacén de filas comprimido (books.blk de pack_store; NULL = sólo CSV)
+    unsigned block_cache_mb; // MB de bloques descomprimidos en caché
+    int acceptors;        // sockets de escucha SO_REUSEPORT, cada uno con su hilo de accept
+    int backlog;          // cola de conexiones pendientes de cada socket de escucha
+    bool nodelay;         // TCP_NODELAY en las conexiones aceptadas
+    int busy_poll_us;     // SO_BUSY_POLL en las conexiones aceptadas (0 = no)
+    int pin;              // PIN_NONE, PIN_CORE o PIN_NODE: afinidad de cada aceptador
+    bool verify_buckets;  // comprueba el CRC32C de cada bucket la primera vez que se carga
+    int max_conns;        // conexiones abiertas a la vez (0 = sin límite)
+    int idle_timeout_s;   // cierra la conexión sin comandos durante S segundos (0 = nunca)
+    int read_timeout_s;   // tope para terminar de recibir un comando o enviar una respuesta (0 = sin tope)
+    int max_inflight;     // GET/MGET/ADD ejecutándose a la vez (0 = sin control de admisión)
+    int max_queue;        // peticiones esperando turno; más allá se rechazan al momento
+    int queue_timeout_ms; // espera máxima por un turno antes de responder ERR BUSY
+    const char *unix_path; // socket Unix adicional para clientes locales (y sesiones SHM)
+    double dense_min;      // ocupación mínima para usar/generar la tabla densa (0 = nunca)
+} ServerOptions;
+
+enum
+{
+    PIN_NONE = 0,
+    PIN_CORE = 1, // aceptador i (y sus hilos de conexión) en la i-ésima CPU permitida
+    PIN_NODE = 2  // aceptador i en las CPUs del nodo NUMA i % nº de nodos
+};
+
+static ServerOptions g_opt = {0, NULL, 60, 64.0, false, 256, 0, NULL, NULL, 64, 1, 64, false, 0, PIN_NONE, false, 0, 0, 0, 0, 256, 50, NULL, DENSE_MIN_FILL};
+
+// Nº de regiones del CSV con contador de accesos (conjunto caliente)
+#define HOT_REGIONS 2048
+
+// ====== Métricas: histogramas tipo HDR (log-lineales) ======
+// Cada potencia de dos se divide en HIST_SUB sub-rangos: error relativo <= 1/16.
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_SLOTS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct
+{
+    uint64_t counts[HIST_SLOTS];
+    uint64_t total; // nº de muestras
+    uint64_t sum;   // suma de valores (para la media y *_sum de Prometheus)
+    uint64_t max;
+} Histogram;
+
+// Suma sin atómicos de lectura-modificación: cada contador sólo lo escribe su hilo
+// dueño; los lectores (STATS) usan cargas relajadas. En x86 compila a un add normal.
+#define STAT_ADD(field, v) \
+    __atomic_store_n(&(field), __atomic_load_n(&(field), __ATOMIC_RELAXED) + (v), __ATOMIC_RELAXED)
+#define STAT_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+static inline unsigned hist_slot(uint64_t v)
+{
+    if (v < HIST_SUB)
+        return (unsigned)v;
+    unsigned msb = 63u - (unsigned)__builtin_clzll(v);
+    unsigned shift = msb - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (unsigned)((v >> shift) & (HIST_SUB - 1));
+}
+
+// Valor representativo (límite superior) de un slot del histograma
+static inline uint64_t hist_slot_value(unsigned slot)
+{
+    if (slot < HIST_SUB)
+        return slot;
+    unsigned shift = slot / HIST_SUB - 1;
+    uint64_t sub = slot % HIST_SUB;
+    return ((HIST_SUB + sub + 1) << shift) - 1;
+}
+
+static void hist_record(Histogram *h, uint64_t v)
+{
+    STAT_ADD(h->counts[hist_slot(v)], 1);
+    STAT_ADD(h->total, 1);
+    STAT_ADD(h->sum, v);
+    if (v > STAT_LOAD(h->max))
+        __atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+}
+
+static void hist_merge(Histogram *dst, Histogram *src)
+{
+    for (unsigned i = 0; i < HIST_SLOTS; ++i)
+        dst->counts[i] += STAT_LOAD(src->counts[i]);
+    dst->total += STAT_LOAD(src->total);
+    dst->sum += STAT_LOAD(src->sum);
+    uint64_t m = STAT_LOAD(src->max);
+    if (m > dst->max)
+        dst->max = m;
+}
+
+// Percentil q (0..1) aproximado según la resolución del histograma
+static uint64_t hist_percentile(const Histogram *h, double q)
+{
+    if (h->total == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(q * (double)h->total + 0.5);
+    if (rank == 0)
+        rank = 1;
+    uint64_t acc = 0;
+    for (unsigned i = 0; i < HIST_SLOTS; ++i)
     {
-        char c;
-        ssize_t r = recv(fd, &c, 1, 0);
-        if (r == 0)
-            return 0; // peer closed
-        if (r < 0)
+        acc += h->counts[i];
+        if (acc >= rank)
         {
-            if (errno == EINTR)
+            uint64_t v = hist_slot_value(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+// ====== Métricas: contadores por hilo ======
+typedef struct ThreadStats
+{
+    uint64_t cmd_get;     // GET atendidos
+    uint64_t get_miss;    // GET con NOTFOUND
+    uint64_t cmd_add;     // ADD recibidos
+    uint64_t add_ok;      // ADD confirmados
+    uint64_t cmd_errors;  // respuestas ERR
+    uint64_t idx_bytes;   // bytes leídos de books.idx
+    uint64_t csv_bytes;   // bytes leídos del CSV
+    Histogram lat_get;    // latencia GET con resultado (ns)
+    Histogram lat_miss;   // latencia GET NOTFOUND (ns)
+    Histogram lat_add;    // latencia ADD (ns)
+    Histogram bucket_len; // tamaño (en pares) de los buckets cargados
+    uint64_t dir_retries; // relecturas del directorio por un ADD concurrente
+    uint64_t dense_hits;  // búsquedas resueltas por la tabla densa
+    uint64_t bucket_hits[TABLE_SIZE];  // accesos por bucket (conjunto caliente)
+    uint64_t region_hits[HOT_REGIONS]; // accesos por región del CSV
+    struct ThreadStats *next;
+    struct ThreadStats *prev;
+} ThreadStats;
+
+static pthread_mutex_t g_stats_mu = PTHREAD_MUTEX_INITIALIZER;
+static ThreadStats *g_stats_list = NULL; // hilos vivos
+static ThreadStats g_stats_retired;      // acumulado de hilos ya terminados
+static uint64_t g_conn_active = 0;       // conexiones abiertas (bajo g_stats_mu)
+static uint64_t g_conn_total = 0;        // conexiones aceptadas desde el arranque
+static struct timespec g_start_ts;
+
+// Progreso del precalentamiento (para STATS)
+static uint64_t g_warm_total = 0;
+static uint64_t g_warm_done = 0;
+
+// Backend io_uring (para STATS): SQEs enviados y llamadas a io_uring_enter que enviaron algo
+static uint64_t g_uring_sqes = 0;
+static uint64_t g_uring_enters = 0;
+
+// Aceptadores (para STATS): conexiones que el kernel repartió a cada socket SO_REUSEPORT.
+// Cada contador lo escribe sólo su hilo de accept; una línea de caché por aceptador.
+#define MAX_ACCEPTORS 64
+typedef struct
+{
+    uint64_t accepted;
+    int cpu; // primera CPU de su afinidad (-1 = sin fijar)
+    char pad[64 - sizeof(uint64_t) - sizeof(int)];
+} AcceptorStats;
+static AcceptorStats g_acceptor_stats[MAX_ACCEPTORS];
+
+// Checksums del índice (para STATS)
+static int g_idx_header_crc = -1;   // 1 coincide, 0 no coincide, -1 índice v1 sin checksums
+static uint64_t g_crc_verified = 0; // buckets comprobados por --verify-buckets
+static uint64_t g_crc_failures = 0; // lecturas de buckets que no coincidieron con su CRC32C
+
+// Control de admisión (para STATS): conexiones abiertas, rechazos y cierres por tiempo
+static int g_conn_open = 0;             // conexiones aceptadas aún vivas (para --max-conns)
+static uint64_t g_conn_rejected = 0;    // conexiones cerradas al aceptar por --max-conns
+static uint64_t g_idle_timeouts = 0;    // conexiones cerradas por --idle-timeout
+static uint64_t g_read_timeouts = 0;    // conexiones cerradas por --read-timeout
+static uint64_t g_send_timeouts = 0;    // conexiones cerradas porque una respuesta no salió
+static uint64_t g_busy_rejected = 0;    // peticiones respondidas con ERR BUSY
+static uint64_t g_adm_queued = 0;       // peticiones que tuvieron que esperar turno
+static uint64_t g_adm_wait_ns = 0;      // tiempo total de espera de esas peticiones
+
+// Transporte local (para STATS): conexiones por el socket Unix y sesiones de memoria compartida
+static uint64_t g_unix_accepted = 0; // conexiones aceptadas por --unix
+static uint64_t g_shm_sessions = 0;  // sesiones SHM abiertas desde el arranque
+static uint64_t g_shm_requests = 0;  // comandos recibidos por los anillos compartidos
+
+// Almacén por bloques (para STATS): aciertos/fallos de la caché y bytes comprimidos leídos
+static uint64_t g_blk_hits = 0;
+static uint64_t g_blk_misses = 0;
+static uint64_t g_blk_bytes = 0;
+static int g_blk_fd = -1; // books.blk abierto (-1 = sin almacén por bloques)
+
+// Replicación. Primario: bytes del CSV con filas ya indexadas (bajo g_write_mu; cada ADD
+// avisa por g_repl_cv a los hilos que alimentan a las réplicas).
+static uint64_t g_csv_committed = 0;
+static pthread_cond_t g_repl_cv = PTHREAD_COND_INITIALIZER;
+static uint64_t g_repl_followers = 0;  // réplicas conectadas
+static uint64_t g_repl_bytes_sent = 0; // bytes de filas enviados a réplicas
+// Réplica: estado del flujo que consume (para STATS)
+static uint64_t g_repl_connected = 0;    // 1 si hay sesión con el primario
+static uint64_t g_repl_primary_size = 0; // tamaño del CSV del primario (último latido)
+static uint64_t g_repl_caught_up_ns = 0; // última vez que la réplica estaba al día
+
+// REBUILD (para STATS; g_rebuild_running se modifica bajo g_write_mu)
+static bool g_rebuild_running = false;
+static uint64_t g_rebuild_count = 0;   // reconstrucciones completadas
+static uint64_t g_rebuild_last_ms = 0; // duración de la última
+static uint64_t g_rebuild_rows = 0;    // filas leídas por la reconstrucción en curso
+
+// UPDATE, DEL y VACUUM (para STATS; VACUUM usa el hilo y el estado de REBUILD)
+static uint64_t g_update_ok = 0;        // UPDATE confirmados
+static uint64_t g_del_ok = 0;           // DEL confirmados
+static uint64_t g_vacuum_count = 0;     // VACUUM completados
+static uint64_t g_vacuum_last_ms = 0;   // duración del último
+static uint64_t g_vacuum_reclaimed = 0; // bytes de filas muertas que quitó del CSV el último
+
+// Contadores del hilo actual (NULL en hilos sin registrar, p. ej. main)
+static __thread ThreadStats *t_stats = NULL;
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// ====== Hazard pointers: una ranura por hilo lector ======
+// Las ranuras van en bloques de HP_SLOTS encadenados: si todas están ocupadas (más hilos que
+// ranuras, p. ej. con --max-conns=0) se añade un bloque en vez de esperar. Los bloques no se
+// liberan; las ranuras de los hilos que terminan se reutilizan.
+#define HP_SLOTS 4096
+
+typedef struct
+{
+    IndexView *ptr; // vista en uso (NULL si ninguna)
+    int owned;      // 1 si algún hilo tiene la ranura
+    char pad[64 - sizeof(void *) - sizeof(int)];
+} HazardSlot;
+
+typedef struct HazardBlock
+{
+    HazardSlot slots[HP_SLOTS];
+    struct HazardBlock *next;
+} HazardBlock;
+
+static HazardBlock g_hazards; // primer bloque; los demás se enlazan detrás
+static __thread HazardSlot *t_hp = NULL;
+
+// Reserva (una vez por hilo) una ranura libre
+static HazardSlot *hp_slot(void)
+{
+    HazardBlock *b = &g_hazards;
+    while (!t_hp)
+    {
+        for (unsigned i = 0; i < HP_SLOTS && !t_hp; ++i)
+        {
+            int expected = 0;
+            if (__atomic_compare_exchange_n(&b->slots[i].owned, &expected, 1, false, __ATOMIC_ACQ_REL,
+                                            __ATOMIC_RELAXED))
+                t_hp = &b->slots[i];
+        }
+        if (t_hp)
+            break;
+        HazardBlock *next = __atomic_load_n(&b->next, __ATOMIC_SEQ_CST);
+        if (!next)
+        {
+            // Bloque lleno y último: se añade otro con la primera ranura ya tomada
+            HazardBlock *nb = (HazardBlock *)calloc(1, sizeof(HazardBlock));
+            if (!nb)
+            {
+                sched_yield(); // sin memoria: se vuelve a buscar una ranura que se libere
+                b = &g_hazards;
                 continue;
-            return -1;
+            }
+            nb->slots[0].owned = 1;
+            if (__atomic_compare_exchange_n(&b->next, &next, nb, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            {
+                t_hp = &nb->slots[0];
+                break;
+            }
+            free(nb); // otro hilo enlazó uno antes: next ya es ese
         }
-        buf[n++] = c;
-        if (c == '\n')
+        b = next;
+    }
+    return t_hp;
+}
+
+// Devuelve la ranura al terminar el hilo
+static void hp_slot_release(void)
+{
+    if (t_hp)
+    {
+        __atomic_store_n(&t_hp->ptr, NULL, __ATOMIC_RELEASE);
+        __atomic_store_n(&t_hp->owned, 0, __ATOMIC_RELEASE);
+        t_hp = NULL;
+    }
+}
+
+// Toma la vista actual: se anuncia y se comprueba que sigue publicada
+static IndexView *view_acquire(void)
+{
+    HazardSlot *h = hp_slot();
+    IndexView *v;
+    do
+    {
+        v = __atomic_load_n(&g_view, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&h->ptr, v, __ATOMIC_SEQ_CST);
+    } while (v != __atomic_load_n(&g_view, __ATOMIC_SEQ_CST));
+    return v;
+}
+
+static void view_release(void)
+{
+    __atomic_store_n(&t_hp->ptr, NULL, __ATOMIC_RELEASE);
+}
+
+// Libera una vista ya despublicada cuando ninguna ranura la tenga anunciada
+static void view_retire(IndexView *old)
+{
+    for (HazardBlock *b = &g_hazards; b; b = __atomic_load_n(&b->next, __ATOMIC_SEQ_CST))
+        for (unsigned i = 0; i < HP_SLOTS; ++i)
+            while (__atomic_load_n(&b->slots[i].ptr, __ATOMIC_SEQ_CST) == old)
+                sched_yield();
+    fclose(old->idx);
+    free(old->dir);
+    free(old->dir_seq);
+    free(old->bucket_crc);
+    free(old->verified);
+    if (old->dense)
+        munmap(old->dense, old->dense_bytes);
+    free(old);
+}
+
+// ====== Directorio: lectura sin locks con secuencia por entrada ======
+// ADD nunca sobrescribe un bucket: escribe la versión nueva al final de books.idx y después
+// cambia (bucket_offset, bucket_count). Ese par se publica con un seqlock por entrada: el
+// escritor (ya serializado por g_write_mu) pone la secuencia en impar, escribe y la pone en
+// par; el lector reintenta si la vio impar o cambió. El lector no escribe memoria compartida
+// y cualquier par que acepta apunta a una versión completa del bucket.
+// UPDATE y DEL sí cambian un offset dentro del bucket publicado (8 bytes, sin copiarlo): lo hacen
+// con la secuencia en impar, así que el lector guarda la que vio en *seq y, tras leer el bucket,
+// comprueba con dir_stable que no cambió; si cambió, vuelve a leerlo.
+// En v2 el CRC del bucket viaja con la entrada: crc (si no es NULL) recibe el de esa versión.
+static DirEntry dir_read(const IndexView *v, unsigned b, uint32_t *crc, unsigned *seq)
+{
+    DirEntry d;
+    unsigned s1, s2, spins = 0;
+    for (;;)
+    {
+        s1 = __atomic_load_n(&v->dir_seq[b], __ATOMIC_ACQUIRE);
+        d.bucket_offset = __atomic_load_n(&v->dir[b].bucket_offset, __ATOMIC_RELAXED);
+        d.bucket_count = __atomic_load_n(&v->dir[b].bucket_count, __ATOMIC_RELAXED);
+        if (crc && v->bucket_crc)
+            *crc = __atomic_load_n(&v->bucket_crc[b], __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&v->dir_seq[b], __ATOMIC_RELAXED);
+        if (!(s1 & 1) && s1 == s2)
             break;
+        spins++;
     }
-    buf[n] = '\0';
-    return (ssize_t)n;
+    if (spins && t_stats)
+        STAT_ADD(t_stats->dir_retries, spins);
+    if (seq)
+        *seq = s1;
+    return d;
 }
 
-// ====== Busca id en su bucket (carga bucket a RAM, <= unos cientos de KB) ======
-static int find_offset(uint64_t id, uint64_t *out_off)
+// 1 si la entrada b no cambió desde el dir_read que devolvió seq (el bucket leído es válido)
+static int dir_stable(const IndexView *v, unsigned b, unsigned seq)
 {
-    unsigned b = hash_id(id);
-    uint64_t count = g_dir[b].bucket_count;
-    if (count == 0)
-        return 0;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&v->dir_seq[b], __ATOMIC_RELAXED) == seq)
+        return 1;
+    if (t_stats)
+        STAT_ADD(t_stats->dir_retries, 1);
+    return 0;
+}
 
-    if (fseeko(g_idx, (off_t)g_dir[b].bucket_offset, SEEK_SET) != 0)
-        return -1;
+static void dir_write(IndexView *v, unsigned b, DirEntry d, uint32_t crc)
+{
+    unsigned s = v->dir_seq[b];
+    __atomic_store_n(&v->dir_seq[b], s + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&v->dir[b].bucket_offset, d.bucket_offset, __ATOMIC_RELAXED);
+    __atomic_store_n(&v->dir[b].bucket_count, d.bucket_count, __ATOMIC_RELAXED);
+    if (v->bucket_crc)
+        __atomic_store_n(&v->bucket_crc[b], crc, __ATOMIC_RELAXED);
+    __atomic_store_n(&v->dir_seq[b], s + 2, __ATOMIC_RELEASE);
+}
 
-    size_t bytes = (size_t)count * sizeof(Pair);
-    // Seguridad de memoria: limita a 8MB por lectura de bucket (muy por debajo del límite pedido)
-    if (bytes > (8u << 20))
+// ====== Verificación perezosa de buckets (--verify-buckets, índices v2) ======
+// La primera vez que se carga cada bucket de la vista se compara su CRC32C con el de la tabla;
+// los siguientes accesos no pagan nada. Un bucket dañado se avisa una vez y sus GET responden
+// ERR internal en vez de devolver filas de otro id. 0 si se puede usar, -1 si está dañado.
+static int bucket_verify(IndexView *v, unsigned b, uint32_t crc, const Pair *pairs, size_t bytes)
+{
+    if (!g_opt.verify_buckets || !v->bucket_crc || __atomic_load_n(&v->verified[b], __ATOMIC_ACQUIRE) == 1)
+        return 0;
+    if (crc32c(0, pairs, bytes) != crc)
+    {
+        STAT_ADD(g_crc_failures, 1);
+        if (__atomic_exchange_n(&v->verified[b], 2, __ATOMIC_RELAXED) != 2)
+            fprintf(stderr, "verify: el bucket %u no coincide con su CRC32C (idx_verify para detalles)\n", b);
         return -1;
+    }
+    if (__atomic_exchange_n(&v->verified[b], 1, __ATOMIC_RELEASE) != 1)
+        STAT_ADD(g_crc_verified, 1);
+    return 0;
+}
 
-    Pair *buf = (Pair *)malloc(bytes);
-    if (!buf)
+// ====== Tabla densa: una ranura por id (ver idx_dense.h) ======
+// Los lectores miran el bit y después cargan el offset; ADD (con g_write_mu) escribe el offset
+// y después pone el bit con release, así que un bit visible siempre tiene su offset completo.
+// 1 si el id está (offset en *out_off), 0 si no y -1 si cae fuera de la tabla (va por buckets).
+static int dense_find(const IndexView *v, uint64_t id, uint64_t *out_off)
+{
+    int64_t slot = v->dense ? dense_slot(v->dense, id) : -1;
+    if (slot < 0)
         return -1;
+    uint64_t bits = __atomic_load_n(&dense_bits(v->dense)[slot >> 6], __ATOMIC_ACQUIRE);
+    if (!(bits & (1ull << (slot & 63))))
+        return 0;
+    *out_off = __atomic_load_n(&dense_offsets(v->dense)[slot], __ATOMIC_RELAXED);
+    if (t_stats)
+        STAT_ADD(t_stats->dense_hits, 1);
+    return 1;
+}
+
+// Ocupa la ranura del id o, si ya estaba (UPDATE), sólo cambia su offset; llamar con g_write_mu.
+// Un lector concurrente ve el offset viejo o el nuevo, y los dos son filas completas del id.
+static void dense_store(IndexView *v, int64_t slot, uint64_t offset)
+{
+    __atomic_store_n(&dense_offsets(v->dense)[slot], offset, __ATOMIC_RELAXED);
+    uint64_t bit = 1ull << (slot & 63);
+    if (!(__atomic_fetch_or(&dense_bits(v->dense)[slot >> 6], bit, __ATOMIC_RELEASE) & bit))
+        __atomic_store_n(&v->dense->count, v->dense->count + 1, __ATOMIC_RELAXED);
+}
+
+// Libera la ranura del id (DEL); llamar con g_write_mu
+static void dense_clear(IndexView *v, int64_t slot)
+{
+    uint64_t bit = 1ull << (slot & 63);
+    if (__atomic_fetch_and(&dense_bits(v->dense)[slot >> 6], ~bit, __ATOMIC_RELEASE) & bit)
+        __atomic_store_n(&v->dense->count, v->dense->count - 1, __ATOMIC_RELAXED);
+}
 
-    size_t rd = fread(buf, sizeof(Pair), (size_t)count, g_idx);
-    if (rd != (size_t)count)
+// Mapea <books.idx>.dense si existe y refleja exactamente csv_size bytes del CSV
+static void dense_attach(IndexView *v, const char *idx_path, uint64_t csv_size)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.dense", idx_path);
+    if (g_opt.dense_min <= 0.0 || access(path, F_OK) != 0)
+        return;
+    size_t bytes = 0;
+    DenseHeader *h = dense_map(path, 1, &bytes);
+    if (!h)
     {
-        free(buf);
-        return -1;
+        fprintf(stderr, "AVISO: %s no es una tabla densa válida; se ignora\n", path);
+        return;
+    }
+    if (h->csv_end != csv_size)
+    {
+        fprintf(stderr,
+                "AVISO: %s refleja %" PRIu64 " bytes del CSV y tiene %" PRIu64 "; se ignora y los GET van "
+                "por books.idx hasta el próximo REBUILD\n",
+                path, h->csv_end, csv_size);
+        munmap(h, bytes);
+        return;
     }
+    v->dense = h;
+    v->dense_bytes = bytes;
+}
+
+// Registra los contadores del hilo de conexión actual
+static void stats_thread_enter(void)
+{
+    ThreadStats *st = (ThreadStats *)calloc(1, sizeof(ThreadStats));
+    if (!st)
+        return;
+    pthread_mutex_lock(&g_stats_mu);
+    st->next = g_stats_list;
+    if (g_stats_list)
+        g_stats_list->prev = st;
+    g_stats_list = st;
+    g_conn_active++;
+    g_conn_total++;
+    pthread_mutex_unlock(&g_stats_mu);
+    t_stats = st;
+}
 
-    // Binary search por id
-    int lo = 0, hi = (int)count - 1;
-    while (lo <= hi)
+// Traspasa los contadores del hilo al acumulado global y lo desregistra
+static void stats_thread_exit(void)
+{
+    ThreadStats *st = t_stats;
+    pthread_mutex_lock(&g_stats_mu);
+    g_conn_active--;
+    if (st)
     {
-        int mid = lo + ((hi - lo) >> 1);
-        if (buf[mid].id == id)
-        {
-            *out_off = buf[mid].offset;
-            free(buf);
-            return 1;
-        }
-        else if (buf[mid].id < id)
-        {
-            lo = mid + 1;
-        }
+        if (st->prev)
+            st->prev->next = st->next;
         else
-        {
-            hi = mid - 1;
-        }
+            g_stats_list = st->next;
+        if (st->next)
+            st->next->prev = st->prev;
+    }
+    if (st)
+    {
+        g_stats_retired.cmd_get += st->cmd_get;
+        g_stats_retired.get_miss += st->get_miss;
+        g_stats_retired.cmd_add += st->cmd_add;
+        g_stats_retired.add_ok += st->add_ok;
+        g_stats_retired.cmd_errors += st->cmd_errors;
+        g_stats_retired.idx_bytes += st->idx_bytes;
+        g_stats_retired.csv_bytes += st->csv_bytes;
+        g_stats_retired.dir_retries += st->dir_retries;
+        g_stats_retired.dense_hits += st->dense_hits;
+        hist_merge(&g_stats_retired.lat_get, &st->lat_get);
+        hist_merge(&g_stats_retired.lat_miss, &st->lat_miss);
+        hist_merge(&g_stats_retired.lat_add, &st->lat_add);
+        hist_merge(&g_stats_retired.bucket_len, &st->bucket_len);
+        for (unsigned i = 0; i < TABLE_SIZE; ++i)
+            g_stats_retired.bucket_hits[i] += st->bucket_hits[i];
+        for (unsigned i = 0; i < HOT_REGIONS; ++i)
+            g_stats_retired.region_hits[i] += st->region_hits[i];
     }
-    free(buf);
-    return 0; // no encontrado
+    pthread_mutex_unlock(&g_stats_mu);
+    free(st);
+    t_stats = NULL;
 }
 
-// ====== Lee la línea completa del CSV en offset ======
-static int read_csv_line_at(uint64_t off, char **out, size_t *out_len)
+typedef struct
 {
-    if (fseeko(g_csv, (off_t)off, SEEK_SET) != 0)
-        return -1;
+    ThreadStats agg;
+    uint64_t conn_active;
+    uint64_t conn_total;
+    double uptime_s;
+} StatsSnapshot;
 
-    // Lee hasta '\n' en un buffer dinámico
-    size_t cap = 4096;
-    size_t len = 0;
-    char *buf = (char *)malloc(cap);
-    if (!buf)
-        return -1;
+// Suma los contadores de todos los hilos (vivos y terminados)
+static void stats_snapshot(StatsSnapshot *out)
+{
+    memset(out, 0, sizeof(*out));
+    pthread_mutex_lock(&g_stats_mu);
+    out->agg = g_stats_retired;
+    for (ThreadStats *st = g_stats_list; st; st = st->next)
+    {
+        out->agg.cmd_get += STAT_LOAD(st->cmd_get);
+        out->agg.get_miss += STAT_LOAD(st->get_miss);
+        out->agg.cmd_add += STAT_LOAD(st->cmd_add);
+        out->agg.add_ok += STAT_LOAD(st->add_ok);
+        out->agg.cmd_errors += STAT_LOAD(st->cmd_errors);
+        out->agg.idx_bytes += STAT_LOAD(st->idx_bytes);
+        out->agg.csv_bytes += STAT_LOAD(st->csv_bytes);
+        out->agg.dir_retries += STAT_LOAD(st->dir_retries);
+        out->agg.dense_hits += STAT_LOAD(st->dense_hits);
+        hist_merge(&out->agg.lat_get, &st->lat_get);
+        hist_merge(&out->agg.lat_miss, &st->lat_miss);
+        hist_merge(&out->agg.lat_add, &st->lat_add);
+        hist_merge(&out->agg.bucket_len, &st->bucket_len);
+    }
+    out->conn_active = g_conn_active;
+    out->conn_total = g_conn_total;
+    pthread_mutex_unlock(&g_stats_mu);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    out->uptime_s = (double)(ts.tv_sec - g_start_ts.tv_sec) + (double)(ts.tv_nsec - g_start_ts.tv_nsec) / 1e9;
+}
 
+// ====== Buffer de texto creciente para componer respuestas largas ======
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t cap;
+} StrBuf;
+
+static int sb_printf(StrBuf *sb, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static int sb_printf(StrBuf *sb, const char *fmt, ...)
+{
     for (;;)
     {
-        int c = fgetc(g_csv);
-        if (c == EOF)
-            break;
-        if (len + 1 >= cap)
+        size_t avail = sb->cap - sb->len;
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(sb->data ? sb->data + sb->len : NULL, sb->data ? avail : 0, fmt, ap);
+        va_end(ap);
+        if (n < 0)
+            return -1;
+        if (sb->data && (size_t)n < avail)
         {
-            size_t ncap = cap * 2;
-            char *tmp = (char *)realloc(buf, ncap);
-            if (!tmp)
-            {
-                free(buf);
-                return -1;
-            }
-            cap = ncap;
-            buf = tmp;
+            sb->len += (size_t)n;
+            return 0;
         }
-        buf[len++] = (char)c;
-        if (c == '\n')
-            break;
+        size_t ncap = sb->cap ? sb->cap * 2 : 4096;
+        while (ncap < sb->len + (size_t)n + 1)
+            ncap *= 2;
+        char *tmp = (char *)realloc(sb->data, ncap);
+        if (!tmp)
+            return -1;
+        sb->data = tmp;
+        sb->cap = ncap;
     }
-    buf[len] = '\0';
-    *out = buf;
-    *out_len = len;
-    return (len > 0) ? 0 : -1;
 }
 
-// ===============================================================
-// Convierte una línea CSV en ficha legible (solo campos clave)
-// ===============================================================
-static char *format_record(const char *csv_line)
+// Texto de la respuesta al comando STATS: "OK STATS\n" + "clave valor" por línea + "END\n"
+static void stats_render_text(StrBuf *sb)
 {
-    // Duplicamos la línea porque strtok modifica el string
-    char *temp = strdup(csv_line);
-    if (!temp)
-        return NULL;
+    StatsSnapshot s;
+    stats_snapshot(&s);
+    const ThreadStats *a = &s.agg;
+    uint64_t lookups = a->cmd_get;
 
-    const int MAX_FIELDS = 24;
-    char *fields[MAX_FIELDS];
-    int count = 0;
+    sb_printf(sb, "OK STATS\n");
+    sb_printf(sb, "uptime_s %.1f\n", s.uptime_s);
+    sb_printf(sb, "connections_active %" PRIu64 "\n", s.conn_active);
+    sb_printf(sb, "connections_total %" PRIu64 "\n", s.conn_total);
+    sb_printf(sb, "acceptors %d\n", g_opt.acceptors);
+    for (int i = 0; i < g_opt.acceptors; ++i)
+    {
+        sb_printf(sb, "acceptor%d_accepted %" PRIu64 "\n", i, STAT_LOAD(g_acceptor_stats[i].accepted));
+        sb_printf(sb, "acceptor%d_cpu %d\n", i, g_acceptor_stats[i].cpu);
+    }
+    IndexView *v = view_acquire();
+    sb_printf(sb, "index_entries %" PRIu64 "\n", __atomic_load_n(&v->hdr.total_entries, __ATOMIC_RELAXED));
+    sb_printf(sb, "index_generation %" PRIu64 "\n", v->generation);
+    sb_printf(sb, "rebuild_running %d\n", __atomic_load_n(&g_rebuild_running, __ATOMIC_RELAXED) ? 1 : 0);
+    sb_printf(sb, "rebuild_rows_scanned %" PRIu64 "\n", __atomic_load_n(&g_rebuild_rows, __ATOMIC_RELAXED));
+    sb_printf(sb, "rebuild_count %" PRIu64 "\n", STAT_LOAD(g_rebuild_count));
+    sb_printf(sb, "rebuild_last_ms %" PRIu64 "\n", __atomic_load_n(&g_rebuild_last_ms, __ATOMIC_RELAXED));
+    sb_printf(sb, "vacuum_count %" PRIu64 "\n", STAT_LOAD(g_vacuum_count));
+    sb_printf(sb, "vacuum_last_ms %" PRIu64 "\n", __atomic_load_n(&g_vacuum_last_ms, __ATOMIC_RELAXED));
+    sb_printf(sb, "vacuum_reclaimed_bytes %" PRIu64 "\n", __atomic_load_n(&g_vacuum_reclaimed, __ATOMIC_RELAXED));
+    sb_printf(sb, "dense_table %s\n", v->dense ? "on" : "off");
+    if (v->dense)
+    {
+        sb_printf(sb, "dense_min_id %" PRIu64 "\n", v->dense->min_id);
+        sb_printf(sb, "dense_slots %" PRIu64 "\n", v->dense->slots);
+        sb_printf(sb, "dense_entries %" PRIu64 "\n", __atomic_load_n(&v->dense->count, __ATOMIC_RELAXED));
+    }
+    view_release();
+    sb_printf(sb, "cmd_get %" PRIu64 "\n", a->cmd_get);
+    sb_printf(sb, "get_miss %" PRIu64 "\n", a->get_miss);
+    sb_printf(sb, "get_hit_ratio %.4f\n", lookups ? (double)(lookups - a->get_miss) / (double)lookups : 0.0);
+    sb_printf(sb, "cmd_add %" PRIu64 "\n", a->cmd_add);
+    sb_printf(sb, "add_ok %" PRIu64 "\n", a->add_ok);
+    sb_printf(sb, "update_ok %" PRIu64 "\n", STAT_LOAD(g_update_ok));
+    sb_printf(sb, "del_ok %" PRIu64 "\n", STAT_LOAD(g_del_ok));
+    sb_printf(sb, "cmd_errors %" PRIu64 "\n", a->cmd_errors);
+    sb_printf(sb, "idx_bytes_read %" PRIu64 "\n", a->idx_bytes);
+    sb_printf(sb, "csv_bytes_read %" PRIu64 "\n", a->csv_bytes);
+    sb_printf(sb, "dir_read_retries %" PRIu64 "\n", a->dir_retries);
+    sb_printf(sb, "dense_lookups %" PRIu64 "\n", a->dense_hits);
+    sb_printf(sb, "index_header_crc %s\n", g_idx_header_crc < 0 ? "none" : g_idx_header_crc ? "ok" : "mismatch");
+    sb_printf(sb, "crc_buckets_verified %" PRIu64 "\n", STAT_LOAD(g_crc_verified));
+    sb_printf(sb, "crc_failures %" PRIu64 "\n", STAT_LOAD(g_crc_failures));
 
-    char *tok = strtok(temp, ",");
-    while (tok && count < MAX_FIELDS)
+    const struct
+    {
+        const char *name;
+        const Histogram *h;
+    } lat[] = {{"get", &a->lat_get}, {"miss", &a->lat_miss}, {"add", &a->lat_add}};
+    for (size_t i = 0; i < sizeof(lat) / sizeof(lat[0]); ++i)
+    {
+        const Histogram *h = lat[i].h;
+        sb_printf(sb, "lat_%s_count %" PRIu64 "\n", lat[i].name, h->total);
+        sb_printf(sb, "lat_%s_mean_us %.1f\n", lat[i].name, h->total ? (double)h->sum / (double)h->total / 1e3 : 0.0);
+        sb_printf(sb, "lat_%s_p50_us %.1f\n", lat[i].name, (double)hist_percentile(h, 0.50) / 1e3);
+        sb_printf(sb, "lat_%s_p99_us %.1f\n", lat[i].name, (double)hist_percentile(h, 0.99) / 1e3);
+        sb_printf(sb, "lat_%s_p999_us %.1f\n", lat[i].name, (double)hist_percentile(h, 0.999) / 1e3);
+        sb_printf(sb, "lat_%s_max_us %.1f\n", lat[i].name, (double)h->max / 1e3);
+    }
+    sb_printf(sb, "warmup_bytes_done %" PRIu64 "\n", __atomic_load_n(&g_warm_done, __ATOMIC_RELAXED));
+    sb_printf(sb, "warmup_bytes_total %" PRIu64 "\n", __atomic_load_n(&g_warm_total, __ATOMIC_RELAXED));
+    if (g_opt.follow)
+    {
+        uint64_t applied = __atomic_load_n(&g_csv_committed, __ATOMIC_RELAXED);
+        uint64_t primary = STAT_LOAD(g_repl_primary_size);
+        uint64_t lag = primary > applied ? primary - applied : 0;
+        uint64_t since = STAT_LOAD(g_repl_caught_up_ns);
+        sb_printf(sb, "role replica\n");
+        sb_printf(sb, "repl_connected %" PRIu64 "\n", STAT_LOAD(g_repl_connected));
+        sb_printf(sb, "repl_applied_bytes %" PRIu64 "\n", applied);
+        sb_printf(sb, "repl_lag_bytes %" PRIu64 "\n", lag);
+        sb_printf(sb, "repl_lag_s %.3f\n", lag && since ? (double)(now_ns() - since) / 1e9 : 0.0);
+    }
+    else
     {
-        fields[count++] = tok;
-        tok = strtok(NULL, ",");
+        sb_printf(sb, "role primary\n");
+        sb_printf(sb, "repl_followers %" PRIu64 "\n", STAT_LOAD(g_repl_followers));
+        sb_printf(sb, "repl_bytes_sent %" PRIu64 "\n", STAT_LOAD(g_repl_bytes_sent));
     }
+    sb_printf(sb, "max_conns %d\n", g_opt.max_conns);
+    sb_printf(sb, "connections_rejected %" PRIu64 "\n", STAT_LOAD(g_conn_rejected));
+    sb_printf(sb, "idle_timeouts %" PRIu64 "\n", STAT_LOAD(g_idle_timeouts));
+    sb_printf(sb, "read_timeouts %" PRIu64 "\n", STAT_LOAD(g_read_timeouts));
+    sb_printf(sb, "send_timeouts %" PRIu64 "\n", STAT_LOAD(g_send_timeouts));
+    sb_printf(sb, "max_inflight %d\n", g_opt.max_inflight);
+    sb_printf(sb, "busy_rejected %" PRIu64 "\n", STAT_LOAD(g_busy_rejected));
+    uint64_t aq = STAT_LOAD(g_adm_queued);
+    sb_printf(sb, "admission_queued %" PRIu64 "\n", aq);
+    sb_printf(sb, "admission_wait_avg_us %.1f\n", aq ? (double)STAT_LOAD(g_adm_wait_ns) / (double)aq / 1e3 : 0.0);
+    sb_printf(sb, "unix_socket %s\n", g_opt.unix_path ? g_opt.unix_path : "off");
+    sb_printf(sb, "unix_accepted %" PRIu64 "\n", STAT_LOAD(g_unix_accepted));
+    sb_printf(sb, "shm_sessions %" PRIu64 "\n", STAT_LOAD(g_shm_sessions));
+    sb_printf(sb, "shm_requests %" PRIu64 "\n", STAT_LOAD(g_shm_requests));
+    sb_printf(sb, "io_backend %s\n", __atomic_load_n(&g_opt.io_uring, __ATOMIC_RELAXED) ? "uring" : "sync");
+    sb_printf(sb, "uring_sqes %" PRIu64 "\n", STAT_LOAD(g_uring_sqes));
+    sb_printf(sb, "uring_enters %" PRIu64 "\n", STAT_LOAD(g_uring_enters));
+    uint64_t bh = STAT_LOAD(g_blk_hits), bm = STAT_LOAD(g_blk_misses);
+    sb_printf(sb, "block_store %s\n", g_blk_fd >= 0 ? "on" : "off");
+    sb_printf(sb, "block_cache_hits %" PRIu64 "\n", bh);
+    sb_printf(sb, "block_cache_misses %" PRIu64 "\n", bm);
+    sb_printf(sb, "block_cache_hit_ratio %.4f\n", bh + bm ? (double)bh / (double)(bh + bm) : 0.0);
+    sb_printf(sb, "block_bytes_read %" PRIu64 "\n", STAT_LOAD(g_blk_bytes));
+    sb_printf(sb, "bucket_pairs_p50 %" PRIu64 "\n", hist_percentile(&a->bucket_len, 0.50));
+    sb_printf(sb, "bucket_pairs_p99 %" PRIu64 "\n", hist_percentile(&a->bucket_len, 0.99));
+    sb_printf(sb, "bucket_pairs_max %" PRIu64 "\n", a->bucket_len.max);
+    sb_printf(sb, "END\n");
+}
+
+// Mismas métricas en formato de exposición de texto de Prometheus (0.0.4)
+static void stats_render_prometheus(StrBuf *sb)
+{
+    StatsSnapshot s;
+    stats_snapshot(&s);
+    const ThreadStats *a = &s.agg;
 
-    // Asignar variables con seguridad
-    const char *id = (count > 0) ? fields[0] : "";
-    const char *titulo = (count > 4) ? fields[4] : "";
-    const char *autor = (count > 10) ? fields[10] : "";
-    const char *editorial = (count > 14) ? fields[14] : "";
-    const char *idioma = (count > 15) ? fields[15] : "";
-    const char *anio = (count > 12) ? fields[12] : "";
-    const char *rating = (count > 18) ? fields[18] : "";
-    const char *paginas = (count > 19) ? fields[19] : "";
-    const char *archivo = (count > 13) ? fields[13] : "";
-    const char *descripcion = (count > 17) ? fields[17] : "";
+    sb_printf(sb, "# TYPE idx_uptime_seconds gauge\nidx_uptime_seconds %.1f\n", s.uptime_s);
+    sb_printf(sb, "# TYPE idx_connections_active gauge\nidx_connections_active %" PRIu64 "\n", s.conn_active);
+    sb_printf(sb, "# TYPE idx_connections_total counter\nidx_connections_total %" PRIu64 "\n", s.conn_total);
+    sb_printf(sb, "# TYPE idx_accepted_total counter\n");
+    for (int i = 0; i < g_opt.acceptors; ++i)
+        sb_printf(sb, "idx_accepted_total{acceptor=\"%d\",cpu=\"%d\"} %" PRIu64 "\n", i, g_acceptor_stats[i].cpu,
+                  STAT_LOAD(g_acceptor_stats[i].accepted));
+    IndexView *v = view_acquire();
+    sb_printf(sb, "# TYPE idx_index_entries gauge\nidx_index_entries %" PRIu64 "\n",
+              __atomic_load_n(&v->hdr.total_entries, __ATOMIC_RELAXED));
+    sb_printf(sb, "# TYPE idx_dense_entries gauge\nidx_dense_entries %" PRIu64 "\n",
+              v->dense ? __atomic_load_n(&v->dense->count, __ATOMIC_RELAXED) : 0);
+    view_release();
+    sb_printf(sb, "# TYPE idx_dense_lookups_total counter\nidx_dense_lookups_total %" PRIu64 "\n", a->dense_hits);
+    sb_printf(sb, "# TYPE idx_commands_total counter\n");
+    sb_printf(sb, "idx_commands_total{cmd=\"get\"} %" PRIu64 "\n", a->cmd_get);
+    sb_printf(sb, "idx_commands_total{cmd=\"add\"} %" PRIu64 "\n", a->cmd_add);
+    sb_printf(sb, "# TYPE idx_get_miss_total counter\nidx_get_miss_total %" PRIu64 "\n", a->get_miss);
+    sb_printf(sb, "# TYPE idx_add_ok_total counter\nidx_add_ok_total %" PRIu64 "\n", a->add_ok);
+    sb_printf(sb, "# TYPE idx_update_ok_total counter\nidx_update_ok_total %" PRIu64 "\n", STAT_LOAD(g_update_ok));
+    sb_printf(sb, "# TYPE idx_del_ok_total counter\nidx_del_ok_total %" PRIu64 "\n", STAT_LOAD(g_del_ok));
+    sb_printf(sb, "# TYPE idx_vacuum_reclaimed_bytes gauge\nidx_vacuum_reclaimed_bytes %" PRIu64 "\n",
+              __atomic_load_n(&g_vacuum_reclaimed, __ATOMIC_RELAXED));
+    sb_printf(sb, "# TYPE idx_errors_total counter\nidx_errors_total %" PRIu64 "\n", a->cmd_errors);
+    sb_printf(sb, "# TYPE idx_read_bytes_total counter\n");
+    sb_printf(sb, "idx_read_bytes_total{file=\"idx\"} %" PRIu64 "\n", a->idx_bytes);
+    sb_printf(sb, "idx_read_bytes_total{file=\"csv\"} %" PRIu64 "\n", a->csv_bytes);
+    sb_printf(sb, "idx_read_bytes_total{file=\"blk\"} %" PRIu64 "\n", STAT_LOAD(g_blk_bytes));
 
-    // Reservamos espacio para el texto final
-    char *out = malloc(4096);
-    if (!out)
+    const struct
     {
-        free(temp);
-        return NULL;
+        const char *name;
+        const Histogram *h;
+    } lat[] = {{"get", &a->lat_get}, {"miss", &a->lat_miss}, {"add", &a->lat_add}};
+    const double qs[] = {0.5, 0.9, 0.99, 0.999};
+    sb_printf(sb, "# TYPE idx_request_latency_seconds summary\n");
+    for (size_t i = 0; i < sizeof(lat) / sizeof(lat[0]); ++i)
+    {
+        for (size_t k = 0; k < sizeof(qs) / sizeof(qs[0]); ++k)
+            sb_printf(sb, "idx_request_latency_seconds{cmd=\"%s\",quantile=\"%g\"} %.9f\n",
+                      lat[i].name, qs[k], (double)hist_percentile(lat[i].h, qs[k]) / 1e9);
+        sb_printf(sb, "idx_request_latency_seconds_sum{cmd=\"%s\"} %.9f\n", lat[i].name, (double)lat[i].h->sum / 1e9);
+        sb_printf(sb, "idx_request_latency_seconds_count{cmd=\"%s\"} %" PRIu64 "\n", lat[i].name, lat[i].h->total);
     }
-
-    snprintf(out, 4096,
-             "OK\n"
-             "ID: %s\n"
-             "Título: %s\n"
-             "Autor: %s\n"
-             "Editorial: %s\n"
-             "Idioma: %s\n"
-             "Año: %s\n"
-             "Rating: %s\n"
-             "Páginas: %s\n"
-             "Archivo origen: %s\n"
-             "Descripción: %s\n"
-             "----------------------------------------\n",
-             id, titulo, autor, editorial, idioma, anio,
-             rating, paginas, archivo, descripcion);
-
-    free(temp);
-    return out;
+    sb_printf(sb, "# TYPE idx_warmup_bytes gauge\n");
+    sb_printf(sb, "idx_warmup_bytes{state=\"done\"} %" PRIu64 "\n", __atomic_load_n(&g_warm_done, __ATOMIC_RELAXED));
+    sb_printf(sb, "idx_warmup_bytes{state=\"total\"} %" PRIu64 "\n", __atomic_load_n(&g_warm_total, __ATOMIC_RELAXED));
+    if (g_opt.follow)
+    {
+        uint64_t applied = __atomic_load_n(&g_csv_committed, __ATOMIC_RELAXED);
+        uint64_t primary = STAT_LOAD(g_repl_primary_size);
+        sb_printf(sb, "# TYPE idx_repl_lag_bytes gauge\n");
+        sb_printf(sb, "idx_repl_lag_bytes %" PRIu64 "\n", primary > applied ? primary - applied : 0);
+        sb_printf(sb, "# TYPE idx_repl_connected gauge\n");
+        sb_printf(sb, "idx_repl_connected %" PRIu64 "\n", STAT_LOAD(g_repl_connected));
+    }
+    else
+    {
+        sb_printf(sb, "# TYPE idx_repl_followers gauge\n");
+        sb_printf(sb, "idx_repl_followers %" PRIu64 "\n", STAT_LOAD(g_repl_followers));
+        sb_printf(sb, "# TYPE idx_repl_bytes_sent_total counter\n");
+        sb_printf(sb, "idx_repl_bytes_sent_total %" PRIu64 "\n", STAT_LOAD(g_repl_bytes_sent));
+    }
+    sb_printf(sb, "# TYPE idx_crc_buckets_verified_total counter\n");
+    sb_printf(sb, "idx_crc_buckets_verified_total %" PRIu64 "\n", STAT_LOAD(g_crc_verified));
+    sb_printf(sb, "# TYPE idx_crc_failures_total counter\n");
+    sb_printf(sb, "idx_crc_failures_total %" PRIu64 "\n", STAT_LOAD(g_crc_failures));
+    sb_printf(sb, "# TYPE idx_rejected_total counter\n");
+    sb_printf(sb, "idx_rejected_total{reason=\"max_conns\"} %" PRIu64 "\n", STAT_LOAD(g_conn_rejected));
+    sb_printf(sb, "idx_rejected_total{reason=\"busy\"} %" PRIu64 "\n", STAT_LOAD(g_busy_rejected));
+    sb_printf(sb, "# TYPE idx_unix_accepted_total counter\n");
+    sb_printf(sb, "idx_unix_accepted_total %" PRIu64 "\n", STAT_LOAD(g_unix_accepted));
+    sb_printf(sb, "# TYPE idx_shm_sessions_total counter\n");
+    sb_printf(sb, "idx_shm_sessions_total %" PRIu64 "\n", STAT_LOAD(g_shm_sessions));
+    sb_printf(sb, "# TYPE idx_shm_requests_total counter\n");
+    sb_printf(sb, "idx_shm_requests_total %" PRIu64 "\n", STAT_LOAD(g_shm_requests));
+    sb_printf(sb, "# TYPE idx_timeouts_total counter\n");
+    sb_printf(sb, "idx_timeouts_total{kind=\"idle\"} %" PRIu64 "\n", STAT_LOAD(g_idle_timeouts));
+    sb_printf(sb, "idx_timeouts_total{kind=\"read\"} %" PRIu64 "\n", STAT_LOAD(g_read_timeouts));
+    sb_printf(sb, "idx_timeouts_total{kind=\"send\"} %" PRIu64 "\n", STAT_LOAD(g_send_timeouts));
+    sb_printf(sb, "# TYPE idx_admission_wait_seconds_total counter\n");
+    sb_printf(sb, "idx_admission_wait_seconds_total %.6f\n", (double)STAT_LOAD(g_adm_wait_ns) / 1e9);
+    sb_printf(sb, "# TYPE idx_uring_sqes_total counter\n");
+    sb_printf(sb, "idx_uring_sqes_total %" PRIu64 "\n", STAT_LOAD(g_uring_sqes));
+    sb_printf(sb, "# TYPE idx_uring_enters_total counter\n");
+    sb_printf(sb, "idx_uring_enters_total %" PRIu64 "\n", STAT_LOAD(g_uring_enters));
+    sb_printf(sb, "# TYPE idx_block_cache_total counter\n");
+    sb_printf(sb, "idx_block_cache_total{result=\"hit\"} %" PRIu64 "\n", STAT_LOAD(g_blk_hits));
+    sb_printf(sb, "idx_block_cache_total{result=\"miss\"} %" PRIu64 "\n", STAT_LOAD(g_blk_misses));
+    sb_printf(sb, "# TYPE idx_bucket_pairs summary\n");
+    for (size_t k = 0; k < sizeof(qs) / sizeof(qs[0]); ++k)
+        sb_printf(sb, "idx_bucket_pairs{quantile=\"%g\"} %" PRIu64 "\n", qs[k], hist_percentile(&a->bucket_len, qs[k]));
+    sb_printf(sb, "idx_bucket_pairs_sum %" PRIu64 "\n", a->bucket_len.sum);
+    sb_printf(sb, "idx_bucket_pairs_count %" PRIu64 "\n", a->bucket_len.total);
 }
 
-// ====== Inserta un nuevo par (id, offset) directamente en el índice ======
-static int insert_into_index(uint64_t id, uint64_t offset)
+// Hilo del endpoint Prometheus: HTTP/1.0 mínimo en 127.0.0.1:<metrics_port>
+static void *metrics_thread(void *arg)
 {
-    unsigned b = hash_id(id);
-    DirEntry *d = &g_dir[b];
+    int s = (int)(intptr_t)arg;
+    while (!g_stop)
+    {
+        int cfd = accept(s, NULL, NULL);
+        if (cfd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("metrics accept");
+            break;
+        }
+        // Descarta la petición (cualquier ruta devuelve las métricas)
+        char req[1024];
+        (void)recv(cfd, req, sizeof(req), 0);
 
-    // Cargar el bucket actual
-    if (fseeko(g_idx, (off_t)d->bucket_offset, SEEK_SET) != 0)
-        return -1;
+        StrBuf body = {0};
+        stats_render_prometheus(&body);
+        char head[160];
+        int hn = snprintf(head, sizeof(head),
+                          "HTTP/1.0 200 OK\r\n"
+                          "Content-Type: text/plain; version=0.0.4\r\n"
+                          "Content-Length: %zu\r\n\r\n",
+                          body.len);
+        send(cfd, head, (size_t)hn, MSG_NOSIGNAL);
+        if (body.data)
+            send(cfd, body.data, body.len, MSG_NOSIGNAL);
+        free(body.data);
+        close(cfd);
+    }
+    close(s);
+    return NULL;
+}
 
-    Pair *pairs = malloc(sizeof(Pair) * (d->bucket_count + 1));
-    if (!pairs)
+// Abre el puerto local de métricas y lanza su hilo
+static int start_metrics_endpoint(int port)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0)
+    {
+        perror("metrics socket");
         return -1;
-
-    size_t rd = fread(pairs, sizeof(Pair), (size_t)d->bucket_count, g_idx);
-    if (rd != (size_t)d->bucket_count && ferror(g_idx))
+    }
+    int opt = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // sólo local
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(s, 16) < 0)
     {
-        free(pairs);
+        perror("metrics bind/listen");
+        close(s);
         return -1;
     }
+    pthread_t th;
+    if (pthread_create(&th, NULL, metrics_thread, (void *)(intptr_t)s) != 0)
+    {
+        close(s);
+        return -1;
+    }
+    pthread_detach(th);
+    return 0;
+}
 
-    // Insertar manteniendo orden por id
-    size_t i = 0;
-    while (i < d->bucket_count && pairs[i].id < id)
-        i++;
-    memmove(&pairs[i + 1], &pairs[i], (d->bucket_count - i) * sizeof(Pair));
-    pairs[i].id = id;
-    pairs[i].offset = offset;
-    d->bucket_count++;
-
-    // Escribir nuevo bloque al final del archivo
-    fseeko(g_idx, 0, SEEK_END);
-    d->bucket_offset = (uint64_t)ftello(g_idx);
-    fwrite(pairs, sizeof(Pair), d->bucket_count, g_idx);
-    fflush(g_idx);
-    free(pairs);
+// ====== Conjunto caliente: buckets y regiones del CSV más leídos ======
+// Los contadores viven en ThreadStats (sin escrituras compartidas en el camino del GET).
+// Un hilo los suma periódicamente, aplica decaimiento exponencial y guarda el ranking
+// en <books.idx>.hot; al arrancar, otro hilo lo relee y pide al kernel esas páginas
+// (posix_fadvise WILLNEED) a ritmo limitado mientras el servidor ya atiende.
+static unsigned g_region_shift = 20; // tamaño de región = 1 << shift bytes del CSV
+static char g_hot_path[4096];
 
-    // Actualizar el directorio
-    fseeko(g_idx, sizeof(Header) + (b * sizeof(DirEntry)), SEEK_SET);
-    fwrite(d, sizeof(DirEntry), 1, g_idx);
-    fflush(g_idx);
+static inline unsigned csv_region(uint64_t off)
+{
+    uint64_t r = off >> g_region_shift;
+    return r < HOT_REGIONS ? (unsigned)r : HOT_REGIONS - 1;
+}
 
-    // Actualizar el header (total_entries)
-    g_hdr.total_entries++;
-    fseeko(g_idx, 0, SEEK_SET);
-    fwrite(&g_hdr, sizeof(Header), 1, g_idx);
-    fflush(g_idx);
+// Elige el tamaño de región para que el CSV (con margen x2 para crecer) quepa en HOT_REGIONS
+static void hot_init_regions(uint64_t csv_size)
+{
+    g_region_shift = 16;
+    while (g_region_shift < 40 && ((csv_size * 2) >> g_region_shift) >= HOT_REGIONS)
+        g_region_shift++;
+}
 
-    return 0;
+// Suma de accesos de todos los hilos (vivos y terminados)
+static void hot_collect(uint64_t *buckets, uint64_t *regions)
+{
+    pthread_mutex_lock(&g_stats_mu);
+    memcpy(buckets, g_stats_retired.bucket_hits, sizeof(g_stats_retired.bucket_hits));
+    memcpy(regions, g_stats_retired.region_hits, sizeof(g_stats_retired.region_hits));
+    for (ThreadStats *st = g_stats_list; st; st = st->next)
+    {
+        for (unsigned i = 0; i < TABLE_SIZE; ++i)
+            buckets[i] += STAT_LOAD(st->bucket_hits[i]);
+        for (unsigned i = 0; i < HOT_REGIONS; ++i)
+            regions[i] += STAT_LOAD(st->region_hits[i]);
+    }
+    pthread_mutex_unlock(&g_stats_mu);
 }
 
-// ====== Hilo por conexión ======
 typedef struct
 {
-    int fd;
-} ClientCtx;
+    char kind; // 'B' bucket, 'R' región del CSV
+    unsigned index;
+    double score;
+} HotEntry;
 
-static void *client_thread(void *arg)
+static int cmp_hot_desc(const void *a, const void *b)
 {
-    // Extrae el contexto del cliente pasado como argumento por el hilo
-    ClientCtx *ctx = (ClientCtx *)arg;
-    // Guarda el descriptor del socket del cliente para lectura/escritura
-    int fd = ctx->fd;
-    // Libera la estructura temporal del cliente (ya no se necesita)
-    free(ctx);
+    const HotEntry *x = (const HotEntry *)a, *y = (const HotEntry *)b;
+    return (x->score < y->score) - (x->score > y->score);
+}
 
-    // Bucle principal: procesa comandos del cliente mientras la conexión esté abierta
-    char line[256];
-    // Lee líneas hasta que el cliente cierre o envíe QUIT
+// Escribe el ranking actual (archivo temporal + rename: nunca queda a medias)
+static int hot_save(const double *bscore, const double *rscore)
+{
+    HotEntry *e = (HotEntry *)malloc(sizeof(HotEntry) * (TABLE_SIZE + HOT_REGIONS));
+    if (!e)
+        return -1;
+    size_t n = 0;
+    for (unsigned i = 0; i < TABLE_SIZE; ++i)
+        if (bscore[i] >= 0.5)
+            e[n++] = (HotEntry){'B', i, bscore[i]};
+    for (unsigned i = 0; i < HOT_REGIONS; ++i)
+        if (rscore[i] >= 0.5)
+            e[n++] = (HotEntry){'R', i, rscore[i]};
+    qsort(e, n, sizeof(HotEntry), cmp_hot_desc);
+
+    char tmp[4200];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", g_hot_path);
+    FILE *f = fopen(tmp, "w");
+    if (!f)
+    {
+        free(e);
+        return -1;
+    }
+    fprintf(f, "# idx_server hot set v1\nregion_shift %u\n", g_region_shift);
+    for (size_t i = 0; i < n; ++i)
+        fprintf(f, "%c %u %.1f\n", e[i].kind, e[i].index, e[i].score);
+    free(e);
+    if (fclose(f) != 0 || rename(tmp, g_hot_path) != 0)
+    {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Hilo que guarda el conjunto caliente cada hot_interval segundos
+static void *hot_saver_thread(void *arg)
+{
+    (void)arg;
+    uint64_t *b = (uint64_t *)calloc(TABLE_SIZE, sizeof(uint64_t));
+    uint64_t *r = (uint64_t *)calloc(HOT_REGIONS, sizeof(uint64_t));
+    uint64_t *bprev = (uint64_t *)calloc(TABLE_SIZE, sizeof(uint64_t));
+    uint64_t *rprev = (uint64_t *)calloc(HOT_REGIONS, sizeof(uint64_t));
+    double *bscore = (double *)calloc(TABLE_SIZE, sizeof(double));
+    double *rscore = (double *)calloc(HOT_REGIONS, sizeof(double));
+    if (!b || !r || !bprev || !rprev || !bscore || !rscore)
+        goto out;
+
+    while (!g_stop)
+    {
+        for (int t = 0; t < g_opt.hot_interval && !g_stop; ++t)
+            sleep(1);
+        hot_collect(b, r);
+        // Decaimiento: la mitad del puntaje anterior + accesos del último intervalo
+        uint64_t delta = 0;
+        for (unsigned i = 0; i < TABLE_SIZE; ++i)
+        {
+            bscore[i] = bscore[i] * 0.5 + (double)(b[i] - bprev[i]);
+            delta += b[i] - bprev[i];
+        }
+        for (unsigned i = 0; i < HOT_REGIONS; ++i)
+            rscore[i] = rscore[i] * 0.5 + (double)(r[i] - rprev[i]);
+        memcpy(bprev, b, sizeof(uint64_t) * TABLE_SIZE);
+        memcpy(rprev, r, sizeof(uint64_t) * HOT_REGIONS);
+        // Sin tráfico nuevo no se pisa el archivo (conserva lo aprendido antes de reiniciar)
+        if (delta == 0)
+            continue;
+        if (hot_save(bscore, rscore) != 0)
+            perror("hot set save");
+    }
+out:
+    free(b);
+    free(r);
+    free(bprev);
+    free(rprev);
+    free(bscore);
+    free(rscore);
+    return NULL;
+}
+
+// Pide al kernel un rango de un archivo sin bloquear, respetando warm_rate_mb
+// (fd < 0: el rango ya se pidió, sólo se contabiliza y se respeta el ritmo)
+static void warm_range(int fd, uint64_t off, uint64_t len, uint64_t t0)
+{
+    const uint64_t CHUNK = 1u << 20;
+    while (len > 0 && !g_stop)
+    {
+        uint64_t n = len < CHUNK ? len : CHUNK;
+        if (fd >= 0)
+            posix_fadvise(fd, (off_t)off, (off_t)n, POSIX_FADV_WILLNEED);
+        off += n;
+        len -= n;
+        uint64_t done = __atomic_add_fetch(&g_warm_done, n, __ATOMIC_RELAXED);
+        // Limita el ritmo: espera si vamos por delante de warm_rate_mb
+        double ahead = (double)done / (g_opt.warm_rate_mb * 1e6) - (double)(now_ns() - t0) / 1e9;
+        if (ahead > 0.0)
+        {
+            struct timespec ts = {(time_t)ahead, (long)((ahead - (double)(time_t)ahead) * 1e9)};
+            nanosleep(&ts, NULL);
+        }
+    }
+}
+
+// Hilo de precalentamiento: lee el conjunto caliente guardado y lo prefetch-ea
+static void *warmup_thread(void *arg)
+{
+    (void)arg;
+    FILE *f = fopen(g_hot_path, "r");
+    if (!f)
+        return NULL;
+    unsigned shift = g_region_shift;
+    size_t cap = TABLE_SIZE + HOT_REGIONS, n = 0;
+    HotEntry *e = (HotEntry *)malloc(sizeof(HotEntry) * cap);
+    char line[128];
+    while (e && n < cap && fgets(line, sizeof(line), f))
+    {
+        HotEntry h;
+        if (sscanf(line, "region_shift %u", &shift) == 1)
+            continue;
+        if (sscanf(line, "%c %u %lf", &h.kind, &h.index, &h.score) != 3)
+            continue;
+        if ((h.kind == 'B' && h.index < TABLE_SIZE) || h.kind == 'R')
+            e[n++] = h;
+    }
+    fclose(f);
+    if (!e || n == 0)
+    {
+        free(e);
+        return NULL;
+    }
+
+    int csv_fd = fileno(g_csv);
+    uint64_t total = 0;
+    IndexView *v = view_acquire();
+    for (size_t i = 0; i < n; ++i)
+        total += e[i].kind == 'B' ? dir_read(v, e[i].index, NULL, NULL).bucket_count * sizeof(Pair) : (1ull << shift);
+    view_release();
+    __atomic_store_n(&g_warm_total, total, __ATOMIC_RELAXED);
+    fprintf(stderr, "warm-up: %zu entradas, %.1f MB a %.0f MB/s\n", n, (double)total / 1e6, g_opt.warm_rate_mb);
+
+    uint64_t t0 = now_ns();
+    int last_pct = 0;
+    for (size_t i = 0; i < n && !g_stop; ++i)
+    {
+        if (e[i].kind == 'B')
+        {
+            // La vista se toma por bucket: un REBUILD no espera a la pausa del limitador
+            v = view_acquire();
+            DirEntry d = dir_read(v, e[i].index, NULL, NULL);
+            posix_fadvise(fileno(v->idx), (off_t)d.bucket_offset, (off_t)(d.bucket_count * sizeof(Pair)),
+                          POSIX_FADV_WILLNEED);
+            view_release();
+            warm_range(-1, 0, d.bucket_count * sizeof(Pair), t0);
+        }
+        else
+            warm_range(csv_fd, (uint64_t)e[i].index << shift, 1ull << shift, t0);
+        int pct = total ? (int)(100 * __atomic_load_n(&g_warm_done, __ATOMIC_RELAXED) / total) : 100;
+        if (pct / 10 > last_pct / 10)
+        {
+            fprintf(stderr, "warm-up: %d%%\n", pct);
+            last_pct = pct;
+        }
+    }
+    fprintf(stderr, "warm-up: terminado en %.1f s\n", (double)(now_ns() - t0) / 1e9);
+    free(e);
+    hp_slot_release();
+    return NULL;
+}
+
+// Arranca el precalentamiento (si hay conjunto guardado) y el guardado periódico
+static void hot_start(const char *idx_path, uint64_t csv_size)
+{
+    if (g_opt.hot_file)
+        snprintf(g_hot_path, sizeof(g_hot_path), "%s", g_opt.hot_file);
+    else
+        snprintf(g_hot_path, sizeof(g_hot_path), "%s.hot", idx_path);
+    hot_init_regions(csv_size);
+
+    pthread_t th;
+    if (pthread_create(&th, NULL, warmup_thread, NULL) == 0)
+        pthread_detach(th);
+    if (g_opt.hot_interval > 0 && pthread_create(&th, NULL, hot_saver_thread, NULL) == 0)
+        pthread_detach(th);
+}
+
+// ====== Lectura robusta de línea del socket (con buffer por conexión) ======
+// Una fila CSV completa debe caber en un ADD (mismo tope que LINE_BUF en build_index)
+#define CMD_LINE_MAX 131072
+
+typedef struct
+{
+    int fd;
+    size_t start; // primer byte sin consumir en buf
+    size_t end;   // fin de los datos recibidos
+    int idle_ms;  // espera máxima por el primer byte de una línea (0 = sin tope)
+    int read_ms;  // tope para completar una línea desde su primer byte (0 = sin tope)
+    char buf[16384];
+} LineReader;
+
+// Devuelve la longitud de la línea (incluye '\n'), 0 si el peer cerró, -1 en error,
+// -2 si la línea excedía cap (se descarta entera hasta el '\n'), -3 si venció idle_ms
+// sin empezar una línea y -4 si venció read_ms con una línea a medias.
+// read_ms cuenta para la línea entera, no para cada espera: goteando un byte de vez en
+// cuando no se retiene el hilo más allá del tope.
+static ssize_t read_line(LineReader *lr, char *out, size_t cap)
+{
+    size_t n = 0;
+    bool overflow = false;
+    uint64_t deadline = 0; // now_ns() en que vence la línea empezada (0 = aún no empezó)
+    for (;;)
+    {
+        // Consume lo que ya está en el buffer hasta encontrar '\n'
+        while (lr->start < lr->end)
+        {
+            char c = lr->buf[lr->start++];
+            if (n + 1 < cap)
+                out[n++] = c;
+            else
+                overflow = true;
+            if (c == '\n')
+            {
+                out[n] = '\0';
+                return overflow ? -2 : (ssize_t)n;
+            }
+        }
+        // Buffer agotado: espera datos como mucho el tope que toque (sin línea / lo que le
+        // queda a la línea a medias)
+        int wait_ms = lr->idle_ms;
+        if ((n > 0 || overflow) && lr->read_ms > 0)
+        {
+            uint64_t now = now_ns();
+            if (deadline == 0)
+                deadline = now + (uint64_t)lr->read_ms * 1000000ull;
+            if (now >= deadline)
+                return -4;
+            wait_ms = (int)((deadline - now + 999999) / 1000000);
+        }
+        else if (n > 0 || overflow)
+            wait_ms = 0;
+        if (wait_ms > 0)
+        {
+            struct pollfd pfd = {lr->fd, POLLIN, 0};
+            int pr = poll(&pfd, 1, wait_ms);
+            if (pr < 0 && errno == EINTR)
+                continue;
+            if (pr == 0)
+                return (n > 0 || overflow) ? -4 : -3;
+        }
+        // Una sola llamada a recv trae varios comandos encadenados
+        ssize_t r = recv(lr->fd, lr->buf, sizeof(lr->buf), 0);
+        if (r == 0)
+            return 0; // peer closed
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        lr->start = 0;
+        lr->end = (size_t)r;
+    }
+}
+
+// ====== Lectura posicional completa (reintenta lecturas parciales) ======
+static int pread_full(int fd, void *dst, size_t len, uint64_t off)
+{
+    char *p = (char *)dst;
+    while (len > 0)
+    {
+        ssize_t r = pread(fd, p, len, (off_t)off);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        p += r;
+        off += (uint64_t)r;
+        len -= (size_t)r;
+    }
+    return 0;
+}
+
+// ====== Arena por hilo: memoria del camino de una petición sin malloc/free ======
+// Cada hilo reparte un trozo fijo avanzando un puntero; lo que no cabe (un bucket enorme,
+// una fila de 100 KB) va a bloques aparte encadenados. Todo se suelta de una vez con
+// arena_reset tras cada respuesta, o hasta una marca con arena_rewind si una función sólo
+// necesita memoria temporal (así también sirve en hilos que no atienden clientes).
+#define ARENA_CHUNK (256u * 1024u)
+
+typedef union ArenaBig
+{
+    union ArenaBig *next;
+    max_align_t align; // los datos empiezan justo detrás, alineados
+} ArenaBig;
+
+typedef struct
+{
+    char *base;
+    size_t used;
+    ArenaBig *big; // bloques grandes, el más nuevo primero
+} Arena;
+
+typedef struct
+{
+    size_t used;
+    ArenaBig *big;
+} ArenaMark;
+
+static __thread Arena t_arena;
+
+static void *arena_alloc(size_t n)
+{
+    Arena *a = &t_arena;
+    n = (n + 15) & ~(size_t)15;
+    if (!a->base && !(a->base = (char *)malloc(ARENA_CHUNK)))
+        return NULL;
+    if (n <= ARENA_CHUNK - a->used)
+    {
+        void *p = a->base + a->used;
+        a->used += n;
+        return p;
+    }
+    ArenaBig *b = (ArenaBig *)malloc(sizeof(ArenaBig) + n);
+    if (!b)
+        return NULL;
+    b->next = a->big;
+    a->big = b;
+    return b + 1;
+}
+
+static ArenaMark arena_mark(void)
+{
+    return (ArenaMark){t_arena.used, t_arena.big};
+}
+
+// Libera todo lo reservado después de la marca
+static void arena_rewind(ArenaMark m)
+{
+    while (t_arena.big != m.big)
+    {
+        ArenaBig *b = t_arena.big;
+        t_arena.big = b->next;
+        free(b);
+    }
+    t_arena.used = m.used;
+}
+
+static void arena_reset(void)
+{
+    arena_rewind((ArenaMark){0, NULL});
+}
+
+// El kernel aún puede escribir en memoria de la arena (ver UR_LOST): se deja sin liberar,
+// con lo ya repartido válido, y el hilo sigue con una arena nueva
+static void arena_abandon(void)
+{
+    memset(&t_arena, 0, sizeof(t_arena));
+}
+
+// Al terminar el hilo
+static void arena_destroy(void)
+{
+    arena_reset();
+    free(t_arena.base);
+    t_arena.base = NULL;
+}
+
+// ====== Busca id en su bucket (carga bucket a RAM, <= unos cientos de KB) ======
+// El llamador mantiene anunciada la vista v (archivo + directorio) mientras se lee el bucket
+// y, si va a leer la fila, también mientras la lee: el offset se refiere a v->csv_fd.
+// Un id borrado (IDX_DEAD) se responde como inexistente.
+static int find_in_view(IndexView *v, uint64_t id, uint64_t *out_off)
+{
+    unsigned b = hash_id(id);
+    // Id dentro de la tabla densa: la respuesta es su ranura, sin leer ningún bucket
+    int dr = dense_find(v, id, out_off);
+    if (dr >= 0)
+        return dr;
+    for (;;)
+    {
+        uint32_t crc = 0;
+        unsigned seq = 0;
+        DirEntry d = dir_read(v, b, &crc, &seq);
+        uint64_t count = d.bucket_count;
+        if (count == 0)
+            return 0;
+
+        size_t bytes = (size_t)count * sizeof(Pair);
+        // Seguridad de memoria: limita a 8MB por lectura de bucket (muy por debajo del límite pedido)
+        // El bucket es temporal: se devuelve a la arena al salir
+        ArenaMark mark = arena_mark();
+        Pair *buf = bytes > (8u << 20) ? NULL : (Pair *)arena_alloc(bytes);
+        if (!buf)
+            return -1;
+
+        // pread no comparte posición de archivo: varios hilos pueden leer a la vez
+        int rd = pread_full(fileno(v->idx), buf, bytes, d.bucket_offset);
+        // Un UPDATE/DEL cambió un offset del bucket mientras se leía: otra vuelta
+        if (rd == 0 && !dir_stable(v, b, seq))
+        {
+            arena_rewind(mark);
+            continue;
+        }
+        if (rd == 0)
+            rd = bucket_verify(v, b, crc, buf, bytes);
+        if (rd != 0)
+        {
+            arena_rewind(mark);
+            return -1;
+        }
+        if (t_stats)
+        {
+            STAT_ADD(t_stats->idx_bytes, bytes);
+            STAT_ADD(t_stats->bucket_hits[b], 1);
+            hist_record(&t_stats->bucket_len, count);
+        }
+
+        // Binary search por id
+        int lo = 0, hi = (int)count - 1;
+        while (lo <= hi)
+        {
+            int mid = lo + ((hi - lo) >> 1);
+            if (buf[mid].id == id)
+            {
+                uint64_t off = buf[mid].offset;
+                arena_rewind(mark);
+                if (off & IDX_DEAD)
+                    return 0;
+                *out_off = off;
+                return 1;
+            }
+            else if (buf[mid].id < id)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid - 1;
+            }
+        }
+        arena_rewind(mark);
+        return 0; // no encontrado
+    }
+}
+
+static int find_offset(uint64_t id, uint64_t *out_off)
+{
+    IndexView *v = view_acquire();
+    int r = find_in_view(v, id, out_off);
+    view_release();
+    return r;
+}
+
+// ====== Almacén de filas por bloques comprimidos (--blocks, generado por pack_store) ======
+// Un Pair.offset con BLK_FLAG apunta a (bloque, slot). El bloque se lee y descomprime una
+// vez y queda en una caché LRU repartida en BLK_SHARDS trozos con su propio mutex; la fila
+// se copia fuera del bloque bajo el mutex, así ninguna entrada se libera mientras se usa.
+#define BLK_SHARDS 16
+#define BLK_HASH 1024 // cadenas de hash por trozo
+
+typedef struct BlkCacheEntry
+{
+    uint64_t block;
+    uint8_t *raw; // bloque descomprimido (nrows | inicios | filas)
+    uint32_t raw_len;
+    struct BlkCacheEntry *hnext;            // cadena de hash
+    struct BlkCacheEntry *lru_prev, *lru_next; // más reciente al frente
+} BlkCacheEntry;
+
+typedef struct
+{
+    pthread_mutex_t mu;
+    BlkCacheEntry *hash[BLK_HASH];
+    BlkCacheEntry *lru_head, *lru_tail;
+    size_t bytes;
+} BlkCacheShard;
+
+static BlkHeader g_blk_hdr;
+static uint8_t *g_blk_dict = NULL;
+static BlkDirEntry *g_blk_dir = NULL;
+static size_t g_blk_shard_cap = 0; // bytes por trozo de caché
+static BlkCacheShard g_blk_cache[BLK_SHARDS];
+
+// Abre books.blk y carga cabecera, diccionario y directorio de bloques en RAM
+static int blk_open(const char *path)
+{
+    g_blk_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (g_blk_fd < 0)
+        return -1;
+    if (pread_full(g_blk_fd, &g_blk_hdr, sizeof(g_blk_hdr), 0) != 0 || memcmp(g_blk_hdr.magic, BLK_MAGIC, 8) != 0 ||
+        g_blk_hdr.dict_len > BLK_MAX_DICT || g_blk_hdr.block_count > (1ull << (62 - BLK_SLOT_BITS)))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    g_blk_dict = (uint8_t *)malloc(g_blk_hdr.dict_len + 1);
+    g_blk_dir = (BlkDirEntry *)malloc(g_blk_hdr.block_count * sizeof(BlkDirEntry) + 1);
+    if (!g_blk_dict || !g_blk_dir ||
+        pread_full(g_blk_fd, g_blk_dict, g_blk_hdr.dict_len, g_blk_hdr.dict_offset) != 0 ||
+        pread_full(g_blk_fd, g_blk_dir, g_blk_hdr.block_count * sizeof(BlkDirEntry), g_blk_hdr.dir_offset) != 0)
+        return -1;
+    g_blk_shard_cap = (size_t)g_opt.block_cache_mb * 1024 * 1024 / BLK_SHARDS;
+    for (unsigned i = 0; i < BLK_SHARDS; ++i)
+        pthread_mutex_init(&g_blk_cache[i].mu, NULL);
+    return 0;
+}
+
+// Lee y descomprime el bloque b (sin caché); el resultado se libera con free
+static uint8_t *blk_load(uint64_t b, uint32_t *raw_len)
+{
+    if (g_blk_fd < 0 || b >= g_blk_hdr.block_count)
+        return NULL;
+    const BlkDirEntry *d = &g_blk_dir[b];
+    if (d->raw_len > BLK_MAX_RAW || d->raw_len < 4 + 4ull * d->nrows)
+        return NULL;
+    size_t dn = g_blk_hdr.dict_len;
+    uint8_t *comp = (uint8_t *)malloc(d->comp_len);
+    uint8_t *out = (uint8_t *)malloc(dn + d->raw_len);
+    if (!comp || !out || pread_full(g_blk_fd, comp, d->comp_len, d->offset) != 0)
+        goto fail;
+    STAT_ADD(g_blk_bytes, d->comp_len);
+    if (d->flags & BLK_STORED_RAW)
+    {
+        if (d->comp_len != d->raw_len)
+            goto fail;
+        memcpy(out, comp, d->raw_len);
+    }
+    else
+    {
+        // El diccionario va delante: las coincidencias pueden apuntar a él
+        memcpy(out, g_blk_dict, dn);
+        if (lz_decompress(comp, d->comp_len, out, dn, d->raw_len) != 0)
+            goto fail;
+        memmove(out, out + dn, d->raw_len);
+    }
+    free(comp);
+    *raw_len = d->raw_len;
+    return out;
+
+fail:
+    free(comp);
+    free(out);
+    return NULL;
+}
+
+// Copia la fila slot del bloque descomprimido raw en *out (en la arena, terminada en '\0')
+static int blk_copy_row(const uint8_t *raw, uint32_t raw_len, unsigned slot, char **out, size_t *out_len)
+{
+    uint32_t nrows;
+    memcpy(&nrows, raw, 4);
+    if (slot >= nrows || 4 + 4ull * nrows > raw_len)
+        return -1;
+    size_t head = 4 + 4 * (size_t)nrows, start, end;
+    uint32_t v;
+    memcpy(&v, raw + 4 + 4 * (size_t)slot, 4);
+    start = head + v;
+    if (slot + 1 < nrows)
+    {
+        memcpy(&v, raw + 4 + 4 * ((size_t)slot + 1), 4);
+        end = head + v;
+    }
+    else
+        end = raw_len;
+    if (start >= end || end > raw_len)
+        return -1;
+    char *row = (char *)arena_alloc(end - start + 1);
+    if (!row)
+        return -1;
+    memcpy(row, raw + start, end - start);
+    row[end - start] = '\0';
+    *out = row;
+    *out_len = end - start;
+    return 0;
+}
+
+static void blk_lru_unlink(BlkCacheShard *sh, BlkCacheEntry *e)
+{
+    if (e->lru_prev)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        sh->lru_head = e->lru_next;
+    if (e->lru_next)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        sh->lru_tail = e->lru_prev;
+}
+
+static void blk_lru_push_front(BlkCacheShard *sh, BlkCacheEntry *e)
+{
+    e->lru_prev = NULL;
+    e->lru_next = sh->lru_head;
+    if (sh->lru_head)
+        sh->lru_head->lru_prev = e;
+    sh->lru_head = e;
+    if (!sh->lru_tail)
+        sh->lru_tail = e;
+}
+
+// Fila de un offset empaquetado: busca el bloque en la caché y, si falta, lo descomprime
+static int blk_read_row(uint64_t off, char **out, size_t *out_len)
+{
+    uint64_t b = blk_block_of(off);
+    unsigned slot = blk_slot_of(off);
+    BlkCacheShard *sh = &g_blk_cache[b % BLK_SHARDS];
+    unsigned h = (unsigned)((b / BLK_SHARDS) % BLK_HASH);
+    int rc;
+
+    pthread_mutex_lock(&sh->mu);
+    for (BlkCacheEntry *e = sh->hash[h]; e; e = e->hnext)
+        if (e->block == b)
+        {
+            blk_lru_unlink(sh, e);
+            blk_lru_push_front(sh, e);
+            rc = blk_copy_row(e->raw, e->raw_len, slot, out, out_len);
+            pthread_mutex_unlock(&sh->mu);
+            STAT_ADD(g_blk_hits, 1);
+            return rc;
+        }
+    pthread_mutex_unlock(&sh->mu);
+
+    // Fallo: lectura y descompresión fuera del mutex
+    STAT_ADD(g_blk_misses, 1);
+    uint32_t raw_len = 0;
+    uint8_t *raw = blk_load(b, &raw_len);
+    if (!raw)
+        return -1;
+    rc = blk_copy_row(raw, raw_len, slot, out, out_len);
+    BlkCacheEntry *ne = g_blk_shard_cap >= raw_len ? (BlkCacheEntry *)malloc(sizeof(BlkCacheEntry)) : NULL;
+    if (!ne)
+    {
+        free(raw);
+        return rc;
+    }
+    ne->block = b;
+    ne->raw = raw;
+    ne->raw_len = raw_len;
+
+    pthread_mutex_lock(&sh->mu);
+    for (BlkCacheEntry *e = sh->hash[h]; e; e = e->hnext)
+        if (e->block == b)
+        {
+            // Otro hilo lo insertó mientras tanto: se queda el suyo
+            pthread_mutex_unlock(&sh->mu);
+            free(raw);
+            free(ne);
+            return rc;
+        }
+    ne->hnext = sh->hash[h];
+    sh->hash[h] = ne;
+    blk_lru_push_front(sh, ne);
+    sh->bytes += raw_len;
+    // Expulsa los menos usados hasta volver al tope del trozo
+    while (sh->bytes > g_blk_shard_cap && sh->lru_tail != ne)
+    {
+        BlkCacheEntry *old = sh->lru_tail;
+        blk_lru_unlink(sh, old);
+        BlkCacheEntry **pp = &sh->hash[(old->block / BLK_SHARDS) % BLK_HASH];
+        while (*pp != old)
+            pp = &(*pp)->hnext;
+        *pp = old->hnext;
+        sh->bytes -= old->raw_len;
+        free(old->raw);
+        free(old);
+    }
+    pthread_mutex_unlock(&sh->mu);
+    return rc;
+}
+
+// ====== Lee la línea completa del CSV (fd, el de la vista que dio el offset) en offset ======
+static int read_csv_line_at(int fd, uint64_t off, char **out, size_t *out_len)
+{
+    // Filas empaquetadas por pack_store: viven en books.blk, no en el CSV
+    if (off & BLK_FLAG)
+        return blk_read_row(off, out, out_len);
+
+    // Lee por bloques con pread hasta encontrar '\n'; el buffer sale de la arena del hilo
+    // (si la fila no cabe se pide uno del doble y se copia: el viejo vuelve con el reset)
+    size_t cap = 4096;
+    size_t len = 0;
+    char *buf = (char *)arena_alloc(cap);
+    if (!buf)
+        return -1;
+
+    for (;;)
+    {
+        if (len + 1 >= cap)
+        {
+            char *tmp = (char *)arena_alloc(cap * 2);
+            if (!tmp)
+                return -1;
+            memcpy(tmp, buf, len);
+            cap *= 2;
+            buf = tmp;
+        }
+        ssize_t r = pread(fd, buf + len, cap - 1 - len, (off_t)(off + len));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+            return -1;
+        if (r == 0)
+            break; // EOF sin '\n' final
+        char *nl = (char *)memchr(buf + len, '\n', (size_t)r);
+        if (nl)
+        {
+            len = (size_t)(nl - buf) + 1;
+            break;
+        }
+        len += (size_t)r;
+    }
+    buf[len] = '\0';
+    *out = buf;
+    *out_len = len;
+    if (t_stats)
+    {
+        STAT_ADD(t_stats->csv_bytes, len);
+        STAT_ADD(t_stats->region_hits[csv_region(off)], 1);
+    }
+    return (len > 0) ? 0 : -1;
+}
+
+// ====== Backend io_uring: un hilo de anillo atiende las lecturas de todos los GET ======
+// Los hilos de conexión encolan su petición y esperan en un semáforo; el hilo del anillo
+// junta todo lo pendiente en un solo io_uring_enter (más profundidad de cola en NVMe) y,
+// al completar la lectura del bucket, busca el id y encadena la lectura del registro sin
+// volver al hilo de conexión. Se usa la interfaz del kernel directamente (sin liburing).
+#define URING_REC_CHUNK 8192 // primera lectura del registro (cubre casi todas las filas)
+
+enum
+{
+    UR_BUCKET, // leyendo el bucket
+    UR_RECORD  // leyendo la fila del CSV
+};
+
+typedef struct UringReq
+{
+    uint64_t id;
+    unsigned bucket;
+    int idx_fd;       // archivo de la vista que el hilo de conexión mantiene anunciada
+    int csv_fd;       // CSV de esa misma vista
+    DirEntry dir;     // entrada de directorio leída al encolar
+    int stage;
+    Pair *pairs;      // bucket completo
+    size_t bytes;     // tamaño del bucket en bytes
+    size_t done;      // bytes ya leídos de la etapa actual
+    uint64_t rec_off; // offset de la fila (si se encontró)
+    char *rec;        // primer bloque de la fila
+    size_t rec_len;
+    int status; // 1 encontrado, 0 no existe, -1 error de índice, -2 error de CSV, UR_RETRY o UR_LOST
+    sem_t sem;
+    struct UringReq *next;
+    struct UringReq *ring_prev, *ring_next; // lista de lecturas en el kernel (sólo el hilo del anillo)
+} UringReq;
+
+#define UR_RETRY (-3) // el anillo dejó de funcionar: el hilo de conexión repite la lectura por pread
+#define UR_LOST (-4)  // igual, pero la lectura sigue en el kernel: sus buffers no se pueden reutilizar
+
+typedef struct
+{
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit; // SQEs preparados desde el último enter
+    unsigned inflight;  // operaciones sin CQE (nunca supera entries: el CQ no desborda)
+} Uring;
+
+static Uring g_ring;
+static int g_ring_efd = -1; // eventfd para despertar al hilo del anillo
+static pthread_mutex_t g_ring_mu = PTHREAD_MUTEX_INITIALIZER;
+static UringReq *g_ring_queue = NULL; // peticiones nuevas (LIFO, el orden da igual)
+static bool g_ring_dead = false;      // bajo g_ring_mu: el hilo del anillo terminó y no acepta más
+static UringReq *g_ring_inflight = NULL;
+
+static int uring_setup(Uring *r, unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0)
+        return -1;
+
+    size_t sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && cq_sz > sq_sz)
+        sq_sz = cq_sz;
+
+    char *sq = (char *)mmap(NULL, sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+    char *cq = sq;
+    if (!single)
+    {
+        cq = (char *)mmap(NULL, cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED)
+        {
+            munmap(sq, sq_sz);
+            close(fd);
+            return -1;
+        }
+    }
+    void *sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        if (!single)
+            munmap(cq, cq_sz);
+        munmap(sq, sq_sz);
+        close(fd);
+        return -1;
+    }
+
+    r->fd = fd;
+    r->entries = p.sq_entries;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->sqes = (struct io_uring_sqe *)sqes;
+    r->to_submit = 0;
+    r->inflight = 0;
+    return 0;
+}
+
+// Prepara un SQE (sólo el hilo del anillo escribe en el SQ); -1 si no hay hueco
+static int uring_prep(Uring *r, uint8_t op, int fd, void *buf, unsigned len, uint64_t off, uint64_t user)
+{
+    if (r->inflight >= r->entries)
+        return -1;
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = user;
+    if (op == IORING_OP_POLL_ADD)
+        sqe->poll_events = POLLIN;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->to_submit++;
+    r->inflight++;
+    return 0;
+}
+
+static void uring_complete(UringReq *q, int status)
+{
+    q->status = status;
+    sem_post(&q->sem);
+}
+
+// Lanza (o continúa tras lectura parcial) la etapa actual de una petición
+static int uring_issue(UringReq *q)
+{
+    int r;
+    if (q->stage == UR_BUCKET)
+        r = uring_prep(&g_ring, IORING_OP_READ, q->idx_fd, (char *)q->pairs + q->done,
+                       (unsigned)(q->bytes - q->done), q->dir.bucket_offset + q->done, (uint64_t)(uintptr_t)q);
+    else
+        r = uring_prep(&g_ring, IORING_OP_READ, q->csv_fd, q->rec, URING_REC_CHUNK, q->rec_off,
+                       (uint64_t)(uintptr_t)q);
+    if (r == 0)
+    {
+        q->ring_prev = NULL;
+        q->ring_next = g_ring_inflight;
+        if (g_ring_inflight)
+            g_ring_inflight->ring_prev = q;
+        g_ring_inflight = q;
+    }
+    return r;
+}
+
+// Saca q de la lista de lecturas en el kernel (su CQE ya llegó)
+static void uring_unlink(UringReq *q)
+{
+    if (q->ring_prev)
+        q->ring_prev->ring_next = q->ring_next;
+    else
+        g_ring_inflight = q->ring_next;
+    if (q->ring_next)
+        q->ring_next->ring_prev = q->ring_prev;
+}
+
+// io_uring_enter falló sin remedio: se vuelve a pread sin dejar ningún GET esperando.
+// Los SQE que el kernel no llegó a tomar se retiran; las lecturas ya enviadas escriben en
+// buffers de sus hilos, así que se espera su CQE. Si ni eso es posible, se devuelven como
+// UR_LOST: su hilo abandona esa memoria (y el anillo sigue abierto) en vez de reutilizarla.
+static void uring_fail(Uring *r, UringReq *backlog)
+{
+    pthread_mutex_lock(&g_ring_mu);
+    g_ring_dead = true;
+    UringReq *q = g_ring_queue;
+    g_ring_queue = NULL;
+    pthread_mutex_unlock(&g_ring_mu);
+    __atomic_store_n(&g_opt.io_uring, false, __ATOMIC_RELAXED);
+    fprintf(stderr, "io_uring: el anillo dejó de funcionar, se sigue con pread\n");
+
+    while (q)
+    {
+        UringReq *next = q->next;
+        uring_complete(q, UR_RETRY);
+        q = next;
+    }
+    while (backlog)
+    {
+        UringReq *next = backlog->next;
+        uring_complete(backlog, UR_RETRY);
+        backlog = next;
+    }
+
+    // SQE preparados que el kernel no tomó (entre su head y nuestro tail): no llegarán a leer
+    unsigned sq_head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    for (unsigned t = sq_head; t != *r->sq_tail; t++)
+    {
+        struct io_uring_sqe *sqe = &r->sqes[r->sq_array[t & *r->sq_mask]];
+        r->inflight--;
+        if (sqe->user_data != 0)
+        {
+            q = (UringReq *)(uintptr_t)sqe->user_data;
+            uring_unlink(q);
+            uring_complete(q, UR_RETRY);
+        }
+    }
+    __atomic_store_n(r->sq_tail, sq_head, __ATOMIC_RELEASE);
+    r->to_submit = 0;
+
+    // El POLL_ADD del eventfd también puede estar en vuelo: se dispara para que complete
+    uint64_t one = 1;
+    if (write(g_ring_efd, &one, sizeof(one)) < 0)
+        perror("eventfd write");
+    while (r->inflight > 0)
+    {
+        if (syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR &&
+            errno != EAGAIN && errno != EBUSY)
+            break;
+        unsigned head = *r->cq_head;
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            r->inflight--;
+            if (cqe->user_data != 0)
+            {
+                q = (UringReq *)(uintptr_t)cqe->user_data;
+                uring_unlink(q);
+                uring_complete(q, UR_RETRY);
+            }
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+    if (g_ring_inflight)
+        fprintf(stderr, "io_uring: %u lecturas sin completar; sus buffers no se reutilizan\n", r->inflight);
+    while (g_ring_inflight)
+    {
+        q = g_ring_inflight;
+        uring_unlink(q);
+        uring_complete(q, UR_LOST);
+    }
+}
+
+// Procesa un CQE de lectura: avanza la petición de etapa o la completa
+static void uring_on_read(UringReq *q, int res, UringReq **backlog)
+{
+    if (q->stage == UR_BUCKET)
+    {
+        if (res <= 0)
+        {
+            uring_complete(q, -1);
+            return;
+        }
+        q->done += (size_t)res;
+        if (q->done < q->bytes)
+        {
+            // Lectura parcial: pide el resto
+            q->next = *backlog;
+            *backlog = q;
+            return;
+        }
+        // Bucket completo: búsqueda binaria y lectura encadenada de la fila
+        uint64_t count = q->bytes / sizeof(Pair);
+        int lo = 0, hi = (int)count - 1;
+        while (lo <= hi)
+        {
+            int mid = lo + ((hi - lo) >> 1);
+            if (q->pairs[mid].id == q->id)
+            {
+                q->rec_off = q->pairs[mid].offset;
+                // Id borrado (DEL): como si no estuviera
+                if (q->rec_off & IDX_DEAD)
+                {
+                    uring_complete(q, 0);
+                    return;
+                }
+                // Fila empaquetada: la lee el hilo de conexión desde la caché de bloques
+                if (q->rec_off & BLK_FLAG)
+                {
+                    uring_complete(q, 1);
+                    return;
+                }
+                q->stage = UR_RECORD;
+                q->done = 0;
+                q->next = *backlog;
+                *backlog = q;
+                return;
+            }
+            else if (q->pairs[mid].id < q->id)
+                lo = mid + 1;
+            else
+                hi = mid - 1;
+        }
+        uring_complete(q, 0);
+        return;
+    }
+    if (res < 0)
+    {
+        uring_complete(q, -2);
+        return;
+    }
+    q->rec_len = (size_t)res;
+    uring_complete(q, 1);
+}
+
+static void *uring_thread(void *arg)
+{
+    (void)arg;
+    Uring *r = &g_ring;
+    UringReq *backlog = NULL; // peticiones listas para enviar que no cupieron en el anillo
+    uint64_t efd_val = 0;
+    bool poll_armed = false;
+
+    for (;;)
+    {
+        // Vigilancia del eventfd: un POLL_ADD one-shot que se rearma tras cada aviso
+        if (!poll_armed && uring_prep(r, IORING_OP_POLL_ADD, g_ring_efd, NULL, 0, 0, 0) == 0)
+            poll_armed = true;
+
+        // Toma todas las peticiones nuevas de una vez
+        pthread_mutex_lock(&g_ring_mu);
+        UringReq *q = g_ring_queue;
+        g_ring_queue = NULL;
+        pthread_mutex_unlock(&g_ring_mu);
+        while (q)
+        {
+            UringReq *next = q->next;
+            q->next = backlog;
+            backlog = q;
+            q = next;
+        }
+        while (backlog && uring_issue(backlog) == 0)
+            backlog = backlog->next;
+
+        unsigned submit = r->to_submit;
+        int ret = (int)syscall(__NR_io_uring_enter, r->fd, submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+            perror("io_uring_enter");
+            uring_fail(r, backlog);
+            break;
+        }
+        r->to_submit -= (unsigned)ret < submit ? (unsigned)ret : submit;
+        if (ret > 0)
+        {
+            STAT_ADD(g_uring_sqes, (uint64_t)ret);
+            STAT_ADD(g_uring_enters, 1);
+        }
+
+        // Cosecha de completados
+        unsigned head = *r->cq_head;
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            r->inflight--;
+            if (cqe->user_data == 0)
+            {
+                // Aviso de peticiones nuevas: se vacía el contador antes de rearmar
+                poll_armed = false;
+                if (read(g_ring_efd, &efd_val, sizeof(efd_val)) < 0 && errno != EAGAIN)
+                    perror("eventfd read");
+            }
+            else
+            {
+                UringReq *done = (UringReq *)(uintptr_t)cqe->user_data;
+                uring_unlink(done);
+                uring_on_read(done, cqe->res, &backlog);
+            }
+            head++;
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// Arranca el anillo; devuelve -1 si el kernel no soporta io_uring (se sigue con pread)
+static int uring_start(void)
+{
+    if (uring_setup(&g_ring, g_opt.uring_depth) != 0)
+        return -1;
+    g_ring_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_ring_efd < 0)
+        return -1;
+    pthread_t th;
+    if (pthread_create(&th, NULL, uring_thread, NULL) != 0)
+        return -1;
+    pthread_detach(th);
+    return 0;
+}
+
+// GET vía anillo: 1 encontrado (fila en *out), 0 no existe, -1 error de índice, -2 error de CSV
+static int uring_lookup(uint64_t id, char **out, size_t *out_len)
+{
+    UringReq q;
+    memset(&q, 0, sizeof(q));
+    q.id = id;
+    q.bucket = hash_id(id);
+    q.stage = UR_BUCKET;
+    // La vista queda anunciada hasta tener la fila: su bucket y su CSV siguen abiertos
+    IndexView *v = view_acquire();
+    q.csv_fd = v->csv_fd;
+    // Tabla densa: el offset ya se conoce y el anillo sólo lee la fila
+    int dr = dense_find(v, id, &q.rec_off);
+    if (dr == 0)
+    {
+        view_release();
+        return 0;
+    }
+    if (dr > 0 && (q.rec_off & BLK_FLAG))
+    {
+        int r = read_csv_line_at(q.csv_fd, q.rec_off, out, out_len) == 0 ? 1 : -2;
+        view_release();
+        return r;
+    }
+    bool by_bucket = dr < 0;
+    uint32_t crc = 0;
+    unsigned seq = 0;
+    uint64_t count = 0;
+    if (by_bucket)
+    {
+        q.idx_fd = fileno(v->idx);
+        q.dir = dir_read(v, q.bucket, &crc, &seq);
+        count = q.dir.bucket_count;
+        if (count == 0)
+        {
+            view_release();
+            return 0;
+        }
+        q.bytes = (size_t)count * sizeof(Pair);
+        if (q.bytes > (8u << 20))
+        {
+            view_release();
+            return -1;
+        }
+    }
+    else
+        q.stage = UR_RECORD;
+    // Fila y bucket en la arena; el bucket (reservado después) se devuelve al terminar
+    q.rec = (char *)arena_alloc(URING_REC_CHUNK + 1);
+    ArenaMark mark = arena_mark();
+    q.pairs = q.rec && by_bucket ? (Pair *)arena_alloc(q.bytes) : NULL;
+    if (!q.rec || (by_bucket && !q.pairs))
+    {
+        view_release();
+        return -1;
+    }
+    sem_init(&q.sem, 0, 0);
+
+    pthread_mutex_lock(&g_ring_mu);
+    bool dead = g_ring_dead;
+    if (!dead)
+    {
+        q.next = g_ring_queue;
+        g_ring_queue = &q;
+    }
+    pthread_mutex_unlock(&g_ring_mu);
+    if (dead)
+        q.status = UR_RETRY;
+    else
+    {
+        uint64_t one = 1;
+        if (write(g_ring_efd, &one, sizeof(one)) < 0)
+            perror("eventfd write");
+        while (sem_wait(&q.sem) != 0 && errno == EINTR)
+            ;
+    }
+    sem_destroy(&q.sem);
+    // Un UPDATE/DEL cambió el bucket mientras el anillo lo leía, o el anillo ya no funciona:
+    // se repite por pread
+    if (q.status == UR_RETRY || q.status == UR_LOST || (by_bucket && q.status != -1 && !dir_stable(v, q.bucket, seq)))
+    {
+        if (q.status == UR_LOST)
+            arena_abandon();
+        else
+            arena_rewind(mark);
+        uint64_t off = 0;
+        int r = find_in_view(v, id, &off);
+        if (r > 0 && read_csv_line_at(v->csv_fd, off, out, out_len) != 0)
+            r = -2;
+        view_release();
+        return r;
+    }
+    // El bucket leído por el anillo sigue en la arena: se comprueba antes de usar su resultado
+    if (by_bucket && q.status != -1 && bucket_verify(v, q.bucket, crc, q.pairs, q.bytes) != 0)
+        q.status = -1;
+    arena_rewind(mark);
+
+    if (by_bucket && t_stats)
+    {
+        STAT_ADD(t_stats->idx_bytes, q.bytes);
+        STAT_ADD(t_stats->bucket_hits[q.bucket], 1);
+        hist_record(&t_stats->bucket_len, count);
+    }
+    if (q.status != 1)
+    {
+        view_release();
+        return q.status;
+    }
+
+    // La fila debe terminar en '\n' dentro del bloque; si es más larga se relee con pread
+    // (las filas empaquetadas no pasan por el anillo: salen de la caché de bloques)
+    char *nl = (char *)memchr(q.rec, '\n', q.rec_len);
+    if ((q.rec_off & BLK_FLAG) || (!nl && q.rec_len == URING_REC_CHUNK))
+    {
+        int r = read_csv_line_at(q.csv_fd, q.rec_off, out, out_len) == 0 ? 1 : -2;
+        view_release();
+        return r;
+    }
+    view_release();
+    size_t len = nl ? (size_t)(nl - q.rec) + 1 : q.rec_len;
+    if (len == 0)
+        return -2;
+    q.rec[len] = '\0';
+    *out = q.rec;
+    *out_len = len;
+    if (t_stats)
+    {
+        STAT_ADD(t_stats->csv_bytes, len);
+        STAT_ADD(t_stats->region_hits[csv_region(q.rec_off)], 1);
+    }
+    return 1;
+}
+
+// ====== Busca y lee la fila de un id por el backend configurado ======
+// 1 encontrado (fila en *out, en la arena del hilo), 0 no existe, -1 error de índice, -2 error de CSV
+static int lookup_record(uint64_t id, char **out, size_t *out_len)
+{
+    if (__atomic_load_n(&g_opt.io_uring, __ATOMIC_RELAXED))
+        return uring_lookup(id, out, out_len);
+
+    // La vista sigue anunciada hasta leer la fila: un VACUUM no cierra su CSV antes
+    IndexView *v = view_acquire();
+    uint64_t off = 0;
+    int r = find_in_view(v, id, &off);
+    if (r > 0 && read_csv_line_at(v->csv_fd, off, out, out_len) != 0)
+        r = -2;
+    view_release();
+    return r;
+}
+
+// ===============================================================
+// Respuestas de GET escritas directamente en un buffer de la arena
+// ===============================================================
+#define CSV_MAX_FIELDS 32
+#define REPLY_HEAD_ROOM 32 // hueco delante del cuerpo para "OK <n>\n"
+
+// Trozo de una línea CSV (sin comillas exteriores; "" sigue duplicada dentro)
+typedef struct
+{
+    const char *p;
+    size_t n;
+    bool quoted;
+} CsvField;
+
+// Nombres de columna (primera línea del CSV), para las claves de FORMAT json
+static CsvField g_csv_cols[CSV_MAX_FIELDS];
+static int g_csv_ncols = 0;
+
+// Parte la línea en campos sin copiarla. A diferencia de strtok, conserva los campos
+// vacíos (",,") y no corta en comas dentro de comillas.
+static int csv_split(const char *line, size_t len, CsvField *f, int max)
+{
+    while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        len--;
+    const char *p = line, *end = line + len;
+    int count = 0;
+    while (count < max)
+    {
+        CsvField *c = &f[count++];
+        c->quoted = p < end && *p == '"';
+        if (c->quoted)
+        {
+            const char *q = ++p;
+            while (q < end && !(*q == '"' && (q + 1 >= end || q[1] != '"')))
+                q += (*q == '"') ? 2 : 1;
+            c->p = p;
+            c->n = (size_t)((q < end ? q : end) - p);
+            p = q < end ? q + 1 : end;
+            while (p < end && *p != ',')
+                p++;
+        }
+        else
+        {
+            const char *q = (const char *)memchr(p, ',', (size_t)(end - p));
+            c->p = p;
+            c->n = (size_t)((q ? q : end) - p);
+            p = q ? q : end;
+        }
+        if (p >= end)
+            break;
+        p++; // salta la coma
+    }
+    return count;
+}
+
+// Lee los nombres de columna de la cabecera del CSV (una vez, al arrancar)
+static void load_csv_columns(void)
+{
+    char *head = (char *)malloc(CMD_LINE_MAX);
+    if (!head)
+        return;
+    ssize_t r = pread(fileno(g_csv), head, CMD_LINE_MAX - 1, 0);
+    char *nl = r > 0 ? (char *)memchr(head, '\n', (size_t)r) : NULL;
+    if (!nl)
+    {
+        free(head);
+        return;
+    }
+    // head queda reservado mientras viva el proceso: los campos apuntan dentro
+    g_csv_ncols = csv_split(head, (size_t)(nl - head), g_csv_cols, CSV_MAX_FIELDS);
+}
+
+// Tope de cada campo de la ficha salvo la descripción: los nueve juntos, con sus etiquetas,
+// caben de sobra en la ficha de 4 KB aunque ADD acepte filas de CMD_LINE_MAX
+#define CARD_FIELD_MAX 256
+
+// Ficha legible (solo campos clave) en un buffer de la arena; devuelve su longitud o -1
+static int render_card(const char *csv_line, size_t csv_len, char **out)
+{
+    CsvField f[CSV_MAX_FIELDS];
+    int count = csv_split(csv_line, csv_len, f, CSV_MAX_FIELDS);
+    static const CsvField none = {"", 0, false};
+    const CsvField *id = count > 0 ? &f[0] : &none;
+    const CsvField *titulo = count > 4 ? &f[4] : &none;
+    const CsvField *autor = count > 10 ? &f[10] : &none;
+    const CsvField *editorial = count > 14 ? &f[14] : &none;
+    const CsvField *idioma = count > 15 ? &f[15] : &none;
+    const CsvField *anio = count > 12 ? &f[12] : &none;
+    const CsvField *rating = count > 18 ? &f[18] : &none;
+    const CsvField *paginas = count > 19 ? &f[19] : &none;
+    const CsvField *archivo = count > 13 ? &f[13] : &none;
+    const CsvField *descripcion = count > 17 ? &f[17] : &none;
+
+    const size_t CAP = 4096;
+    char *buf = (char *)arena_alloc(CAP);
+    if (!buf)
+        return -1;
+
+    // La ficha siempre termina en la línea de guiones (los clientes la usan como
+    // fin de respuesta): cada campo se recorta a CARD_FIELD_MAX y la descripción a lo
+    // que quede, nunca el cierre.
+    const char *fmt = "OK\n"
+                      "ID: %.*s\n"
+                      "Título: %.*s\n"
+                      "Autor: %.*s\n"
+                      "Editorial: %.*s\n"
+                      "Idioma: %.*s\n"
+                      "Año: %.*s\n"
+                      "Rating: %.*s\n"
+                      "Páginas: %.*s\n"
+                      "Archivo origen: %.*s\n"
+                      "Descripción: %.*s\n"
+                      "----------------------------------------\n";
+#define CARD_LEN(fld) (int)((fld)->n < CARD_FIELD_MAX ? (fld)->n : CARD_FIELD_MAX)
+#define CARD_ARGS(desc_len)                                                                          \
+    CARD_LEN(id), id->p, CARD_LEN(titulo), titulo->p, CARD_LEN(autor), autor->p, CARD_LEN(editorial), \
+        editorial->p, CARD_LEN(idioma), idioma->p, CARD_LEN(anio), anio->p, CARD_LEN(rating),         \
+        rating->p, CARD_LEN(paginas), paginas->p, CARD_LEN(archivo), archivo->p, (int)(desc_len),     \
+        descripcion->p
+    int fixed = snprintf(NULL, 0, fmt, CARD_ARGS(0));
+    int room = (int)CAP - 1 - fixed;
+    if (room < 0)
+        room = 0;
+    if ((size_t)room > descripcion->n)
+        room = (int)descripcion->n;
+    int n = snprintf(buf, CAP, fmt, CARD_ARGS(room));
+#undef CARD_ARGS
+#undef CARD_LEN
+    *out = buf;
+    return n < (int)CAP ? n : (int)CAP - 1;
+}
+
+// Copia un campo como cadena JSON ("" del CSV -> ", escapes de JSON); devuelve el final
+static char *json_put_string(char *o, const CsvField *f)
+{
+    static const char hex[] = "0123456789abcdef";
+    *o++ = '"';
+    for (size_t i = 0; i < f->n; ++i)
+    {
+        unsigned char c = (unsigned char)f->p[i];
+        if (f->quoted && c == '"' && i + 1 < f->n && f->p[i + 1] == '"')
+            i++;
+        if (c == '"' || c == '\\')
+        {
+            *o++ = '\\';
+            *o++ = (char)c;
+        }
+        else if (c < 0x20)
+        {
+            memcpy(o, "\\u00", 4);
+            o[4] = hex[c >> 4];
+            o[5] = hex[c & 15];
+            o += 6;
+        }
+        else
+            *o++ = (char)c;
+    }
+    *o++ = '"';
+    return o;
+}
+
+// "OK <n>\n" + objeto JSON de una línea con todas las columnas, en un solo buffer de la arena
+static int render_json(const char *csv_line, size_t csv_len, char **out)
+{
+    CsvField f[CSV_MAX_FIELDS];
+    int count = csv_split(csv_line, csv_len, f, CSV_MAX_FIELDS);
+    // Cota: cada byte de clave o valor ocupa como mucho 6 al escaparse
+    size_t bound = REPLY_HEAD_ROOM + 4;
+    for (int i = 0; i < count; ++i)
+        bound += 6 * (f[i].n + (i < g_csv_ncols ? g_csv_cols[i].n : 8)) + 8;
+    char *buf = (char *)arena_alloc(bound);
+    if (!buf)
+        return -1;
+
+    char *body = buf + REPLY_HEAD_ROOM, *o = body;
+    *o++ = '{';
+    for (int i = 0; i < count; ++i)
+    {
+        if (i)
+            *o++ = ',';
+        if (i < g_csv_ncols)
+            o = json_put_string(o, &g_csv_cols[i]);
+        else
+            o += sprintf(o, "\"f%d\"", i);
+        *o++ = ':';
+        o = json_put_string(o, &f[i]);
+    }
+    *o++ = '}';
+    *o++ = '\n';
+
+    // La cabecera se escribe justo delante del cuerpo: una sola llamada a send
+    char head[REPLY_HEAD_ROOM];
+    int hn = snprintf(head, sizeof(head), "OK %zu\n", (size_t)(o - body));
+    memcpy(body - hn, head, (size_t)hn);
+    *out = body - hn;
+    return (int)(o - body) + hn;
+}
+
+// ====== Escritura del índice: inserción, cambio de offset (UPDATE) y borrado (DEL) ======
+// Todas se llaman con g_write_mu, que las hace el único escritor del directorio de la vista:
+// no compiten entre sí ni con el cambio de vista.
+
+// Guarda en books.idx los metadatos del bucket b ya publicados en RAM: su entrada de directorio
+// (si cambió), su CRC y la cabecera con su CRC (v2: cubre total_entries, directorio y CRCs)
+static void idx_store_meta(IndexView *v, unsigned b, bool dir_changed)
+{
+    if (dir_changed)
+    {
+        fseeko(v->idx, sizeof(Header) + (b * sizeof(DirEntry)), SEEK_SET);
+        fwrite(&v->dir[b], sizeof(DirEntry), 1, v->idx);
+    }
+    if (v->bucket_crc)
+    {
+        fseeko(v->idx, sizeof(Header) + TABLE_SIZE * sizeof(DirEntry) + b * sizeof(uint32_t), SEEK_SET);
+        fwrite(&v->bucket_crc[b], sizeof(uint32_t), 1, v->idx);
+    }
+    fflush(v->idx);
+
+    fseeko(v->idx, 0, SEEK_SET);
+    fwrite(&v->hdr, sizeof(Header), 1, v->idx);
+    if (v->bucket_crc)
+    {
+        v->bucket_crc[TABLE_SIZE] = idx_header_crc(&v->hdr, sizeof(Header), v->dir, TABLE_SIZE * sizeof(DirEntry),
+                                                   v->bucket_crc, TABLE_SIZE);
+        fseeko(v->idx, sizeof(Header) + TABLE_SIZE * sizeof(DirEntry) + TABLE_SIZE * sizeof(uint32_t), SEEK_SET);
+        fwrite(&v->bucket_crc[TABLE_SIZE], sizeof(uint32_t), 1, v->idx);
+    }
+    fflush(v->idx);
+}
+
+// Cambia en su sitio el offset del par i del bucket b (pairs: el bucket ya modificado en RAM).
+// Son 8 bytes en el bucket publicado, sin copiarlo: la entrada del directorio queda en impar
+// mientras se escriben, así los lectores que lo lean a la vez lo repiten (ver dir_stable).
+// El CRC nuevo sólo se publica si la escritura llegó al archivo: si falla, el CRC y
+// verified siguen describiendo el bucket que hay en disco.
+static int bucket_patch(IndexView *v, unsigned b, size_t i, const Pair *pairs)
+{
+    DirEntry d = v->dir[b];
+    uint32_t crc = v->bucket_crc ? crc32c(0, pairs, d.bucket_count * sizeof(Pair)) : 0;
+    unsigned s = v->dir_seq[b];
+    __atomic_store_n(&v->dir_seq[b], s + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    // pwrite y no fwrite: si falla, no quedan bytes en el búfer de stdio que se escriban después
+    int rc = -1;
+    if (fflush(v->idx) == 0 &&
+        pwrite(fileno(v->idx), &pairs[i].offset, sizeof(uint64_t),
+               (off_t)(d.bucket_offset + i * sizeof(Pair) + offsetof(Pair, offset))) == (ssize_t)sizeof(uint64_t))
+        rc = 0;
+    if (rc == 0 && v->bucket_crc)
+        __atomic_store_n(&v->bucket_crc[b], crc, __ATOMIC_RELAXED);
+    __atomic_store_n(&v->dir_seq[b], s + 2, __ATOMIC_RELEASE);
+    if (rc != 0)
+        return rc;
+    __atomic_store_n(&v->verified[b], 1, __ATOMIC_RELEASE);
+    idx_store_meta(v, b, false);
+    return rc;
+}
+
+// Aplica una fila del CSV al bucket del id: el id se inserta si no estaba y, si estaba, pasa
+// a apuntar a offset (UPDATE, o ADD de un id borrado). Con IDX_DEAD en offset el id se marca
+// como borrado conservando su último offset (DEL).
+static int bucket_apply(IndexView *v, uint64_t id, uint64_t offset)
+{
+    bool dead = (offset & IDX_DEAD) != 0;
+    unsigned b = hash_id(id);
+    DirEntry d = v->dir[b];
+
+    // Cargar el bucket actual
+    if (fseeko(v->idx, (off_t)d.bucket_offset, SEEK_SET) != 0)
+        return -1;
+
+    Pair *pairs = malloc(sizeof(Pair) * (d.bucket_count + 1));
+    if (!pairs)
+        return -1;
+
+    size_t rd = fread(pairs, sizeof(Pair), (size_t)d.bucket_count, v->idx);
+    if (rd != (size_t)d.bucket_count && ferror(v->idx))
+    {
+        free(pairs);
+        return -1;
+    }
+    // v2: no se reescribe (con un CRC nuevo y válido) un bucket que ya estaba dañado
+    if (v->bucket_crc && crc32c(0, pairs, rd * sizeof(Pair)) != v->bucket_crc[b])
+    {
+        fprintf(stderr, "ADD: el bucket %u no coincide con su CRC32C; no se modifica\n", b);
+        STAT_ADD(g_crc_failures, 1);
+        free(pairs);
+        return -1;
+    }
+
+    // Posición del id (o donde iría) manteniendo el orden por id
+    size_t i = 0;
+    while (i < d.bucket_count && pairs[i].id < id)
+        i++;
+    if (i < d.bucket_count && pairs[i].id == id)
+    {
+        // El id ya tiene par: sólo cambia su offset (nada que hacer si ya es ese)
+        uint64_t next = dead ? (pairs[i].offset | IDX_DEAD) : offset;
+        int rc = 0;
+        if (pairs[i].offset != next)
+        {
+            pairs[i].offset = next;
+            rc = bucket_patch(v, b, i, pairs);
+        }
+        free(pairs);
+        return rc;
+    }
+    // Borrar un id sin par: el bucket no cambia
+    if (dead)
+    {
+        free(pairs);
+        return 0;
+    }
+    memmove(&pairs[i + 1], &pairs[i], (d.bucket_count - i) * sizeof(Pair));
+    pairs[i].id = id;
+    pairs[i].offset = offset;
+    d.bucket_count++;
+
+    // Escribir la versión nueva del bucket al final del archivo (la vieja no se toca:
+    // los lectores que aún la usan siguen viendo un bucket completo)
+    fseeko(v->idx, 0, SEEK_END);
+    d.bucket_offset = (uint64_t)ftello(v->idx);
+    fwrite(pairs, sizeof(Pair), d.bucket_count, v->idx);
+    fflush(v->idx);
+    uint32_t crc = v->bucket_crc ? crc32c(0, pairs, d.bucket_count * sizeof(Pair)) : 0;
+    free(pairs);
+
+    // Publicar en RAM el par (offset, count) y su CRC de una vez para los lectores
+    dir_write(v, b, d, crc);
+    __atomic_store_n(&v->verified[b], 1, __ATOMIC_RELEASE);
+
+    // Actualizar el directorio, el header (total_entries) y sus CRC
+    __atomic_store_n(&v->hdr.total_entries, v->hdr.total_entries + 1, __ATOMIC_RELAXED);
+    idx_store_meta(v, b, true);
+    return 0;
+}
+
+// Aplica una fila del CSV a la vista. books.idx recibe siempre el cambio, también para los
+// ids de la tabla densa: así el índice está completo aunque la tabla se descarte al arrancar
+// (csv_end distinto, --dense-min=0) y lo ven split_index, pack_store e idx_bench. La tabla,
+// si cubre el id, se actualiza después y sólo si el bucket se pudo escribir.
+static int apply_to_view(IndexView *v, uint64_t id, uint64_t offset)
+{
+    if (bucket_apply(v, id, offset) != 0)
+        return -1;
+    int64_t slot = v->dense ? dense_slot(v->dense, id) : -1;
+    if (slot >= 0)
+    {
+        if (offset & IDX_DEAD)
+            dense_clear(v, slot);
+        else
+            dense_store(v, slot, offset);
+    }
+    return 0;
+}
+
+// ====== REBUILD: índice nuevo en segundo plano y cambio atómico de vista ======
+// El hilo de reconstrucción (nice 19, E/S idle) recorre el CSV hasta el byte publicado al
+// empezar, reparte los pares en memoria por bucket, ordena y escribe <books.idx>.rebuild
+// con el mismo formato que build_index. Las escrituras que llegan mientras tanto quedan
+// en un registro delta; al final, bajo g_write_mu, se reaplican sobre el índice nuevo, se
+// renombra sobre books.idx y se publica la vista nueva sin pausar a los lectores.
+// Como build_index, de cada id vale su última fila y un borrado ("-<id>") lo quita: el índice
+// nuevo no lleva pares IDX_DEAD. VACUUM usa el mismo hilo y además compacta el CSV.
+typedef struct
+{
+    Pair *p;
+    size_t n, cap;
+} PairVec;
+
+static PairVec g_rebuild_delta; // escrituras durante la reconstrucción (bajo g_write_mu)
+
+static int pairvec_push(PairVec *pv, uint64_t id, uint64_t off)
+{
+    if (pv->n == pv->cap)
+    {
+        size_t ncap = pv->cap ? pv->cap * 2 : 64;
+        Pair *np = (Pair *)realloc(pv->p, ncap * sizeof(Pair));
+        if (!np)
+            return -1;
+        pv->p = np;
+        pv->cap = ncap;
+    }
+    pv->p[pv->n++] = (Pair){id, off};
+    return 0;
+}
+
+// Escritura en la vista publicada (ADD, UPDATE, DEL y réplicas); se anota si hay un REBUILD
+// o un VACUUM en curso
+static int apply_to_index(uint64_t id, uint64_t offset)
+{
+    if (g_rebuild_running && pairvec_push(&g_rebuild_delta, id, offset) != 0)
+        return -1;
+    return apply_to_view(g_view, id, offset);
+}
+
+// Publica el nuevo final del CSV: réplicas y tabla densa (que lo guarda como csv_end).
+// Llamar con g_write_mu, después de indexar las filas añadidas
+static void csv_commit(uint64_t end)
+{
+    __atomic_store_n(&g_csv_committed, end, __ATOMIC_RELAXED);
+    if (g_view->dense)
+        g_view->dense->csv_end = end;
+    pthread_cond_broadcast(&g_repl_cv);
+}
+
+// Orden de escritura de la fila de un offset: las empaquetadas (--blocks) son anteriores a
+// cualquier fila del CSV y, dentro del CSV, la posterior es la más nueva
+static inline uint64_t row_age(uint64_t off)
+{
+    return (off & BLK_FLAG) ? 0 : (off & ~IDX_DEAD) + 1;
+}
+
+// Por id y, con ids repetidos, de la fila más vieja a la más nueva
+static int cmp_pair_id(const void *a, const void *b)
+{
+    const Pair *pa = (const Pair *)a, *pb = (const Pair *)b;
+    if (pa->id != pb->id)
+        return (pa->id > pb->id) - (pa->id < pb->id);
+    return (row_age(pa->offset) > row_age(pb->offset)) - (row_age(pa->offset) < row_age(pb->offset));
+}
+
+// Ordena p y deja sólo la última fila de cada id, sin los ids cuya última fila es un borrado;
+// devuelve cuántos pares quedan
+static size_t pairs_resolve(Pair *p, size_t n)
+{
+    qsort(p, n, sizeof(Pair), cmp_pair_id);
+    size_t k = 0;
+    for (size_t i = 0; i < n; ++i)
+        if ((i + 1 == n || p[i + 1].id != p[i].id) && !(p[i].offset & IDX_DEAD))
+            p[k++] = p[i];
+    return k;
+}
+
+// Id del primer campo con las mismas reglas que build_index (espacios/comillas, sólo dígitos).
+// line tiene n bytes (no hace falta '\0'). 1 si es una fila, 2 si es un borrado y 0 si no
+// tiene id. Un borrado (DEL) es una línea con '-' y dígitos y nada más; una fila cuyo primer
+// campo empieza por '-' no es un borrado sino una fila sin id válido.
+static int csv_row_id(const char *line, size_t n, uint64_t *out)
+{
+    while (n && (line[n - 1] == '\r' || line[n - 1] == '\n'))
+        n--;
+    if (n && *line == '-')
+    {
+        uint64_t v = 0;
+        if (n < 2 || n > 21)
+            return 0;
+        for (size_t i = 1; i < n; ++i)
+        {
+            if (line[i] < '0' || line[i] > '9')
+                return 0;
+            uint64_t nv = v * 10 + (uint64_t)(line[i] - '0');
+            if (nv / 10 != v)
+                return 0; // desborde
+            v = nv;
+        }
+        *out = v;
+        return 2;
+    }
+    const char *c = (const char *)memchr(line, ',', n);
+    size_t len = c ? (size_t)(c - line) : n;
+    while (len && (*line == ' ' || *line == '\t' || *line == '"'))
+        line++, len--;
+    while (len && (line[len - 1] == ' ' || line[len - 1] == '\t' || line[len - 1] == '"'))
+        len--;
+    if (len == 0 || len > 20)
+        return 0;
+    uint64_t v = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (line[i] < '0' || line[i] > '9')
+            return 0;
+        uint64_t nv = v * 10 + (uint64_t)(line[i] - '0');
+        if (nv / 10 != v)
+            return 0; // desborde
+        v = nv;
+    }
+    *out = v;
+    return 1;
+}
+
+// Construye el índice de csv_path[0, end) en path; devuelve la vista (sin publicar) o NULL
+static IndexView *rebuild_build(const char *csv_path, const char *path, uint64_t end)
+{
+    FILE *csv = fopen(csv_path, "rb");
+    if (!csv)
+        return NULL;
+    PairVec *parts = (PairVec *)calloc(TABLE_SIZE, sizeof(PairVec));
+    char *line = NULL;
+    size_t cap = 0;
+    IndexView *nv = NULL;
+    FILE *idx = NULL;
+    if (!parts)
+        goto fail;
+
+    // 1) scan + partición en memoria (sin temporales: ~16 bytes por fila)
+    uint64_t total = 0, rows = 0, min_id = UINT64_MAX, max_id = 0;
+    char dense_path[4200];
+    snprintf(dense_path, sizeof(dense_path), "%s.dense", path);
+    // Filas empaquetadas (--blocks): se recorren bloque a bloque sin pasar por la caché
+    for (uint64_t b = 0; g_blk_fd >= 0 && b < g_blk_hdr.block_count && !g_stop; ++b)
+    {
+        uint32_t raw_len = 0;
+        uint8_t *raw = blk_load(b, &raw_len);
+        if (!raw)
+            goto fail;
+        for (unsigned slot = 0; slot < g_blk_dir[b].nrows; ++slot)
+        {
+            char *row = NULL;
+            size_t rlen = 0;
+            uint64_t id;
+            ArenaMark mark = arena_mark();
+            if (blk_copy_row(raw, raw_len, slot, &row, &rlen) != 0)
+            {
+                free(raw);
+                goto fail;
+            }
+            int ok = csv_row_id(row, rlen, &id) == 1;
+            arena_rewind(mark);
+            if (ok)
+            {
+                if (pairvec_push(&parts[hash_id(id)], id, blk_make_offset(b, slot)) != 0)
+                {
+                    free(raw);
+                    goto fail;
+                }
+                rows++;
+            }
+        }
+        free(raw);
+        __atomic_store_n(&g_rebuild_rows, rows, __ATOMIC_RELAXED);
+    }
+    ssize_t n = getline(&line, &cap, csv); // cabecera
+    uint64_t off = n > 0 ? (uint64_t)n : 0;
+    while (off < end && !g_stop && (n = getline(&line, &cap, csv)) > 0)
+    {
+        uint64_t id;
+        int kind = csv_row_id(line, (size_t)n, &id);
+        // Un borrado entra como par IDX_DEAD: sólo sirve para descartar las filas anteriores
+        if (kind && pairvec_push(&parts[hash_id(id)], id, kind == 2 ? off | IDX_DEAD : off) != 0)
+            goto fail;
+        rows += kind != 0;
+        off += (uint64_t)n;
+        if ((rows & 65535) == 0)
+            __atomic_store_n(&g_rebuild_rows, rows, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&g_rebuild_rows, rows, __ATOMIC_RELAXED);
+    if (g_stop)
+        goto fail;
+    // De cada id, su última fila (y ninguna si fue borrado)
+    for (unsigned b = 0; b < TABLE_SIZE; ++b)
+    {
+        PairVec *pv = &parts[b];
+        pv->n = pairs_resolve(pv->p, pv->n);
+        total += pv->n;
+        if (pv->n)
+        {
+            min_id = pv->p[0].id < min_id ? pv->p[0].id : min_id;
+            max_id = pv->p[pv->n - 1].id > max_id ? pv->p[pv->n - 1].id : max_id;
+        }
+    }
+
+    // 2) orden por bucket y escritura: header, directorio, checksums y buckets consecutivos
+    nv = (IndexView *)calloc(1, sizeof(IndexView));
+    idx = fopen(path, "w+b");
+    if (!nv || !idx || !(nv->dir = (DirEntry *)calloc(TABLE_SIZE, sizeof(DirEntry))) ||
+        !(nv->dir_seq = (unsigned *)calloc(TABLE_SIZE, sizeof(unsigned))) ||
+        !(nv->bucket_crc = (uint32_t *)calloc(1, IDX_CRC_BYTES(TABLE_SIZE))) ||
+        !(nv->verified = (unsigned char *)calloc(TABLE_SIZE, 1)))
+        goto fail;
+    memcpy(nv->hdr.magic, IDX_MAGIC_V2, 8);
+    nv->hdr.table_size = TABLE_SIZE;
+    nv->hdr.total_entries = total;
+    // Ids densos: tabla directa junto al índice, con las mismas reglas que build_index
+    uint64_t slots = 0;
+    if (dense_plan(min_id, max_id, total, g_opt.dense_min, &slots))
+    {
+        if (!(nv->dense = dense_create(dense_path, min_id, slots)))
+            goto fail;
+        nv->dense_bytes = dense_file_bytes(slots);
+    }
+    uint64_t pos = sizeof(Header) + TABLE_SIZE * sizeof(DirEntry) + IDX_CRC_BYTES(TABLE_SIZE);
+    if (fseeko(idx, (off_t)pos, SEEK_SET) != 0)
+        goto fail;
+    for (unsigned b = 0; b < TABLE_SIZE; ++b)
+    {
+        PairVec *pv = &parts[b];
+        if (pv->n == 0)
+            continue;
+        nv->dir[b].bucket_offset = pos;
+        nv->dir[b].bucket_count = pv->n;
+        nv->bucket_crc[b] = crc32c(0, pv->p, pv->n * sizeof(Pair));
+        if (fwrite(pv->p, sizeof(Pair), pv->n, idx) != pv->n)
+            goto fail;
+        for (size_t k = 0; nv->dense && k < pv->n; ++k)
+            dense_store(nv, dense_slot(nv->dense, pv->p[k].id), pv->p[k].offset);
+        pos += pv->n * sizeof(Pair);
+        free(pv->p);
+        pv->p = NULL;
+    }
+    nv->bucket_crc[TABLE_SIZE] =
+        idx_header_crc(&nv->hdr, sizeof(Header), nv->dir, TABLE_SIZE * sizeof(DirEntry), nv->bucket_crc, TABLE_SIZE);
+    if (fseeko(idx, 0, SEEK_SET) != 0 || fwrite(&nv->hdr, sizeof(Header), 1, idx) != 1 ||
+        fwrite(nv->dir, sizeof(DirEntry), TABLE_SIZE, idx) != TABLE_SIZE ||
+        fwrite(nv->bucket_crc, 1, IDX_CRC_BYTES(TABLE_SIZE), idx) != IDX_CRC_BYTES(TABLE_SIZE) || fflush(idx) != 0 ||
+        fsync(fileno(idx)) != 0)
+        goto fail;
+    if (nv->dense)
+    {
+        nv->dense->csv_end = end;
+        if (msync(nv->dense, nv->dense_bytes, MS_SYNC) != 0)
+            goto fail;
+    }
+    nv->idx = idx;
+    nv->csv_fd = g_view->csv_fd;
+    for (unsigned b = 0; b < TABLE_SIZE; ++b)
+        free(parts[b].p);
+    free(parts);
+    free(line);
+    fclose(csv);
+    return nv;
+
+fail:
+    if (parts)
+        for (unsigned b = 0; b < TABLE_SIZE; ++b)
+            free(parts[b].p);
+    free(parts);
+    free(line);
+    fclose(csv);
+    if (idx)
+    {
+        fclose(idx);
+        remove(path);
+    }
+    if (nv)
+    {
+        free(nv->dir);
+        free(nv->dir_seq);
+        free(nv->bucket_crc);
+        free(nv->verified);
+        if (nv->dense)
+            munmap(nv->dense, nv->dense_bytes);
+    }
+    remove(dense_path);
+    free(nv);
+    return NULL;
+}
+
+#define VACUUM_TAIL_CHUNK (1u << 20) // copia de las filas llegadas durante VACUUM
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// ====== VACUUM: CSV sin filas muertas ======
+// Copia a out_path la cabecera y las filas vivas de csv[0, end) en el mismo orden: la última
+// fila de cada id no borrado y las que no tienen id (que nadie indexa, pero no son muertas).
+// Las filas reemplazadas por UPDATE, las de ids borrados y las líneas de borrado desaparecen.
+// Devuelve los bytes escritos (0 si falla); *reclaimed recibe los que se quitaron.
+static uint64_t vacuum_compact(const char *out_path, uint64_t end, uint64_t *reclaimed)
+{
+    FILE *csv = fopen(g_csv_path, "rb");
+    FILE *out = fopen(out_path, "wb");
+    PairVec all = {0};
+    uint64_t *live = NULL;
+    char *line = NULL;
+    size_t cap = 0, nlive = 0;
+    uint64_t written = 0;
+    *reclaimed = 0;
+    if (!csv || !out)
+        goto done;
+
+    // 1) (id, offset) de cada fila y de cada borrado; por id sólo queda la última fila viva
+    ssize_t n = getline(&line, &cap, csv); // cabecera
+    uint64_t head = n > 0 ? (uint64_t)n : 0, off = head;
+    while (off < end && !g_stop && (n = getline(&line, &cap, csv)) > 0)
+    {
+        uint64_t id;
+        int kind = csv_row_id(line, (size_t)n, &id);
+        if (kind && pairvec_push(&all, id, kind == 2 ? off | IDX_DEAD : off) != 0)
+            goto done;
+        off += (uint64_t)n;
+    }
+    if (g_stop)
+        goto done;
+    nlive = pairs_resolve(all.p, all.n);
+    if (!(live = (uint64_t *)malloc((nlive + 1) * sizeof(uint64_t))))
+        goto done;
+    for (size_t k = 0; k < nlive; ++k)
+        live[k] = all.p[k].offset;
+    free(all.p);
+    all.p = NULL;
+    qsort(live, nlive, sizeof(uint64_t), cmp_u64);
+
+    // 2) segunda pasada en orden: se copian la cabecera y las filas vivas
+    if (fseeko(csv, 0, SEEK_SET) != 0 || (n = getline(&line, &cap, csv)) <= 0 ||
+        fwrite(line, 1, (size_t)n, out) != (size_t)n)
+        goto done;
+    uint64_t size = (uint64_t)n;
+    off = head;
+    size_t k = 0;
+    while (off < end && !g_stop && (n = getline(&line, &cap, csv)) > 0)
+    {
+        uint64_t id;
+        while (k < nlive && live[k] < off)
+            k++;
+        if (!csv_row_id(line, (size_t)n, &id) || (k < nlive && live[k] == off))
+        {
+            if (fwrite(line, 1, (size_t)n, out) != (size_t)n)
+                goto done;
+            size += (uint64_t)n;
+        }
+        else
+            *reclaimed += (uint64_t)n;
+        off += (uint64_t)n;
+    }
+    if (!g_stop && off == end && fflush(out) == 0 && fsync(fileno(out)) == 0)
+        written = size;
+
+done:
+    free(all.p);
+    free(live);
+    free(line);
+    if (csv)
+        fclose(csv);
+    if (out)
+        fclose(out);
+    if (!written)
+        remove(out_path);
+    return written;
+}
+
+// VACUUM cambia dos archivos: primero el CSV compactado y después su índice. Entre los dos
+// renames books.idx apunta a filas del CSV viejo, así que antes de tocar el CSV se escribe la
+// marca <books.idx>.swap y sólo se borra cuando books.idx (y su tabla densa) son los nuevos.
+// Si queda (caída, rename fallido), swap_finish termina el cambio con lo preparado en
+// <books.idx>.rebuild: al arrancar y antes de cada REBUILD o VACUUM, que reutilizan ese nombre.
+static int swap_mark(void)
+{
+    char marker[4200];
+    snprintf(marker, sizeof(marker), "%s.swap", g_idx_path);
+    int fd = open(marker, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+// Devuelve 0 si no había cambio pendiente o se ha completado; -1 si books.idx sigue sin
+// corresponder al CSV (no se debe servir ni reconstruir sobre él)
+static int swap_finish(void)
+{
+    char marker[4200], staged[4200], dense_staged[4200], dense_path[4200], csv_tmp[4200];
+    snprintf(marker, sizeof(marker), "%s.swap", g_idx_path);
+    if (access(marker, F_OK) != 0)
+        return 0;
+    snprintf(staged, sizeof(staged), "%s.rebuild", g_idx_path);
+    snprintf(dense_staged, sizeof(dense_staged), "%s.rebuild.dense", g_idx_path);
+    snprintf(dense_path, sizeof(dense_path), "%s.dense", g_idx_path);
+    snprintf(csv_tmp, sizeof(csv_tmp), "%s.vacuum", g_csv_path);
+    if (access(csv_tmp, F_OK) == 0)
+    {
+        // El CSV no llegó a cambiarse: books.idx sigue siendo el suyo y lo preparado sobra
+        remove(staged);
+        remove(dense_staged);
+        remove(csv_tmp);
+    }
+    else
+    {
+        // El CSV ya es el compactado: su índice (y su tabla densa, si la hay) pasan a su sitio
+        if (access(staged, F_OK) == 0)
+        {
+            remove(dense_path);
+            if (rename(staged, g_idx_path) != 0)
+            {
+                fprintf(stderr, "vacuum: cambio pendiente; no se pudo mover %s a %s: %s\n", staged, g_idx_path,
+                        strerror(errno));
+                return -1;
+            }
+        }
+        if (access(dense_staged, F_OK) == 0 && rename(dense_staged, dense_path) != 0)
+            remove(dense_staged);
+        fprintf(stderr, "vacuum: completado el cambio pendiente de %s\n", g_idx_path);
+    }
+    if (remove(marker) != 0)
+    {
+        perror("vacuum: borrar la marca de cambio");
+        return -1;
+    }
+    return 0;
+}
+
+// Hilo de REBUILD (arg NULL) o de VACUUM (arg no NULL)
+static void *rebuild_thread(void *arg)
+{
+    bool vacuum = arg != NULL;
+    // Prioridad baja de CPU y de E/S para este hilo (Linux: nice y ioprio por hilo)
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    setpriority(PRIO_PROCESS, (id_t)tid, 19);
+    syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, tid, 3 << 13 /* IOPRIO_CLASS_IDLE */);
+
+    // Lo escrito hasta end entra por el recorrido del CSV; el delta sólo guarda lo posterior
+    uint64_t t0 = now_ns();
+    pthread_mutex_lock(&g_write_mu);
+    uint64_t end = g_csv_committed;
+    g_rebuild_delta.n = 0;
+    pthread_mutex_unlock(&g_write_mu);
+
+    char path[4096], dense_tmp[4200], dense_path[4200], csv_tmp[4200], marker[4200];
+    snprintf(path, sizeof(path), "%s.rebuild", g_idx_path);
+    snprintf(dense_tmp, sizeof(dense_tmp), "%s.dense", path);
+    snprintf(dense_path, sizeof(dense_path), "%s.dense", g_idx_path);
+    snprintf(csv_tmp, sizeof(csv_tmp), "%s.vacuum", g_csv_path);
+    snprintf(marker, sizeof(marker), "%s.swap", g_idx_path);
+    // VACUUM: primero el CSV compactado y después el índice de ese CSV
+    uint64_t vac_end = 0, reclaimed = 0;
+    IndexView *nv = NULL;
+    if (!vacuum)
+        nv = rebuild_build(g_csv_path, path, end);
+    else if ((vac_end = vacuum_compact(csv_tmp, end, &reclaimed)) != 0)
+        nv = rebuild_build(csv_tmp, path, vac_end);
+    arena_destroy();
+
+    pthread_mutex_lock(&g_write_mu);
+    // VACUUM: las filas añadidas durante la compactación pasan al CSV nuevo tal cual, así que
+    // sus offsets se desplazan (shift) lo que se compactó
+    uint64_t shift = vacuum ? end - vac_end : 0;
+    FILE *old_csv = g_csv;
+    if (nv && vacuum)
+    {
+        uint64_t pos = end;
+        FILE *tail = fopen(csv_tmp, "ab");
+        char *chunk = (char *)malloc(VACUUM_TAIL_CHUNK);
+        while (tail && chunk && pos < g_csv_committed)
+        {
+            size_t want = g_csv_committed - pos < VACUUM_TAIL_CHUNK ? (size_t)(g_csv_committed - pos) : VACUUM_TAIL_CHUNK;
+            if (pread_full(fileno(g_csv), chunk, want, pos) != 0 || fwrite(chunk, 1, want, tail) != want)
+                break;
+            pos += want;
+        }
+        free(chunk);
+        if (!tail || pos != g_csv_committed || fflush(tail) != 0 || fsync(fileno(tail)) != 0)
+            nv = NULL;
+        if (tail)
+            fclose(tail);
+        if (nv)
+            nv->csv_fd = -1; // se fija al reabrir el CSV nuevo
+    }
+    if (nv)
+    {
+        // Reaplica las escrituras llegadas durante la construcción y reemplaza el archivo
+        for (size_t i = 0; i < g_rebuild_delta.n && nv; ++i)
+            if (apply_to_view(nv, g_rebuild_delta.p[i].id, g_rebuild_delta.p[i].offset - shift) != 0)
+                nv = NULL;
+        // El CSV compactado reemplaza al actual, con la marca ya en disco (ver swap_mark). Se
+        // abre antes del rename para no quedar con el CSV cambiado y sin poder escribir en él
+        FILE *new_csv = NULL;
+        if (nv && vacuum && (swap_mark() != 0 || !(new_csv = fopen(csv_tmp, "a+b")) || rename(csv_tmp, g_csv_path) != 0))
+        {
+            perror("vacuum: reemplazo del CSV");
+            if (new_csv)
+                fclose(new_csv);
+            nv = NULL;
+        }
+        if (nv && vacuum)
+        {
+            g_csv = new_csv;
+            fseeko(g_csv, 0, SEEK_END);
+            nv->csv_fd = fileno(g_csv);
+            __atomic_store_n(&g_csv_committed, (uint64_t)ftello(g_csv), __ATOMIC_RELAXED);
+            remove(dense_path); // la tabla vieja ya no vale para el CSV nuevo
+        }
+        // Con el CSV ya cambiado no hay vuelta atrás: la vista nueva se publica igualmente, sus
+        // archivos siguen en path y la marca queda para que swap_finish complete el cambio
+        bool swap_pending = false;
+        if (nv && rename(path, g_idx_path) != 0)
+        {
+            perror("rebuild: reemplazo del índice");
+            if (!vacuum)
+                nv = NULL;
+            swap_pending = vacuum;
+        }
+        // La tabla densa nueva (o ninguna, si los ids ya no son densos) reemplaza a la anterior
+        if (nv && !swap_pending)
+        {
+            if (nv->dense)
+            {
+                nv->dense->csv_end = g_csv_committed;
+                // Si no se puede colocar, la tabla vieja no debe quedar (su csv_end u offsets
+                // ya no valen): la vista sigue con la nueva en memoria y books.idx está completo
+                if (rename(dense_tmp, dense_path) != 0)
+                {
+                    perror("rebuild: reemplazo de la tabla densa");
+                    remove(dense_path);
+                    remove(dense_tmp);
+                }
+            }
+            else
+                remove(dense_path);
+            if (vacuum)
+                remove(marker);
+        }
+    }
+    size_t replayed = g_rebuild_delta.n;
+    free(g_rebuild_delta.p);
+    memset(&g_rebuild_delta, 0, sizeof(g_rebuild_delta));
+    g_rebuild_running = false;
+    IndexView *old = g_view;
+    if (nv)
+    {
+        nv->generation = old->generation + 1;
+        __atomic_store_n(&g_view, nv, __ATOMIC_SEQ_CST);
+        g_idx_header_crc = 1;
+    }
+    pthread_mutex_unlock(&g_write_mu);
+
+    if (!nv)
+    {
+        remove(path);
+        remove(dense_tmp);
+        remove(csv_tmp);
+        if (vacuum)
+            remove(marker); // el CSV no se cambió
+        fprintf(stderr, "%s: falló; se mantiene el índice actual\n", vacuum ? "vacuum" : "rebuild");
+        return NULL;
+    }
+    // La vista vieja (y con VACUUM su CSV) se libera cuando ningún lector la tenga anunciada
+    view_retire(old);
+    if (g_csv != old_csv)
+        fclose(old_csv);
+
+    uint64_t ms = (now_ns() - t0) / 1000000;
+    if (vacuum)
+    {
+        __atomic_store_n(&g_vacuum_last_ms, ms, __ATOMIC_RELAXED);
+        __atomic_store_n(&g_vacuum_reclaimed, reclaimed, __ATOMIC_RELAXED);
+        STAT_ADD(g_vacuum_count, 1);
+        fprintf(stderr, "vacuum: %" PRIu64 " bytes de filas muertas fuera, CSV de %.1f MB y %" PRIu64
+                        " entradas en %.2f s (%zu escrituras reaplicadas), generación %" PRIu64 "\n",
+                reclaimed, (double)g_csv_committed / 1e6, nv->hdr.total_entries, (double)ms / 1000.0,
+                replayed, nv->generation);
+        return NULL;
+    }
+    __atomic_store_n(&g_rebuild_last_ms, ms, __ATOMIC_RELAXED);
+    STAT_ADD(g_rebuild_count, 1);
+    fprintf(stderr, "rebuild: %" PRIu64 " entradas en %.2f s (%zu escrituras reaplicadas), generación %" PRIu64 "\n",
+            nv->hdr.total_entries, (double)ms / 1000.0, replayed, nv->generation);
+    return NULL;
+}
+
+
+// ====== Formato de respuesta de GET (por sesión, comando FORMAT) ======
+enum
+{
+    FMT_CARD = 0, // ficha legible (por defecto, cliente interactivo)
+    FMT_CSV = 1,  // "OK <nbytes>\n" seguido de la fila CSV tal cual
+    FMT_JSON = 2  // "OK <nbytes>\n" seguido de un objeto JSON de una línea
+};
+
+static const char *const FMT_NAMES[] = {"card", "csv", "json"};
+
+// ====== Resultado de un comando (para métricas) ======
+enum
+{
+    CMD_ERR = -1, // se respondió ERR
+    CMD_MISS = 0, // GET sin resultado (NOTFOUND)
+    CMD_OK = 1    // GET con ficha o ADD confirmado
+};
+
+// Respuestas al cliente: con --read-timeout el socket tiene SO_SNDTIMEO, así que un envío
+// puede quedarse corto o vencer. Se reintenta lo que falte y, si no sale, se marca la
+// conexión para que el bucle de comandos la cierre en vez de seguir respondiendo a medias.
+static __thread bool t_send_failed = false;
+
+static void client_sendv(int fd, struct iovec *iov, int niov, int flags)
+{
+    while (niov > 0 && !t_send_failed)
+    {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t)niov;
+        ssize_t w = sendmsg(fd, &msg, flags | MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+        {
+            t_send_failed = true;
+            return;
+        }
+        while (niov > 0 && (size_t)w >= iov->iov_len)
+        {
+            w -= (ssize_t)iov->iov_len;
+            iov++;
+            niov--;
+        }
+        if (niov > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= (size_t)w;
+        }
+    }
+}
+
+static void client_send(int fd, const void *p, size_t n, int flags)
+{
+    struct iovec iov = {(void *)p, n};
+    client_sendv(fd, &iov, 1, flags);
+}
+
+// Envía un mensaje de error al cliente y devuelve CMD_ERR
+static int reply_err(int fd, const char *msg)
+{
+    client_send(fd, msg, strlen(msg), 0);
+    return CMD_ERR;
+}
+
+// ====== ADD <línea_csv> ======
+static int handle_add(int fd, const char *line)
+{
+    // Las réplicas sólo aplican lo que llega del primario
+    if (g_opt.follow)
+        return reply_err(fd, "ERR read-only replica\n");
+
+    // 1. Extraer línea CSV completa
+    // Obtiene el texto del nuevo registro CSV (después de "ADD ") y omite espacios
+    const char *csv_line = line + 4;
+    // Saltar espacios iniciales
+    while (*csv_line == ' ')
+        csv_line++;
+
+    // 2. Extraer el ID inicial
+    // Si no hay coma, el formato es incorrecto: enviar error al cliente
+    size_t len = strlen(csv_line);
+    if (!memchr(csv_line, ',', len))
+        return reply_err(fd, "ERR formato CSV inválido\n");
+    // El ID (antes de la primera coma) con las mismas reglas que build_index y REBUILD: una fila
+    // que aceptaran aquí y descartaran al reconstruir (o leyeran como "-<id>") no puede entrar
+    uint64_t id;
+    if (csv_row_id(csv_line, len, &id) != 1)
+        return reply_err(fd, "ERR bad id\n");
+
+    // 3. Verificar si el ID ya existe
+    // Desde aquí hasta actualizar el índice no puede intercalarse otro ADD
+    pthread_mutex_lock(&g_write_mu);
+    uint64_t off_exist = 0;
+    // Busca en el índice si el ID ya está registrado; devuelve 1 si existe, 0 si no
+    int exists = find_offset(id, &off_exist);
+    // Si hubo error al leer el índice, notificar al cliente y abortar esta operación
+    if (exists < 0)
+    {
+        pthread_mutex_unlock(&g_write_mu);
+        return reply_err(fd, "ERR index read error\n");
+    }
+    // Si el ID ya existe en el índice, enviar error de duplicado
+    if (exists > 0)
+    {
+        pthread_mutex_unlock(&g_write_mu);
+        return reply_err(fd, "ERR ID duplicado\n");
+    }
+
+    // 4. Escribir la nueva línea al final del CSV
+
+    // Mueve el puntero al final del archivo CSV para agregar el nuevo registro
+    fseeko(g_csv, 0, SEEK_END);
+    // Obtiene el desplazamiento (offset) actual, para indexar este registro en el archivo
+    uint64_t offset = (uint64_t)ftello(g_csv);
+    // Escribe el nuevo registro CSV en el archivo con salto de línea final
+    fprintf(g_csv, "%s\n", csv_line);
+    // Fuerza la escritura inmediata al disco para mantener la coherencia del índice
+    fflush(g_csv);
+
+    // 5. Insertar en el índice binario
+
+    // Inserta el nuevo par (ID, offset) en el índice binario; si falla, notificar error
+    int ins = apply_to_index(id, offset);
+    // La fila ya está en el CSV: se publica a las réplicas
+    csv_commit(offset + strlen(csv_line) + 1);
+    pthread_mutex_unlock(&g_write_mu);
+    if (ins != 0)
+        return reply_err(fd, "ERR inserción en índice\n");
+
+    // 6. Confirmar al cliente
+
+    // Envía confirmación al cliente de que el registro se insertó correctamente
+    const char *okmsg = "OK Registro agregado correctamente\n";
+    client_send(fd, okmsg, strlen(okmsg), 0);
+    return CMD_OK;
+}
+
+// Añade len bytes y '\n' al final del CSV; devuelve el offset de la línea o UINT64_MAX.
+// Llamar con g_write_mu (y después csv_commit con el nuevo final)
+static uint64_t csv_append(const char *text, size_t len)
+{
+    if (fseeko(g_csv, 0, SEEK_END) != 0)
+        return UINT64_MAX;
+    uint64_t offset = (uint64_t)ftello(g_csv);
+    if (fwrite(text, 1, len, g_csv) != len || fputc('\n', g_csv) == EOF || fflush(g_csv) != 0)
+        return UINT64_MAX;
+    return offset;
+}
+
+// ====== UPDATE <línea_csv>: nueva versión de un registro que ya existe ======
+// La fila se añade al CSV y el par del id pasa a apuntarla en su sitio (8 bytes del bucket o
+// la ranura de la tabla densa, sin copiar el bucket). La fila anterior queda muerta en el CSV
+// hasta el próximo VACUUM; REBUILD y build_index ya se quedan con la última fila de cada id.
+static int handle_update(int fd, const char *line)
+{
+    if (g_opt.follow)
+        return reply_err(fd, "ERR read-only replica\n");
+
+    const char *csv_line = line + 7;
+    while (*csv_line == ' ')
+        csv_line++;
+    size_t len = strlen(csv_line);
+    uint64_t id;
+    if (!memchr(csv_line, ',', len) || csv_row_id(csv_line, len, &id) != 1)
+        return reply_err(fd, "ERR formato CSV inválido\n");
+
+    pthread_mutex_lock(&g_write_mu);
+    uint64_t off_exist = 0;
+    int exists = find_offset(id, &off_exist);
+    if (exists <= 0)
+    {
+        pthread_mutex_unlock(&g_write_mu);
+        if (exists == 0)
+        {
+            client_send(fd, "NOTFOUND\n", 9, 0);
+            return CMD_MISS;
+        }
+        return reply_err(fd, "ERR index read error\n");
+    }
+    uint64_t offset = csv_append(csv_line, len);
+    int rc = offset == UINT64_MAX ? -1 : apply_to_index(id, offset);
+    if (offset != UINT64_MAX)
+        csv_commit(offset + len + 1);
+    pthread_mutex_unlock(&g_write_mu);
+    if (rc != 0)
+        return reply_err(fd, "ERR actualización del índice\n");
+
+    STAT_ADD(g_update_ok, 1);
+    const char *okmsg = "OK Registro actualizado correctamente\n";
+    client_send(fd, okmsg, strlen(okmsg), 0);
+    return CMD_OK;
+}
+
+// ====== DEL <id>: borrado con lápida ======
+// El CSV recibe la línea "-<id>" (el borrado sobrevive a reinicios, REBUILD y réplicas) y el
+// par del id se marca con IDX_DEAD en su sitio (en la tabla densa se libera la ranura). El id
+// deja de existir para GET y un ADD posterior lo vuelve a crear; VACUUM quita la fila y el par.
+static int handle_del(int fd, const char *line)
+{
+    if (g_opt.follow)
+        return reply_err(fd, "ERR read-only replica\n");
+
+    const char *p = line + 4;
+    while (*p == ' ')
+        p++;
+    if (*p == '\0')
+        return reply_err(fd, "ERR missing id\n");
+    uint64_t id;
+    size_t len = strlen(p);
+    if (memchr(p, ',', len) || csv_row_id(p, len, &id) != 1)
+        return reply_err(fd, "ERR bad id\n");
+
+    pthread_mutex_lock(&g_write_mu);
+    uint64_t off_exist = 0;
+    int exists = find_offset(id, &off_exist);
+    if (exists <= 0)
+    {
+        pthread_mutex_unlock(&g_write_mu);
+        if (exists == 0)
+        {
+            client_send(fd, "NOTFOUND\n", 9, 0);
+            return CMD_MISS;
+        }
+        return reply_err(fd, "ERR index read error\n");
+    }
+    char tomb[32];
+    int tn = snprintf(tomb, sizeof(tomb), "-%" PRIu64, id);
+    uint64_t offset = csv_append(tomb, (size_t)tn);
+    int rc = offset == UINT64_MAX ? -1 : apply_to_index(id, offset | IDX_DEAD);
+    if (offset != UINT64_MAX)
+        csv_commit(offset + (uint64_t)tn + 1);
+    pthread_mutex_unlock(&g_write_mu);
+    if (rc != 0)
+        return reply_err(fd, "ERR borrado en índice\n");
+
+    STAT_ADD(g_del_ok, 1);
+    const char *okmsg = "OK Registro borrado\n";
+    client_send(fd, okmsg, strlen(okmsg), 0);
+    return CMD_OK;
+}
+
+// ====== Replicación: flujo de filas añadidas del primario a las réplicas ======
+// Protocolo (texto + bloques binarios, una conexión por réplica):
+//   réplica  -> "SYNC <bytes de su CSV>\n"  (su snapshot es un prefijo del CSV del primario)
+//   primario -> "OK SYNC <bytes del primario>\n"
+//   primario -> "ROWS <offset> <n>\n" + n bytes de filas completas del CSV
+//   primario -> "HB <bytes del primario>\n" (latido cada segundo, y tras cada bloque)
+// La réplica añade las filas a su CSV en el mismo offset y actualiza su propio índice,
+// así que los buckets se reconstruyen localmente sin enviarlos por la red.
+#define REPL_CHUNK (256u * 1024u) // > CMD_LINE_MAX: siempre cabe al menos una fila entera
+
+static int send_all(int fd, const char *p, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return -1;
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+// Lee exactamente n bytes (primero lo que quede en el buffer de líneas)
+static int lr_read_bytes(LineReader *lr, char *dst, size_t n)
+{
+    size_t have = lr->end - lr->start;
+    size_t k = have < n ? have : n;
+    memcpy(dst, lr->buf + lr->start, k);
+    lr->start += k;
+    dst += k;
+    n -= k;
+    while (n > 0)
+    {
+        ssize_t r = recv(lr->fd, dst, n, 0);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        dst += r;
+        n -= (size_t)r;
+    }
+    return 0;
+}
+
+// Primario: un hilo por réplica que sigue el final del CSV
+static void *repl_sender_thread(void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    LineReader *lr = (LineReader *)calloc(1, sizeof(LineReader));
+    char *chunk = (char *)malloc(REPL_CHUNK);
+    char line[128];
+    if (!lr || !chunk)
+        goto out;
+    lr->fd = fd;
+
+    uint64_t pos = 0;
+    if (read_line(lr, line, sizeof(line)) <= 0 || sscanf(line, "SYNC %" SCNu64, &pos) != 1)
+        goto out;
+    pthread_mutex_lock(&g_write_mu);
+    uint64_t end = g_csv_committed;
+    pthread_mutex_unlock(&g_write_mu);
+    if (pos > end)
+    {
+        send_all(fd, "ERR replica ahead of primary\n", 29);
+        goto out;
+    }
+    int hn = snprintf(line, sizeof(line), "OK SYNC %" PRIu64 "\n", end);
+    if (send_all(fd, line, (size_t)hn) != 0)
+        goto out;
+    STAT_ADD(g_repl_followers, 1);
+    fprintf(stderr, "réplica conectada desde el byte %" PRIu64 " (primario en %" PRIu64 ")\n", pos, end);
+
+    while (!g_stop)
+    {
+        // Espera filas nuevas o el siguiente latido (1 s)
+        pthread_mutex_lock(&g_write_mu);
+        if (pos == g_csv_committed)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += 1;
+            pthread_cond_timedwait(&g_repl_cv, &g_write_mu, &ts);
+        }
+        end = g_csv_committed;
+        pthread_mutex_unlock(&g_write_mu);
+
+        // Envía lo pendiente en bloques que terminan en fila completa
+        while (pos < end)
+        {
+            size_t want = end - pos < REPL_CHUNK ? (size_t)(end - pos) : REPL_CHUNK;
+            if (pread_full(fileno(g_csv), chunk, want, pos) != 0)
+                goto done;
+            char *last = (char *)memrchr(chunk, '\n', want);
+            if (!last)
+                goto done;
+            size_t n = (size_t)(last - chunk) + 1;
+            hn = snprintf(line, sizeof(line), "ROWS %" PRIu64 " %zu\n", pos, n);
+            if (send_all(fd, line, (size_t)hn) != 0 || send_all(fd, chunk, n) != 0)
+                goto done;
+            STAT_ADD(g_repl_bytes_sent, n);
+            pos += n;
+        }
+        hn = snprintf(line, sizeof(line), "HB %" PRIu64 "\n", end);
+        if (send_all(fd, line, (size_t)hn) != 0)
+            goto done;
+    }
+done:
+    STAT_ADD(g_repl_followers, (uint64_t)-1);
+    fprintf(stderr, "réplica desconectada en el byte %" PRIu64 "\n", pos);
+out:
+    free(chunk);
+    free(lr);
+    close(fd);
+    return NULL;
+}
+
+static void *repl_listen_thread(void *arg)
+{
+    int s = (int)(intptr_t)arg;
+    while (!g_stop)
+    {
+        int cfd = accept(s, NULL, NULL);
+        if (cfd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("repl accept");
+            break;
+        }
+        pthread_t th;
+        if (pthread_create(&th, NULL, repl_sender_thread, (void *)(intptr_t)cfd) != 0)
+        {
+            close(cfd);
+            continue;
+        }
+        pthread_detach(th);
+    }
+    close(s);
+    return NULL;
+}
+
+// Abre el puerto de replicación (en la misma IP que el servidor) y lanza su hilo
+static int start_repl_listener(const char *bind_ip, int port)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0)
+    {
+        perror("repl socket");
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, bind_ip, &addr.sin_addr) != 1 || bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(s, 16) < 0)
+    {
+        perror("repl bind/listen");
+        close(s);
+        return -1;
+    }
+    pthread_t th;
+    if (pthread_create(&th, NULL, repl_listen_thread, (void *)(intptr_t)s) != 0)
+    {
+        close(s);
+        return -1;
+    }
+    pthread_detach(th);
+    return 0;
+}
+
+// Réplica: aplica un bloque de filas recibido en el offset off
+static int repl_apply(uint64_t off, const char *rows, size_t n)
+{
+    pthread_mutex_lock(&g_write_mu);
+    // El bloque debe empezar justo donde acaba nuestro CSV
+    if (off != g_csv_committed)
+    {
+        pthread_mutex_unlock(&g_write_mu);
+        fprintf(stderr, "replicación: offset %" PRIu64 " inesperado (local %" PRIu64 ")\n", off, g_csv_committed);
+        return -1;
+    }
+    if (fwrite(rows, 1, n, g_csv) != n || fflush(g_csv) != 0)
+    {
+        pthread_mutex_unlock(&g_write_mu);
+        perror("replicación: write csv");
+        return -1;
+    }
+    // Cada fila entra en el índice local como en el primario: un id repetido (UPDATE) pasa a
+    // su fila nueva y "-<id>" (DEL) lo borra; reaplicar una fila que ya estaba no cambia nada
+    int rc = 0;
+    for (size_t i = 0; i < n;)
+    {
+        const char *nl = (const char *)memchr(rows + i, '\n', n - i);
+        size_t len = nl ? (size_t)(nl - (rows + i)) + 1 : n - i;
+        uint64_t id;
+        int kind = csv_row_id(rows + i, len, &id);
+        if (kind && apply_to_index(id, kind == 2 ? (off + i) | IDX_DEAD : off + i) != 0)
+            rc = -1;
+        i += len;
+    }
+    csv_commit(off + n); // también para réplicas en cascada
+    pthread_mutex_unlock(&g_write_mu);
+    return rc;
+}
+
+// Réplica: sesión con el primario; reconecta cada segundo si se corta
+static void *repl_follow_thread(void *arg)
+{
+    (void)arg;
+    char host[64];
+    const char *colon = strrchr(g_opt.follow, ':');
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - g_opt.follow), g_opt.follow);
+    int port = atoi(colon + 1);
+    LineReader *lr = (LineReader *)calloc(1, sizeof(LineReader));
+    char *rows = (char *)malloc(REPL_CHUNK);
+    char line[128];
+    if (!lr || !rows)
+        return NULL;
+
+    while (!g_stop)
+    {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)port);
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || inet_pton(AF_INET, host, &addr.sin_addr) != 1 ||
+            connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        {
+            if (fd >= 0)
+                close(fd);
+            sleep(1);
+            continue;
+        }
+        lr->fd = fd;
+        lr->start = lr->end = 0;
+
+        pthread_mutex_lock(&g_write_mu);
+        uint64_t have = g_csv_committed;
+        pthread_mutex_unlock(&g_write_mu);
+        int hn = snprintf(line, sizeof(line), "SYNC %" PRIu64 "\n", have);
+        uint64_t primary = 0;
+        if (send_all(fd, line, (size_t)hn) != 0 || read_line(lr, line, sizeof(line)) <= 0 ||
+            sscanf(line, "OK SYNC %" SCNu64, &primary) != 1)
+        {
+            fprintf(stderr, "replicación: el primario rechazó SYNC %" PRIu64 ": %s", have, line);
+            close(fd);
+            sleep(1);
+            continue;
+        }
+        __atomic_store_n(&g_repl_primary_size, primary, __ATOMIC_RELAXED);
+        __atomic_store_n(&g_repl_connected, 1, __ATOMIC_RELAXED);
+        // El retraso en segundos se mide desde la última vez al día (o desde esta conexión)
+        if (__atomic_load_n(&g_repl_caught_up_ns, __ATOMIC_RELAXED) == 0)
+            __atomic_store_n(&g_repl_caught_up_ns, now_ns(), __ATOMIC_RELAXED);
+        fprintf(stderr, "replicando desde %s (local %" PRIu64 ", primario %" PRIu64 ")\n", g_opt.follow, have, primary);
+
+        for (;;)
+        {
+            uint64_t off = 0;
+            size_t n = 0;
+            if (read_line(lr, line, sizeof(line)) <= 0)
+                break;
+            if (sscanf(line, "HB %" SCNu64, &primary) == 1)
+            {
+                __atomic_store_n(&g_repl_primary_size, primary, __ATOMIC_RELAXED);
+                if (__atomic_load_n(&g_csv_committed, __ATOMIC_RELAXED) >= primary)
+                    __atomic_store_n(&g_repl_caught_up_ns, now_ns(), __ATOMIC_RELAXED);
+            }
+            else if (sscanf(line, "ROWS %" SCNu64 " %zu", &off, &n) == 2 && n <= REPL_CHUNK)
+            {
+                if (lr_read_bytes(lr, rows, n) != 0 || repl_apply(off, rows, n) != 0)
+                    break;
+            }
+            else
+                break;
+        }
+        __atomic_store_n(&g_repl_connected, 0, __ATOMIC_RELAXED);
+        fprintf(stderr, "replicación: sesión con %s cerrada\n", g_opt.follow);
+        close(fd);
+        sleep(1);
+    }
+    free(rows);
+    free(lr);
+    arena_destroy();
+    return NULL;
+}
+
+// ====== GET <id> ======
+// Arma la respuesta en iov (cabecera en head, fila o ficha en la arena del hilo) sin enviarla:
+// la usan el socket (handle_get) y el anillo de memoria compartida. Devuelve CMD_OK/MISS/ERR.
+static int build_get_reply(int format, const char *line, char head[40], struct iovec iov[2], int *niov)
+{
+    *niov = 1;
+    // Salta la palabra 'GET ' y cualquier espacio extra antes del ID
+    const char *p = line + 4;
+    while (*p == ' ')
+        p++;
+    // Si no hay ID después del comando GET, responder con error
+    if (*p == '\0')
+    {
+        iov[0] = (struct iovec){(void *)"ERR missing id\n", 15};
+        return CMD_ERR;
+    }
+
+    // Convierte el texto del ID a número entero (uint64_t), controlando errores
+    errno = 0;
+    char *endp = NULL;
+    uint64_t id = strtoull(p, &endp, 10);
+    // Si el ID no es numérico o excede el rango válido, responder con error
+    if (errno == ERANGE || endp == p)
+    {
+        iov[0] = (struct iovec){(void *)"ERR bad id\n", 11};
+        return CMD_ERR;
+    }
+
+    // Variables para la línea CSV leída (vive en la arena del hilo hasta el próximo reset)
+    char *csv_line = NULL;
+    size_t csv_len = 0;
+    // Busca el ID en el índice y lee su línea completa del CSV (pread o io_uring)
+    int r = lookup_record(id, &csv_line, &csv_len);
+    // Si ocurre un error interno al leer el índice, informar al cliente
+    if (r == -1)
+    {
+        iov[0] = (struct iovec){(void *)"ERR internal\n", 13};
+        return CMD_ERR;
+    }
+    // Si el ID no está en el índice, responder 'NOTFOUND'
+    if (r == 0)
+    {
+        iov[0] = (struct iovec){(void *)"NOTFOUND\n", 9};
+        return CMD_MISS;
+    }
+
+    // Si ocurre un error al leer la línea del CSV, notificar al cliente
+    if (r < 0)
+    {
+        iov[0] = (struct iovec){(void *)"ERR readcsv\n", 12};
+        return CMD_ERR;
+    }
+
+    // Respuesta en modo CSV: "OK <nbytes>\n<linea>" (enmarcada por longitud), en un solo envío
+    if (format == FMT_CSV)
+    {
+        int hn = snprintf(head, 40, "OK %zu\n", csv_len);
+        iov[0] = (struct iovec){head, (size_t)hn};
+        iov[1] = (struct iovec){csv_line, csv_len};
+        *niov = 2;
+        return CMD_OK;
+    }
+
+    // Ficha legible o JSON, compuestos directamente en un buffer de la arena
+    char *reply = NULL;
+    int rn = format == FMT_JSON ? render_json(csv_line, csv_len, &reply) : render_card(csv_line, csv_len, &reply);
+
+    // Si falló el formateo de la línea CSV, responder con error
+    if (rn < 0)
+    {
+        iov[0] = (struct iovec){(void *)"ERR format\n", 11};
+        return CMD_ERR;
+    }
+    // Respuesta completa (la memoria vuelve a la arena tras el comando)
+    iov[0] = (struct iovec){reply, (size_t)rn};
+    return CMD_OK;
+}
+
+static int handle_get(int fd, int format, const char *line)
+{
+    char head[40];
+    struct iovec iov[2];
+    int niov;
+    int r = build_get_reply(format, line, head, iov, &niov);
+    client_sendv(fd, iov, niov, 0);
+    return r;
+}
+
+// Cuenta un GET en las métricas del hilo (latencia de acierto o de fallo)
+static void record_get(ThreadStats *st, int r, uint64_t t0)
+{
+    if (!st)
+        return;
+    STAT_ADD(st->cmd_get, 1);
+    if (r == CMD_MISS)
+    {
+        STAT_ADD(st->get_miss, 1);
+        hist_record(&st->lat_miss, now_ns() - t0);
+    }
+    else
+    {
+        if (r == CMD_ERR)
+            STAT_ADD(st->cmd_errors, 1);
+        hist_record(&st->lat_get, now_ns() - t0);
+    }
+}
+
+// ====== MGET <id> <id>... ======
+// "OK MGET <n>\n" y después la respuesta de cada GET, en el orden pedido
+// (mismo formato que el enrutador de shards, que lo reparte entre procesos)
+static int handle_mget(int fd, int format, const char *line)
+{
+    size_t n = 0;
+    for (const char *p = line + 5; *p;)
+    {
+        while (*p == ' ')
+            p++;
+        if (!*p)
+            break;
+        n++;
+        while (*p && *p != ' ')
+            p++;
+    }
+    if (n == 0)
+        return reply_err(fd, "ERR missing id\n");
+
+    char head[48];
+    int hn = snprintf(head, sizeof(head), "OK MGET %zu\n", n);
+    client_send(fd, head, (size_t)hn, MSG_MORE);
+    char get[72];
+    for (const char *p = line + 5; *p;)
+    {
+        while (*p == ' ')
+            p++;
+        if (!*p)
+            break;
+        const char *tok = p;
+        while (*p && *p != ' ')
+            p++;
+        uint64_t t0 = now_ns();
+        snprintf(get, sizeof(get), "GET %.*s", (int)(p - tok) < 64 ? (int)(p - tok) : 64, tok);
+        record_get(t_stats, handle_get(fd, format, get), t0);
+        arena_reset();
+        if (t_send_failed)
+            break;
+    }
+    return CMD_OK;
+}
+
+// ====== REBUILD y VACUUM ======
+// VACUUM reescribe el CSV: no se admite con --blocks (las filas empaquetadas las compacta
+// pack_store) ni con replicación, cuyo protocolo supone que el CSV sólo crece
+static int handle_rebuild(int fd, bool vacuum)
+{
+    if (vacuum && (g_blk_fd >= 0 || g_opt.repl_port > 0 || g_opt.follow))
+        return reply_err(fd, "ERR VACUUM not available with --blocks or replication\n");
+    pthread_mutex_lock(&g_write_mu);
+    if (g_rebuild_running)
+    {
+        pthread_mutex_unlock(&g_write_mu);
+        return reply_err(fd, "ERR rebuild already running\n");
+    }
+    // Un VACUUM anterior a medias usa aún <books.idx>.rebuild, que el nuevo sobrescribiría
+    if (swap_finish() != 0)
+    {
+        pthread_mutex_unlock(&g_write_mu);
+        return reply_err(fd, "ERR pending VACUUM swap, see server log\n");
+    }
+    g_rebuild_running = true;
+    __atomic_store_n(&g_rebuild_rows, 0, __ATOMIC_RELAXED);
+    pthread_t th;
+    int rc = pthread_create(&th, NULL, rebuild_thread, vacuum ? (void *)&g_vacuum_count : NULL);
+    if (rc != 0)
+        g_rebuild_running = false;
+    pthread_mutex_unlock(&g_write_mu);
+    if (rc != 0)
+        return reply_err(fd, "ERR rebuild thread\n");
+    pthread_detach(th);
+    const char *msg = vacuum ? "OK VACUUM started\n" : "OK REBUILD started\n";
+    client_send(fd, msg, strlen(msg), 0);
+    return CMD_OK;
+}
+
+// ====== STATS ======
+static int handle_stats(int fd)
+{
+    StrBuf sb = {0};
+    stats_render_text(&sb);
+    if (!sb.data)
+        return reply_err(fd, "ERR sin memoria\n");
+    client_send(fd, sb.data, sb.len, 0);
+    free(sb.data);
+    return CMD_OK;
+}
+
+// ====== FORMAT card|csv ======
+// Cambia *format según 'FORMAT <nombre>' y devuelve el texto de la respuesta (msg o un error fijo)
+static const char *set_format(const char *line, int *format, char msg[32])
+{
+    const char *p = line + 6;
+    while (*p == ' ')
+        p++;
+    if (strcasecmp(p, "card") == 0)
+        *format = FMT_CARD;
+    else if (strcasecmp(p, "csv") == 0)
+        *format = FMT_CSV;
+    else if (strcasecmp(p, "json") == 0)
+        *format = FMT_JSON;
+    else
+        return "ERR expected: FORMAT card|csv|json\n";
+    snprintf(msg, 32, "OK FORMAT %s\n", FMT_NAMES[*format]);
+    return msg;
+}
+
+static int handle_format(int fd, const char *line, int *format)
+{
+    char msg[32];
+    const char *reply = set_format(line, format, msg);
+    client_send(fd, reply, strlen(reply), 0);
+    return reply == msg ? CMD_OK : CMD_ERR;
+}
+
+// ====== Hilo por conexión ======
+typedef struct
+{
+    int fd;
+} ClientCtx;
+
+// ====== Control de admisión: GET/MGET/ADD en ejecución a la vez ======
+// Con --max-inflight=N, a lo sumo N peticiones trabajan a la vez; las demás esperan turno en
+// una cola de --max-queue plazas durante --queue-timeout-ms. Si la cola está llena o vence la
+// espera, se responde ERR BUSY al momento: bajo sobrecarga unos pocos clientes reciben un
+// rechazo rápido en vez de que todos acumulen latencia hasta agotar su propio timeout.
+static pthread_mutex_t g_adm_mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_adm_cv;
+static int g_adm_running = 0; // peticiones en ejecución (bajo g_adm_mu)
+static int g_adm_waiting = 0; // peticiones en cola (bajo g_adm_mu)
+
+static void admission_init(void)
+{
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_adm_cv, &ca);
+    pthread_condattr_destroy(&ca);
+}
+
+// Pide turno; false si hay que rechazar la petición con ERR BUSY
+static bool admission_enter(void)
+{
+    if (g_opt.max_inflight <= 0)
+        return true;
+    pthread_mutex_lock(&g_adm_mu);
+    if (g_adm_running < g_opt.max_inflight)
+    {
+        g_adm_running++;
+        pthread_mutex_unlock(&g_adm_mu);
+        return true;
+    }
+    if (g_adm_waiting >= g_opt.max_queue)
+    {
+        pthread_mutex_unlock(&g_adm_mu);
+        STAT_ADD(g_busy_rejected, 1);
+        return false;
+    }
+    uint64_t t0 = now_ns();
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += g_opt.queue_timeout_ms / 1000;
+    deadline.tv_nsec += (long)(g_opt.queue_timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    g_adm_waiting++;
+    int rc = 0;
+    while (g_adm_running >= g_opt.max_inflight && rc != ETIMEDOUT)
+        rc = pthread_cond_timedwait(&g_adm_cv, &g_adm_mu, &deadline);
+    g_adm_waiting--;
+    bool ok = g_adm_running < g_opt.max_inflight;
+    if (ok)
+        g_adm_running++;
+    pthread_mutex_unlock(&g_adm_mu);
+    STAT_ADD(g_adm_queued, 1);
+    STAT_ADD(g_adm_wait_ns, now_ns() - t0);
+    if (!ok)
+        STAT_ADD(g_busy_rejected, 1);
+    return ok;
+}
+
+// Devuelve el turno y despierta a la siguiente petición en cola
+static void admission_leave(void)
+{
+    if (g_opt.max_inflight <= 0)
+        return;
+    pthread_mutex_lock(&g_adm_mu);
+    g_adm_running--;
+    if (g_adm_waiting > 0)
+        pthread_cond_signal(&g_adm_cv);
+    pthread_mutex_unlock(&g_adm_mu);
+}
+
+// ====== SHM: sesión por memoria compartida ======
+// Sólo por el socket Unix (--unix): la región se crea con memfd y su descriptor viaja con
+// SCM_RIGHTS, así que el cliente tiene que estar en la misma máquina. Después el hilo de la
+// conexión atiende GET y FORMAT por los anillos (ver idx_shm.h) hasta que el cliente cierra la
+// región o el socket; el resto de comandos siguen yendo por TCP o por el socket Unix.
+static void shm_session(int fd, int format)
+{
+    struct sockaddr_storage local;
+    socklen_t ll = sizeof(local);
+    if (getsockname(fd, (struct sockaddr *)&local, &ll) != 0 || local.ss_family != AF_UNIX)
+    {
+        reply_err(fd, "ERR SHM sólo por el socket Unix (--unix)\n");
+        return;
+    }
+
+    // Región compartida: cabecera y los dos anillos
+    size_t bytes = shm_region_bytes();
+    int mfd = memfd_create("idx_shm", MFD_CLOEXEC);
+    void *p = MAP_FAILED;
+    if (mfd < 0 || ftruncate(mfd, (off_t)bytes) != 0 ||
+        (p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, mfd, 0)) == MAP_FAILED)
+    {
+        perror("shm");
+        if (mfd >= 0)
+            close(mfd);
+        reply_err(fd, "ERR shm\n");
+        return;
+    }
+    ShmRegion *r = (ShmRegion *)p;
+    shm_region_init(r);
+    // Geometría de los anillos en memoria del servidor: el cliente puede escribir la región
+    ShmPort req_port = shm_port(r, &r->req, (uint32_t)sizeof(ShmRegion), SHM_REQ_BYTES);
+    ShmPort resp_port = shm_port(r, &r->resp, (uint32_t)(sizeof(ShmRegion) + SHM_REQ_BYTES), SHM_RESP_BYTES);
+
+    // "OK SHM <bytes>\n" con el memfd adjunto; el cliente lo mapea y el descriptor sobra
+    char ok[48];
+    int on = snprintf(ok, sizeof(ok), "OK SHM %zu\n", bytes);
+    union
+    {
+        struct cmsghdr h;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctl;
+    memset(&ctl, 0, sizeof(ctl));
+    struct iovec oiov = {ok, (size_t)on};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &oiov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cm), &mfd, sizeof(int));
+    ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    close(mfd);
+    char *req = (char *)malloc(SHM_REQ_BYTES + 1);
+    if (sent != on || !req)
+    {
+        free(req);
+        munmap(p, bytes);
+        return;
+    }
+    STAT_ADD(g_shm_sessions, 1);
+
+    ThreadStats *st = t_stats;
+    while (!g_stop)
+    {
+        ssize_t n = shm_pop(r, &req_port, req, SHM_REQ_BYTES, 1000);
+        // Sin peticiones en un segundo: si el cliente murió, su extremo del socket está cerrado
+        if (n == -3)
+        {
+            char c;
+            if (recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+                break;
+            continue;
+        }
+        if (n == -1)
+            break;
+        if (n < 0)
+            continue;
+        req[n] = '\0';
+        if (n > 0 && req[n - 1] == '\n')
+            req[n - 1] = '\0';
+        STAT_ADD(g_shm_requests, 1);
+
+        // Mismas respuestas que por el socket, pero se copian al anillo en vez de a send()
+        uint64_t t0 = now_ns();
+        char head[40], fmsg[32];
+        struct iovec iov[2];
+        int niov = 1, r_get = CMD_ERR;
+        bool is_get = false;
+        if (strncasecmp(req, "GET ", 4) == 0)
+        {
+            if (admission_enter())
+            {
+                is_get = true;
+                r_get = build_get_reply(format, req, head, iov, &niov);
+                admission_leave();
+            }
+            else
+                iov[0] = (struct iovec){(void *)"ERR BUSY\n", 9};
+        }
+        else if (strncasecmp(req, "FORMAT ", 7) == 0)
+        {
+            const char *m = set_format(req, &format, fmsg);
+            iov[0] = (struct iovec){(void *)m, strlen(m)};
+        }
+        else
+        {
+            iov[0] = (struct iovec){(void *)"ERR expected: GET <id> or FORMAT card|csv|json (shm)\n", 53};
+            if (st)
+                STAT_ADD(st->cmd_errors, 1);
+        }
+
+        // Si el cliente no recoge respuestas el anillo se llena: se espera mientras siga vivo
+        int pr;
+        while ((pr = shm_push(r, &resp_port, iov, niov, 1000)) == -3)
+        {
+            char c;
+            if (g_stop || recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+                break;
+        }
+        if (pr == -2)
+        {
+            iov[0] = (struct iovec){(void *)"ERR reply too large\n", 20};
+            pr = shm_push(r, &resp_port, iov, 1, 1000);
+        }
+        if (is_get)
+            record_get(st, r_get, t0);
+        arena_reset();
+        if (pr != 0)
+            break;
+    }
+
+    free(req);
+    shm_region_close(r);
+    munmap(p, bytes);
+}
+
+static void *client_thread(void *arg)
+{
+    // Extrae el contexto del cliente pasado como argumento por el hilo
+    ClientCtx *ctx = (ClientCtx *)arg;
+    // Guarda el descriptor del socket del cliente para lectura/escritura
+    int fd = ctx->fd;
+    // Libera la estructura temporal del cliente (ya no se necesita)
+    free(ctx);
+    // Registra los contadores de métricas de este hilo
+    stats_thread_enter();
+
+    // Lector con buffer y línea de comando en el heap (un ADD puede traer una fila de 100+ KB)
+    LineReader *lr = (LineReader *)malloc(sizeof(LineReader));
+    char *line = (char *)malloc(CMD_LINE_MAX);
+    if (!lr || !line)
+    {
+        free(lr);
+        free(line);
+        stats_thread_exit();
+        close(fd);
+        __atomic_sub_fetch(&g_conn_open, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    lr->fd = fd;
+    lr->start = lr->end = 0;
+    lr->idle_ms = g_opt.idle_timeout_s * 1000;
+    lr->read_ms = g_opt.read_timeout_s * 1000;
+    // Un cliente que no lee sus respuestas tampoco retiene el hilo más de --read-timeout
+    if (g_opt.read_timeout_s > 0)
+    {
+        struct timeval tv = {g_opt.read_timeout_s, 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+    // Formato de respuesta de GET para esta sesión
+    int format = FMT_CARD;
+
+    // Bucle principal: procesa comandos del cliente mientras la conexión esté abierta
+    // Lee líneas hasta que el cliente cierre o envíe QUIT
+    t_send_failed = false;
     for (;;)
     {
+        // Una respuesta anterior no llegó a salir (cliente que no lee): se cierra la conexión
+        if (t_send_failed)
+        {
+            STAT_ADD(g_send_timeouts, 1);
+            break;
+        }
         // Lee una línea de comando del socket del cliente (terminada en '\n')
-        ssize_t n = read_line(fd, line, sizeof(line));
+        ssize_t n = read_line(lr, line, CMD_LINE_MAX);
+        // Línea demasiado larga: se descartó completa, se informa y se sigue
+        if (n == -2)
+        {
+            reply_err(fd, "ERR línea demasiado larga\n");
+            continue;
+        }
+        // Conexión inactiva o comando que no termina de llegar: se cierra y libera el hilo
+        if (n == -3 || n == -4)
+        {
+            STAT_ADD(*(n == -3 ? &g_idle_timeouts : &g_read_timeouts), 1);
+            reply_err(fd, n == -3 ? "ERR idle timeout\n" : "ERR read timeout\n");
+            break;
+        }
         // Si el cliente cerró la conexión o hubo error, salir del bucle
         if (n <= 0)
             break;
@@ -317,173 +4328,404 @@ static void *client_thread(void *arg)
         // Si el cliente envía 'QUIT', cerrar la conexión limpiamente
         if (strcasecmp(line, "QUIT") == 0)
             break;
-        // Si el comando comienza con 'ADD ', procesar la inserción de un nuevo registro
-        if (strncasecmp(line, "ADD ", 4) == 0)
+
+        // Marca de tiempo de inicio para el histograma de latencia del comando
+        uint64_t t0 = now_ns();
+        ThreadStats *st = t_stats;
+
+        // GET, MGET y las escrituras pasan por el control de admisión; STATS y FORMAT nunca esperan
+        bool admitted = false;
+        if (strncasecmp(line, "GET ", 4) == 0 || strncasecmp(line, "MGET ", 5) == 0 ||
+            strncasecmp(line, "ADD ", 4) == 0 || strncasecmp(line, "UPDATE ", 7) == 0 ||
+            strncasecmp(line, "DEL ", 4) == 0)
         {
-            // 1. Extraer línea CSV completa
-            // Obtiene el texto del nuevo registro CSV (después de "ADD ") y omite espacios
-            const char *csv_line = line + 4;
-            // Saltar espacios iniciales
-            while (*csv_line == ' ')
-                csv_line++;
-
-            // 2. Extraer el ID inicial
-            char idbuf[32];
-            // Busca la primera coma para separar el ID del resto del registro
-            const char *comma = strchr(csv_line, ',');
-            // Si no hay coma, el formato es incorrecto: enviar error al cliente
-            if (!comma)
-            {
-                const char *msg = "ERR formato CSV inválido\n";
-                send(fd, msg, strlen(msg), 0);
-                continue;
-            }
-            // Copia el valor del ID (antes de la primera coma) en un buffer seguro
-            size_t len = comma - csv_line;
-            // Seguridad: limitar tamaño del ID
-            if (len >= sizeof(idbuf))
-                len = sizeof(idbuf) - 1;
-            // Establecer el ID como cadena
-            memcpy(idbuf, csv_line, len);
-            // Añadir terminador nulo
-            idbuf[len] = '\0';
-            // Convierte el ID a número entero (uint64_t) para indexarlo
-            uint64_t id = strtoull(idbuf, NULL, 10);
-
-            // 3. Verificar si el ID ya existe
-            uint64_t off_exist = 0;
-            // Busca en el índice si el ID ya está registrado; devuelve 1 si existe, 0 si no
-            int exists = find_offset(id, &off_exist);
-            // Si hubo error al leer el índice, notificar al cliente y abortar esta operación
-            if (exists < 0)
+            if (!admission_enter())
             {
-                const char *msg = "ERR index read error\n";
-                send(fd, msg, strlen(msg), 0);
+                reply_err(fd, "ERR BUSY\n");
                 continue;
             }
-            // Si el ID ya existe en el índice, enviar error de duplicado
-            if (exists > 0)
+            admitted = true;
+        }
+
+        // Si el comando comienza con 'ADD ', procesar la inserción de un nuevo registro
+        if (strncasecmp(line, "ADD ", 4) == 0)
+        {
+            int r = handle_add(fd, line);
+            if (st)
             {
-                const char *msg = "ERR ID duplicado\n";
-                send(fd, msg, strlen(msg), 0);
-                continue;
+                STAT_ADD(st->cmd_add, 1);
+                if (r == CMD_OK)
+                    STAT_ADD(st->add_ok, 1);
+                else
+                    STAT_ADD(st->cmd_errors, 1);
+                hist_record(&st->lat_add, now_ns() - t0);
             }
+        }
+        // 'UPDATE <csv>' y 'DEL <id>': corrección y borrado de un registro existente
+        else if (strncasecmp(line, "UPDATE ", 7) == 0 || strncasecmp(line, "DEL ", 4) == 0)
+        {
+            int r = line[0] == 'U' || line[0] == 'u' ? handle_update(fd, line) : handle_del(fd, line);
+            if (st && r == CMD_ERR)
+                STAT_ADD(st->cmd_errors, 1);
+        }
+        // 'GET <id>': búsqueda en el índice y respuesta con la ficha
+        else if (strncasecmp(line, "GET ", 4) == 0)
+        {
+            record_get(st, handle_get(fd, format, line), t0);
+        }
+        // 'MGET <id> <id>...': varios GET seguidos con una sola cabecera
+        else if (strncasecmp(line, "MGET ", 5) == 0)
+        {
+            handle_mget(fd, format, line);
+        }
+        // 'REBUILD': reconstrucción del índice en segundo plano
+        else if (strcasecmp(line, "REBUILD") == 0)
+        {
+            handle_rebuild(fd, false);
+        }
+        // 'VACUUM': CSV e índice sin filas reemplazadas ni borradas, en segundo plano
+        else if (strcasecmp(line, "VACUUM") == 0)
+        {
+            handle_rebuild(fd, true);
+        }
+        // 'STATS': métricas internas del servidor
+        else if (strcasecmp(line, "STATS") == 0)
+        {
+            handle_stats(fd);
+        }
+        // 'FORMAT card|csv|json': formato de las respuestas de GET en esta sesión
+        else if (strncasecmp(line, "FORMAT ", 7) == 0)
+        {
+            handle_format(fd, line, &format);
+        }
+        // 'SHM': la conexión pasa a atender GET/FORMAT por memoria compartida (socket Unix)
+        else if (strcasecmp(line, "SHM") == 0)
+        {
+            shm_session(fd, format);
+            break;
+        }
+        // Si el comando no es reconocido, enviar mensaje de error y continuar
+        else
+        {
+            const char *msg = "ERR expected: GET <id>, MGET <id>..., ADD <csv>, UPDATE <csv>, DEL <id>, "
+                              "FORMAT card|csv|json, STATS, REBUILD or VACUUM\n";
+            client_send(fd, msg, strlen(msg), 0);
+            if (st)
+                STAT_ADD(st->cmd_errors, 1);
+        }
+        if (admitted)
+            admission_leave();
+        // Todo lo que usó la respuesta vuelve de golpe a la arena del hilo
+        arena_reset();
+    }
+
+    free(line);
+    free(lr);
+    arena_destroy();
+    // Traspasa las métricas del hilo al acumulado global y libera su ranura de lector
+    stats_thread_exit();
+    hp_slot_release();
+    // Cierra el socket del cliente al finalizar la conexión
+    close(fd);
+    __atomic_sub_fetch(&g_conn_open, 1, __ATOMIC_RELAXED);
+    // Termina el hilo del cliente
+    return NULL;
+}
 
-            // 4. Escribir la nueva línea al final del CSV
+// ====== Aceptadores: sockets de escucha SO_REUSEPORT con afinidad de CPU ======
+// Con --acceptors=N se abren N sockets en el mismo puerto; el kernel reparte las conexiones
+// nuevas entre ellos (hash de la 4-tupla) y cada uno tiene su propio hilo de accept, así
+// una avalancha de conexiones no hace cola tras un único accept. Los hilos de conexión
+// heredan la afinidad del aceptador que los crea.
 
-            // Mueve el puntero al final del archivo CSV para agregar el nuevo registro
-            fseeko(g_csv, 0, SEEK_END);
-            // Obtiene el desplazamiento (offset) actual, para indexar este registro en el archivo
-            uint64_t offset = (uint64_t)ftello(g_csv);
-            // Escribe el nuevo registro CSV en el archivo con salto de línea final
-            fprintf(g_csv, "%s\n", csv_line);
-            // Fuerza la escritura inmediata al disco para mantener la coherencia del índice
-            fflush(g_csv);
+// Crea, enlaza y pone a escuchar un socket TCP en bind_ip:port; -1 si falla
+static int open_listener(const char *bind_ip, int port)
+{
+    // Crea el socket TCP (IPv4, tipo flujo)
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    // Si no se puede crear el socket, muestra error y termina
+    if (s < 0)
+    {
+        perror("socket");
+        return -1;
+    }
 
-            // 5. Insertar en el índice binario
+    // Permite reutilizar el puerto inmediatamente tras reiniciar el servidor
+    int opt = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    // Varios aceptadores: todos los sockets comparten puerto y el kernel reparte
+    if (g_opt.acceptors > 1 && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) != 0)
+    {
+        perror("SO_REUSEPORT");
+        close(s);
+        return -1;
+    }
 
-            // Inserta el nuevo par (ID, offset) en el índice binario; si falla, notificar error
-            if (insert_into_index(id, offset) != 0)
-            {
-                const char *msg = "ERR inserción en índice\n";
-                send(fd, msg, strlen(msg), 0);
-                continue;
-            }
+    // Estructura que define la dirección IP y puerto del servidor
+    struct sockaddr_in addr;
+    // Inicializa la estructura a cero para evitar valores residuales
+    memset(&addr, 0, sizeof(addr));
+    // Define la familia de direcciones: IPv4
+    addr.sin_family = AF_INET;
+    // Asigna el puerto del servidor y lo convierte al orden de bytes de red
+    addr.sin_port = htons((uint16_t)port);
+    // Convierte la IP en texto (ej. "127.0.0.1") a formato binario; valida dirección
+    if (inet_pton(AF_INET, bind_ip, &addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "IP inválida\n");
+        close(s);
+        return -1;
+    }
 
-            // 6. Confirmar al cliente
+    // Asocia el socket a la dirección y puerto especificados (bind)
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bind");
+        close(s);
+        return -1;
+    }
+    // Pone el socket en modo de escucha, con la cola de pendientes configurada (--backlog)
+    if (listen(s, g_opt.backlog) < 0)
+    {
+        perror("listen");
+        close(s);
+        return -1;
+    }
+    return s;
+}
 
-            // Envía confirmación al cliente de que el registro se insertó correctamente
-            const char *okmsg = "OK Registro agregado correctamente\n";
-            send(fd, okmsg, strlen(okmsg), 0);
-            continue;
-        }
-        // Si el comando no es 'GET' ni 'ADD', enviar mensaje de error y continuar
-        else if (strncasecmp(line, "GET ", 4) != 0)
+// Socket Unix de escucha en path (se borra uno anterior que haya quedado); -1 si falla
+static int open_unix_listener(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "--unix: ruta demasiado larga\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s < 0)
+    {
+        perror("socket unix");
+        return -1;
+    }
+    // Sólo se borra un socket que haya quedado de una ejecución anterior: una ruta mal escrita
+    // que apunte a un archivo normal no se toca
+    struct stat st;
+    if (lstat(path, &st) == 0)
+    {
+        if (!S_ISSOCK(st.st_mode))
         {
-            const char *msg = "ERR expected: GET <id> or ADD <csv>\n";
-            send(fd, msg, strlen(msg), 0);
-            send(fd, "\n", 1, 0);
-            continue;
+            fprintf(stderr, "--unix: %s existe y no es un socket\n", path);
+            close(s);
+            return -1;
         }
+        unlink(path);
+    }
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(s, g_opt.backlog) < 0)
+    {
+        perror("bind unix");
+        close(s);
+        return -1;
+    }
+    return s;
+}
 
-        // Salta la palabra 'GET ' y cualquier espacio extra antes del ID
-        char *p = line + 4;
-        while (*p == ' ')
-            p++;
-        // Si no hay ID después del comando GET, enviar error al cliente
-        if (*p == '\0')
+// Lee una lista de CPUs del kernel ("0-3,8-11") en set; devuelve cuántas hay
+static int parse_cpulist(const char *path, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+    int n = 0, a, b;
+    char sep;
+    while (fscanf(f, "%d", &a) == 1)
+    {
+        b = a;
+        if (fscanf(f, "%c", &sep) == 1 && sep == '-')
         {
-            const char *msg = "ERR missing id\n";
-            send(fd, msg, strlen(msg), 0);
-            continue;
+            if (fscanf(f, "%d", &b) != 1)
+                break;
+            if (fscanf(f, "%c", &sep) != 1)
+                sep = '\n';
         }
+        for (int c = a; c <= b && c < CPU_SETSIZE; ++c, ++n)
+            CPU_SET(c, set);
+        if (sep != ',')
+            break;
+    }
+    fclose(f);
+    return n;
+}
 
-        // Convierte el texto del ID a número entero (uint64_t), controlando errores
-        errno = 0;
-        char *endp = NULL;
-        uint64_t id = strtoull(p, &endp, 10);
-        // Si el ID no es numérico o excede el rango válido, notificar error al cliente
-        if (errno == ERANGE || endp == p)
+// Fija la afinidad del hilo actual según --pin para el aceptador idx
+static void acceptor_pin(int idx)
+{
+    g_acceptor_stats[idx].cpu = -1;
+    cpu_set_t allowed, set;
+    if (g_opt.pin == PIN_NONE || sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return;
+    CPU_ZERO(&set);
+    if (g_opt.pin == PIN_NODE)
+    {
+        int nodes = 0;
+        char path[96];
+        cpu_set_t tmp;
+        while (nodes < 1024)
         {
-            const char *msg = "ERR bad id\n";
-            send(fd, msg, strlen(msg), 0);
-            continue;
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nodes);
+            if (access(path, R_OK) != 0)
+                break;
+            nodes++;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nodes ? idx % nodes : 0);
+        if (nodes == 0 || parse_cpulist(path, &tmp) == 0)
+            return;
+        CPU_AND(&set, &tmp, &allowed);
+    }
+    else
+    {
+        // La (idx % nº permitidas)-ésima CPU de la afinidad del proceso
+        int count = CPU_COUNT(&allowed), want = idx % (count ? count : 1);
+        for (int c = 0; c < CPU_SETSIZE; ++c)
+            if (CPU_ISSET(c, &allowed) && want-- == 0)
+            {
+                CPU_SET(c, &set);
+                break;
+            }
+    }
+    if (CPU_COUNT(&set) == 0 || pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        return;
+    for (int c = 0; c < CPU_SETSIZE; ++c)
+        if (CPU_ISSET(c, &set))
+        {
+            g_acceptor_stats[idx].cpu = c;
+            break;
         }
+}
 
-        // Busca el ID en el índice binario; devuelve su desplazamiento en el CSV si existe
-        uint64_t off = 0;
-        int r = find_offset(id, &off);
-        // Si ocurre un error interno al leer el índice, informar al cliente
-        if (r < 0)
+// Bucle de accept de un aceptador: un hilo por conexión aceptada (idx < 0: socket Unix)
+static void accept_loop(int s, int idx)
+{
+    static bool busy_poll_warned = false;
+    // Bucle principal: acepta clientes hasta que se reciba SIGINT (Ctrl+C)
+    while (!g_stop)
+    {
+        // Estructura para guardar la dirección del cliente que se conecte (IPv4 o Unix)
+        struct sockaddr_storage cli;
+        socklen_t cl = sizeof(cli);
+        // Acepta una conexión entrante y devuelve un nuevo socket para el cliente
+        int cfd = accept(s, (struct sockaddr *)&cli, &cl);
+        // Maneja errores al aceptar conexiones; permite salir limpiamente con Ctrl+C
+        if (cfd < 0)
         {
-            const char *msg = "ERR internal\n";
-            send(fd, msg, strlen(msg), 0);
+            // Si la señal de interrupción fue recibida, sale del bucle
+            if (errno == EINTR && g_stop)
+                break;
+            // Si ocurre otro error, muestra el error y continúa aceptando nuevas conexiones
+            perror("accept");
             continue;
         }
-        // Si el ID no está en el índice, enviar mensaje 'NOTFOUND' al cliente
-        if (r == 0)
+        STAT_ADD(*(idx >= 0 ? &g_acceptor_stats[idx].accepted : &g_unix_accepted), 1);
+        // Por encima de --max-conns se rechaza al momento, sin crear hilo
+        if (__atomic_add_fetch(&g_conn_open, 1, __ATOMIC_RELAXED) > g_opt.max_conns && g_opt.max_conns > 0)
         {
-            const char *msg = "NOTFOUND\n";
-            send(fd, msg, strlen(msg), 0);
+            __atomic_sub_fetch(&g_conn_open, 1, __ATOMIC_RELAXED);
+            STAT_ADD(g_conn_rejected, 1);
+            send(cfd, "ERR BUSY\n", 9, MSG_NOSIGNAL | MSG_DONTWAIT);
+            close(cfd);
             continue;
         }
+        // Opciones por conexión: sin Nagle y sondeo activo del socket (menos latencia)
+        int one = 1;
+        if (g_opt.nodelay && idx >= 0)
+            setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (g_opt.busy_poll_us > 0 && idx >= 0 &&
+            setsockopt(cfd, SOL_SOCKET, SO_BUSY_POLL, &g_opt.busy_poll_us, sizeof(g_opt.busy_poll_us)) != 0 &&
+            !__atomic_exchange_n(&busy_poll_warned, true, __ATOMIC_RELAXED))
+            perror("SO_BUSY_POLL (requiere CAP_NET_ADMIN por encima de net.core.busy_read)");
+        // Hilo por cliente (simple y suficiente)
 
-        // Variables para almacenar la línea CSV leída desde el archivo
-        char *csv_line = NULL;
-        size_t csv_len = 0;
-        // Lee desde el archivo CSV la línea completa ubicada en el offset indicado
-        // Si ocurre un error de lectura, notificar al cliente
-        if (read_csv_line_at(off, &csv_line, &csv_len) != 0)
+        // Crea un nuevo hilo para manejar la conexión del cliente
+        pthread_t th;
+        // Reserva memoria para el contexto del cliente
+        ClientCtx *ctx = (ClientCtx *)malloc(sizeof(ClientCtx));
+        // Sin memoria o sin hilos: se descarta esta conexión y se sigue aceptando
+        if (!ctx)
         {
-            const char *msg = "ERR readcsv\n";
-            send(fd, msg, strlen(msg), 0);
+            __atomic_sub_fetch(&g_conn_open, 1, __ATOMIC_RELAXED);
+            close(cfd);
             continue;
         }
-
-        // Respuesta: "OK <nbytes>\n<linea>"
-        // Genera una ficha legible a partir de la línea CSV y libera la memoria original
-        char *ficha = format_record(csv_line);
-        free(csv_line);
-
-        // Si falló el formateo de la línea CSV, enviar error al cliente
-        if (!ficha)
+        // Asigna el descriptor de archivo del socket del cliente al contexto
+        ctx->fd = cfd;
+        // Crea el hilo que ejecutará la función client_thread con el contexto del cliente
+        if (pthread_create(&th, NULL, client_thread, ctx) != 0)
         {
-            const char *msg = "ERR format\n";
-            send(fd, msg, strlen(msg), 0);
+            perror("pthread_create");
+            free(ctx);
+            __atomic_sub_fetch(&g_conn_open, 1, __ATOMIC_RELAXED);
+            close(cfd);
             continue;
         }
-
-        // Envía al cliente la ficha final del registro y libera la memoria usada
-        send(fd, ficha, strlen(ficha), 0);
-        free(ficha);
+        // Desvincula el hilo para que sus recursos se liberen automáticamente al terminar
+        pthread_detach(th);
     }
+}
 
-    // Cierra el socket del cliente al finalizar la conexión
-    close(fd);
-    // Termina el hilo del cliente
+typedef struct
+{
+    int fd;
+    int idx;
+} AcceptorCtx;
+
+static void *acceptor_thread(void *arg)
+{
+    AcceptorCtx a = *(AcceptorCtx *)arg;
+    free(arg);
+    if (a.idx >= 0)
+        acceptor_pin(a.idx);
+    accept_loop(a.fd, a.idx);
+    close(a.fd);
     return NULL;
 }
 
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Uso: %s <bind_ip> <port> <books.idx> <books_validos.csv> [opciones]\n"
+            "Opciones:\n"
+            "  --metrics-port=N   expone métricas Prometheus en 127.0.0.1:N\n"
+            "  --hot-file=RUTA    conjunto caliente persistido (<books.idx>.hot)\n"
+            "  --hot-interval=S   segundos entre guardados del conjunto caliente (60, 0 = no guardar)\n"
+            "  --warm-rate=MB     MB/s máximos de precalentamiento al arrancar (64)\n"
+            "  --io=sync|uring    lecturas de GET con pread bloqueante o con un anillo io_uring (sync)\n"
+            "  --uring-depth=N    entradas del anillo io_uring (256)\n"
+            "  --repl-listen=N    sirve el flujo de replicación a réplicas en <IP>:N\n"
+            "  --follow=IP:PUERTO réplica de sólo lectura que sigue al primario en IP:PUERTO\n"
+            "  --blocks=RUTA      filas empaquetadas por pack_store (books.blk)\n"
+            "  --block-cache-mb=N MB de bloques descomprimidos en caché (64)\n"
+            "  --acceptors=N      N sockets SO_REUSEPORT con su propio hilo de accept (1)\n"
+            "  --backlog=N        cola de conexiones pendientes por socket (64)\n"
+            "  --pin=core|node    fija cada aceptador y sus conexiones a una CPU o nodo NUMA\n"
+            "  --nodelay          TCP_NODELAY en las conexiones aceptadas\n"
+            "  --busy-poll=US     SO_BUSY_POLL en las conexiones aceptadas (microsegundos)\n"
+            "  --verify-buckets   comprueba el CRC32C de cada bucket la primera vez que se lee (índices v2)\n"
+            "  --max-conns=N      conexiones abiertas a la vez; el resto recibe ERR BUSY (0 = sin límite)\n"
+            "  --idle-timeout=S   cierra conexiones sin comandos durante S segundos (0 = nunca)\n"
+            "  --read-timeout=S   tope para recibir un comando empezado o enviar una respuesta (0 = sin tope)\n"
+            "  --max-inflight=N   GET/MGET/ADD ejecutándose a la vez (0 = sin control de admisión)\n"
+            "  --max-queue=N      peticiones esperando turno antes de rechazar con ERR BUSY (256)\n"
+            "  --queue-timeout-ms=M espera máxima por un turno antes de ERR BUSY (50)\n"
+            "  --unix=RUTA        escucha también en un socket Unix (clientes locales y sesiones SHM)\n"
+            "  --dense-min=F      ocupación mínima de la tabla densa que genera REBUILD (0.5; 0 = no usarla)\n",
+            prog);
+}
+
 // ====== Main: servidor TCP ======
 int main(int argc, char **argv)
 {
@@ -491,7 +4733,7 @@ int main(int argc, char **argv)
     if (argc < 5)
     {
         // Muestra mensaje de uso correcto si faltan argumentos
-        fprintf(stderr, "Uso: %s <bind_ip> <port> <books.idx> <books_validos.csv>\n", argv[0]);
+        usage(argv[0]);
         // Finaliza el programa indicando error de ejecución
         return EXIT_FAILURE;
     }
@@ -504,15 +4746,104 @@ int main(int argc, char **argv)
     const char *idx_path = argv[3];
     const char *csv_path = argv[4];
 
+    // Opciones adicionales con formato --clave=valor
+    for (int i = 5; i < argc; ++i)
+    {
+        if (strncmp(argv[i], "--metrics-port=", 15) == 0)
+            g_opt.metrics_port = atoi(argv[i] + 15);
+        else if (strcmp(argv[i], "--io=uring") == 0)
+            g_opt.io_uring = true;
+        else if (strcmp(argv[i], "--io=sync") == 0)
+            g_opt.io_uring = false;
+        else if (strncmp(argv[i], "--uring-depth=", 14) == 0)
+            g_opt.uring_depth = (unsigned)atoi(argv[i] + 14);
+        else if (strncmp(argv[i], "--repl-listen=", 14) == 0)
+            g_opt.repl_port = atoi(argv[i] + 14);
+        else if (strncmp(argv[i], "--follow=", 9) == 0 && strchr(argv[i] + 9, ':'))
+            g_opt.follow = argv[i] + 9;
+        else if (strncmp(argv[i], "--hot-file=", 11) == 0)
+            g_opt.hot_file = argv[i] + 11;
+        else if (strncmp(argv[i], "--hot-interval=", 15) == 0)
+            g_opt.hot_interval = atoi(argv[i] + 15);
+        else if (strncmp(argv[i], "--warm-rate=", 12) == 0)
+            g_opt.warm_rate_mb = atof(argv[i] + 12);
+        else if (strncmp(argv[i], "--blocks=", 9) == 0)
+            g_opt.blocks = argv[i] + 9;
+        else if (strncmp(argv[i], "--block-cache-mb=", 17) == 0)
+            g_opt.block_cache_mb = (unsigned)atoi(argv[i] + 17);
+        else if (strncmp(argv[i], "--acceptors=", 12) == 0)
+            g_opt.acceptors = atoi(argv[i] + 12);
+        else if (strncmp(argv[i], "--backlog=", 10) == 0)
+            g_opt.backlog = atoi(argv[i] + 10);
+        else if (strcmp(argv[i], "--pin=core") == 0)
+            g_opt.pin = PIN_CORE;
+        else if (strcmp(argv[i], "--pin=node") == 0)
+            g_opt.pin = PIN_NODE;
+        else if (strcmp(argv[i], "--nodelay") == 0)
+            g_opt.nodelay = true;
+        else if (strncmp(argv[i], "--busy-poll=", 12) == 0)
+            g_opt.busy_poll_us = atoi(argv[i] + 12);
+        else if (strcmp(argv[i], "--verify-buckets") == 0)
+            g_opt.verify_buckets = true;
+        else if (strncmp(argv[i], "--max-conns=", 12) == 0)
+            g_opt.max_conns = atoi(argv[i] + 12);
+        else if (strncmp(argv[i], "--idle-timeout=", 15) == 0)
+            g_opt.idle_timeout_s = atoi(argv[i] + 15);
+        else if (strncmp(argv[i], "--read-timeout=", 15) == 0)
+            g_opt.read_timeout_s = atoi(argv[i] + 15);
+        else if (strncmp(argv[i], "--max-inflight=", 15) == 0)
+            g_opt.max_inflight = atoi(argv[i] + 15);
+        else if (strncmp(argv[i], "--max-queue=", 12) == 0)
+            g_opt.max_queue = atoi(argv[i] + 12);
+        else if (strncmp(argv[i], "--queue-timeout-ms=", 19) == 0)
+            g_opt.queue_timeout_ms = atoi(argv[i] + 19);
+        else if (strncmp(argv[i], "--dense-min=", 12) == 0)
+            g_opt.dense_min = atof(argv[i] + 12);
+        else if (strncmp(argv[i], "--unix=", 7) == 0 && argv[i][7])
+            g_opt.unix_path = argv[i] + 7;
+        else
+        {
+            fprintf(stderr, "Opción desconocida: %s\n", argv[i]);
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (g_opt.acceptors < 1 || g_opt.acceptors > MAX_ACCEPTORS || g_opt.backlog < 1)
+    {
+        fprintf(stderr, "--acceptors debe estar entre 1 y %d y --backlog ser positivo\n", MAX_ACCEPTORS);
+        return EXIT_FAILURE;
+    }
+    if (g_opt.max_conns < 0 || g_opt.idle_timeout_s < 0 || g_opt.read_timeout_s < 0 || g_opt.max_inflight < 0 ||
+        g_opt.max_queue < 0 || g_opt.queue_timeout_ms < 0)
+    {
+        fprintf(stderr, "Los límites y timeouts no pueden ser negativos\n");
+        return EXIT_FAILURE;
+    }
+    admission_init();
+    clock_gettime(CLOCK_MONOTONIC, &g_start_ts);
+
     // Captura SIGINT (Ctrl+C) para cerrar el servidor limpiamente mediante handle_sigint()
     signal(SIGINT, handle_sigint);
 
     // Abrir índice y CSV
 
+    // Vista inicial del índice (generación 0); REBUILD la reemplaza en caliente
+    IndexView *view = (IndexView *)calloc(1, sizeof(IndexView));
+    if (!view)
+    {
+        perror("malloc view");
+        return EXIT_FAILURE;
+    }
+    g_idx_path = idx_path;
+    g_csv_path = csv_path;
+    // Un VACUUM interrumpido entre el cambio del CSV y el del índice se completa aquí
+    if (swap_finish() != 0)
+        return EXIT_FAILURE;
+
     // Abre el archivo de índice binario (.idx) en modo lectura/escritura ("r+b")
-    g_idx = fopen(idx_path, "r+b"); // lectura/escritura binaria
+    view->idx = fopen(idx_path, "r+b"); // lectura/escritura binaria
     // Si no se puede abrir el índice, muestra error y termina el programa
-    if (!g_idx)
+    if (!view->idx)
     {
         perror("open idx");
         return EXIT_FAILURE;
@@ -530,14 +4861,15 @@ int main(int argc, char **argv)
     // Leer header
 
     // Lee el encabezado (header) del archivo de índice binario
-    if (fread(&g_hdr, sizeof(g_hdr), 1, g_idx) != 1)
+    if (fread(&view->hdr, sizeof(view->hdr), 1, view->idx) != 1)
     {
         // Si la lectura del header falla, muestra error y detiene el servidor
         perror("read header");
         return EXIT_FAILURE;
     }
-    // Verifica que la firma "BKIDXv01" y el tamaño de tabla (1000) sean válidos
-    if (memcmp(g_hdr.magic, "BKIDXv01", 8) != 0 || g_hdr.table_size != 1000)
+    // Verifica la firma ("BKIDXv01" o "BKIDXv02", con checksums) y el tamaño de tabla (1000)
+    int idx_ver = idx_version(view->hdr.magic);
+    if (idx_ver == 0 || view->hdr.table_size != TABLE_SIZE)
     {
         // Si el índice no cumple el formato esperado, avisa y termina
         fprintf(stderr, "Índice inválido o versión incompatible\n");
@@ -547,103 +4879,155 @@ int main(int argc, char **argv)
     // Leer directorio completo en RAM (~16 KB)
 
     // Reserva memoria para el directorio de buckets (1000 entradas típicamente)
-    g_dir = (DirEntry *)malloc(sizeof(DirEntry) * g_hdr.table_size);
+    view->dir = (DirEntry *)malloc(sizeof(DirEntry) * view->hdr.table_size);
+    view->dir_seq = (unsigned *)calloc(view->hdr.table_size, sizeof(unsigned));
+    view->verified = (unsigned char *)calloc(view->hdr.table_size, 1);
+    view->bucket_crc = idx_ver == 2 ? (uint32_t *)malloc(IDX_CRC_BYTES(TABLE_SIZE)) : NULL;
     // Si falla la reserva de memoria, muestra error y termina
-    if (!g_dir)
+    if (!view->dir || !view->dir_seq || !view->verified || (idx_ver == 2 && !view->bucket_crc))
     {
         perror("malloc dir");
         return EXIT_FAILURE;
     }
     // Lee desde el índice el directorio completo de buckets a memoria
-    if (fread(g_dir, sizeof(DirEntry), (size_t)g_hdr.table_size, g_idx) != (size_t)g_hdr.table_size)
+    if (fread(view->dir, sizeof(DirEntry), (size_t)view->hdr.table_size, view->idx) != (size_t)view->hdr.table_size)
     {
         // Si ocurre un error al leer el directorio, muestra error y finaliza
         perror("read dir");
         return EXIT_FAILURE;
     }
+    // v2: tabla de checksums; el CRC de la cabecera cubre header, directorio y CRC de buckets.
+    // Si no coincide (p. ej. un ADD interrumpido) se avisa y se sigue: idx_verify dice qué falla
+    if (view->bucket_crc)
+    {
+        if (fread(view->bucket_crc, 1, IDX_CRC_BYTES(TABLE_SIZE), view->idx) != IDX_CRC_BYTES(TABLE_SIZE))
+        {
+            perror("read crc");
+            return EXIT_FAILURE;
+        }
+        g_idx_header_crc = idx_header_crc(&view->hdr, sizeof(Header), view->dir, TABLE_SIZE * sizeof(DirEntry),
+                                          view->bucket_crc, TABLE_SIZE) == view->bucket_crc[TABLE_SIZE];
+        if (!g_idx_header_crc)
+            fprintf(stderr, "AVISO: el CRC32C de la cabecera de %s no coincide; ejecute idx_verify\n", idx_path);
+    }
+    // Ningún bucket puede apuntar fuera del archivo
+    fseeko(view->idx, 0, SEEK_END);
+    uint64_t idx_size = (uint64_t)ftello(view->idx);
+    for (unsigned b = 0; b < TABLE_SIZE; ++b)
+        if (view->dir[b].bucket_count > idx_size / sizeof(Pair) ||
+            view->dir[b].bucket_offset + view->dir[b].bucket_count * sizeof(Pair) > idx_size)
+        {
+            fprintf(stderr, "Índice inválido: el bucket %u sale del archivo\n", b);
+            return EXIT_FAILURE;
+        }
+    view->csv_fd = fileno(g_csv);
+    g_view = view;
+
+    // Almacén de filas comprimido (opcional): directorio de bloques y diccionario en RAM
+    if (g_opt.blocks)
+    {
+        if (blk_open(g_opt.blocks) != 0)
+        {
+            perror("open blocks");
+            return EXIT_FAILURE;
+        }
+        fprintf(stderr, "Bloques: %" PRIu64 " filas en %" PRIu64 " bloques, caché %u MB\n", g_blk_hdr.rows,
+                g_blk_hdr.block_count, g_opt.block_cache_mb);
+    }
 
     // Socket listen
 
-    // Crea el socket TCP principal (IPv4, tipo flujo)
-    int s = socket(AF_INET, SOCK_STREAM, 0);
-    // Si no se puede crear el socket, muestra error y termina
+    // Socket de escucha del aceptador 0 (con SO_REUSEPORT si hay más aceptadores)
+    int s = open_listener(bind_ip, port);
     if (s < 0)
-    {
-        perror("socket");
         return EXIT_FAILURE;
-    }
 
-    // Permite reutilizar el puerto inmediatamente tras reiniciar el servidor
-    int opt = 1;
-    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    // Endpoint opcional de métricas en formato Prometheus (sólo 127.0.0.1)
+    if (g_opt.metrics_port > 0 && start_metrics_endpoint(g_opt.metrics_port) == 0)
+        fprintf(stderr, "Métricas Prometheus en 127.0.0.1:%d\n", g_opt.metrics_port);
 
-    // Estructura que define la dirección IP y puerto del servidor
-    struct sockaddr_in addr;
-    // Inicializa la estructura a cero para evitar valores residuales
-    memset(&addr, 0, sizeof(addr));
-    // Define la familia de direcciones: IPv4
-    addr.sin_family = AF_INET;
-    // Asigna el puerto del servidor y lo convierte al orden de bytes de red
-    addr.sin_port = htons((uint16_t)port);
-    // Convierte la IP en texto (ej. "127.0.0.1") a formato binario; valida dirección
-    if (inet_pton(AF_INET, bind_ip, &addr.sin_addr) != 1)
-    {
-        fprintf(stderr, "IP inválida\n");
-        return EXIT_FAILURE;
-    }
+    // Precalentamiento en segundo plano del conjunto caliente guardado y guardado periódico
+    if (g_opt.warm_rate_mb <= 0.0)
+        g_opt.warm_rate_mb = 64.0;
+    fseeko(g_csv, 0, SEEK_END);
+    g_csv_committed = (uint64_t)ftello(g_csv);
+    // Tabla densa de ids, si build_index la generó para este mismo CSV
+    dense_attach(view, idx_path, g_csv_committed);
+    if (view->dense)
+        fprintf(stderr, "Tabla densa: %" PRIu64 " de %" PRIu64 " ranuras desde id %" PRIu64 "\n", view->dense->count,
+                view->dense->slots, view->dense->min_id);
+    load_csv_columns();
+    hot_start(idx_path, g_csv_committed);
 
-    // Asocia el socket a la dirección y puerto especificados (bind)
-    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    // Replicación: puerto para réplicas y/o sesión con el primario
+    if (g_opt.repl_port > 0 && start_repl_listener(bind_ip, g_opt.repl_port) == 0)
+        fprintf(stderr, "Flujo de replicación en %s:%d\n", bind_ip, g_opt.repl_port);
+    if (g_opt.follow)
     {
-        perror("bind");
-        return EXIT_FAILURE;
+        pthread_t th;
+        if (pthread_create(&th, NULL, repl_follow_thread, NULL) == 0)
+            pthread_detach(th);
     }
-    // Pone el socket en modo de escucha, con cola máxima de 64 conexiones pendientes
-    if (listen(s, 64) < 0)
+
+    // Backend io_uring opcional; si el kernel no lo ofrece se sigue con pread
+    if (g_opt.io_uring && (g_opt.uring_depth == 0 || uring_start() != 0))
     {
-        perror("listen");
-        return EXIT_FAILURE;
+        perror("io_uring no disponible, se usa pread");
+        g_opt.io_uring = false;
     }
 
     // Mensaje informativo: confirma IP, puerto y total de registros indexados
-    fprintf(stderr, "Servidor listo en %s:%d | total=%" PRIu64 " entradas\n", bind_ip, port, g_hdr.total_entries);
+    fprintf(stderr, "Servidor listo en %s:%d | total=%" PRIu64 " entradas | aceptadores=%d\n", bind_ip, port,
+            view->hdr.total_entries, g_opt.acceptors);
 
-    // Bucle principal: acepta clientes hasta que se reciba SIGINT (Ctrl+C)
-    while (!g_stop)
+    // Aceptadores extra: cada uno con su socket en el mismo puerto y su hilo de accept
+    for (int i = 1; i < g_opt.acceptors; ++i)
     {
-        // Estructura para guardar la dirección del cliente que se conecte
-        struct sockaddr_in cli;
-        socklen_t cl = sizeof(cli);
-        // Acepta una conexión entrante y devuelve un nuevo socket para el cliente
-        int cfd = accept(s, (struct sockaddr *)&cli, &cl);
-        // Maneja errores al aceptar conexiones; permite salir limpiamente con Ctrl+C
-        if (cfd < 0)
+        AcceptorCtx *a = (AcceptorCtx *)malloc(sizeof(AcceptorCtx));
+        pthread_t th;
+        if (!a || (a->fd = open_listener(bind_ip, port)) < 0)
+            return EXIT_FAILURE;
+        a->idx = i;
+        if (pthread_create(&th, NULL, acceptor_thread, a) != 0)
         {
-            // Si la señal de interrupción fue recibida, sale del bucle
-            if (errno == EINTR && g_stop)
-                break;
-            // Si ocurre otro error, muestra el error y continúa aceptando nuevas conexiones
-            perror("accept");
-            continue;
+            perror("pthread_create acceptor");
+            return EXIT_FAILURE;
         }
-        // Hilo por cliente (simple y suficiente)
+        pthread_detach(th);
+    }
 
-        // Crea un nuevo hilo para manejar la conexión del cliente
+    // Socket Unix opcional: mismo protocolo sin la pila TCP, y la puerta a las sesiones SHM
+    if (g_opt.unix_path)
+    {
+        AcceptorCtx *a = (AcceptorCtx *)malloc(sizeof(AcceptorCtx));
         pthread_t th;
-        // Reserva memoria para el contexto del cliente
-        ClientCtx *ctx = (ClientCtx *)malloc(sizeof(ClientCtx));
-        // Asigna el descriptor de archivo del socket del cliente al contexto
-        ctx->fd = cfd;
-        // Crea el hilo que ejecutará la función client_thread con el contexto del cliente
-        pthread_create(&th, NULL, client_thread, ctx);
-        // Desvincula el hilo para que sus recursos se liberen automáticamente al terminar
+        if (!a || (a->fd = open_unix_listener(g_opt.unix_path)) < 0)
+            return EXIT_FAILURE;
+        a->idx = -1;
+        if (pthread_create(&th, NULL, acceptor_thread, a) != 0)
+        {
+            perror("pthread_create unix");
+            return EXIT_FAILURE;
+        }
         pthread_detach(th);
+        fprintf(stderr, "Socket Unix en %s\n", g_opt.unix_path);
     }
 
+    // El hilo principal es el aceptador 0
+    acceptor_pin(0);
+    accept_loop(s, 0);
+
     // Limpieza y cierre del servidor
     close(s);
-    free(g_dir);
-    fclose(g_idx);
+    if (g_opt.unix_path)
+        unlink(g_opt.unix_path);
+    free(g_view->dir);
+    free(g_view->dir_seq);
+    free(g_view->bucket_crc);
+    free(g_view->verified);
+    if (g_view->dense)
+        munmap(g_view->dense, g_view->dense_bytes);
+    fclose(g_view->idx);
     fclose(g_csv);
     fprintf(stderr, "Servidor cerrado.\n");
     return 0;
@@ -0,0 +1,394 @@
+// ====== Transporte por memoria compartida para clientes en la misma máquina ======
+// Compartido por idx_server (lado servidor de los anillos) y los clientes (biblioteca).
+//
+// Protocolo:
+//   1. El cliente se conecta al socket Unix del servidor (--unix=RUTA) y envía "SHM\n".
+//   2. El servidor crea una región con memfd, responde "OK SHM <bytes>\n" y pasa el
+//      descriptor con SCM_RIGHTS. Ambos la mapean; el socket queda abierto sólo para que
+//      el servidor note si el cliente muere.
+//   3. Peticiones y respuestas viajan como mensajes [uint32 len][bytes] por dos anillos de un
+//      solo productor y un solo consumidor (cliente->servidor y servidor->cliente), sin locks.
+//      Quien espera gira un momento y después duerme con futex sobre la posición del otro
+//      lado; el que publica sólo llama a FUTEX_WAKE si hay alguien dormido, así que con
+//      ambos lados activos una consulta no hace ninguna llamada al sistema.
+//   4. Todo lo que hay en la región lo puede escribir el otro proceso. Por eso cada lado
+//      guarda en su propia memoria (ShmPort) la geometría de cada anillo y la posición que le
+//      toca avanzar, y sólo lee de la región la posición del otro lado, que comprueba antes
+//      de copiar nada: un cliente defectuoso no puede hacer que el servidor copie fuera de la
+//      región.
+//
+// Comandos: GET <id> y FORMAT card|csv|json, con las mismas respuestas que por TCP; una
+// respuesta por petición y en orden, así que se pueden encadenar varias (idx_shm_send) y
+// recoger después (idx_shm_recv).
+//
+// Uso desde un cliente:
+//   IdxShm *c = idx_shm_connect("/tmp/idx.sock");
+//   char buf[IDX_SHM_MAX_REPLY];
+//   ssize_t n = idx_shm_call(c, "GET 42", buf, sizeof(buf));
+//   idx_shm_close(c);
+#ifndef IDX_SHM_H
+#define IDX_SHM_H
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SHM_MAGIC "BKSHMv01"
+#define SHM_REQ_BYTES (64u << 10)     // anillo de peticiones (potencia de 2)
+#define SHM_RESP_BYTES (1u << 20)     // anillo de respuestas: cabe la fila más larga (128 KB)
+#define SHM_SPIN 2000                 // vueltas de espera activa antes de dormir (con >1 CPU)
+#define IDX_SHM_MAX_REPLY (256u << 10) // buffer recomendado para idx_shm_recv
+
+// Un anillo: posiciones en bytes que sólo crecen (módulo 2^32); cada una en su línea de caché
+typedef struct
+{
+    uint32_t head;         // bytes publicados por el productor
+    uint32_t head_waiters; // el consumidor duerme en FUTEX_WAIT(&head)
+    char pad0[56];
+    uint32_t tail;         // bytes liberados por el consumidor
+    uint32_t tail_waiters; // el productor duerme en FUTEX_WAIT(&tail) esperando espacio
+    char pad1[56];
+    uint32_t size;     // capacidad de los datos (potencia de 2); sólo informativo
+    uint32_t data_off; // posición de los datos desde el inicio de la región; sólo informativo
+    char pad2[56];
+} ShmRing;
+
+// Un extremo de un anillo en memoria privada: la geometría fijada al negociar la región y la
+// posición propia (head si se produce, tail si se consume), que no se vuelven a leer de ella
+typedef struct
+{
+    ShmRing *q;    // posiciones compartidas del anillo
+    uint8_t *data; // datos del anillo dentro de la región
+    uint32_t size; // capacidad (potencia de 2)
+    uint32_t pos;  // posición que sólo avanza este lado
+} ShmPort;
+
+typedef struct
+{
+    char magic[8];   // "BKSHMv01"
+    uint32_t closed; // 1 cuando uno de los lados cierra
+    uint32_t reserved;
+    char pad[48];
+    ShmRing req;  // cliente -> servidor
+    ShmRing resp; // servidor -> cliente
+} ShmRegion;
+
+static inline size_t shm_region_bytes(void)
+{
+    return sizeof(ShmRegion) + SHM_REQ_BYTES + SHM_RESP_BYTES;
+}
+
+// Prepara una región recién creada (lado servidor)
+static inline void shm_region_init(ShmRegion *r)
+{
+    memset(r, 0, sizeof(*r));
+    memcpy(r->magic, SHM_MAGIC, 8);
+    r->req.size = SHM_REQ_BYTES;
+    r->req.data_off = (uint32_t)sizeof(ShmRegion);
+    r->resp.size = SHM_RESP_BYTES;
+    r->resp.data_off = (uint32_t)(sizeof(ShmRegion) + SHM_REQ_BYTES);
+}
+
+// Extremo de un anillo con la geometría dada (el servidor la toma de sus constantes, el
+// cliente de la región tras comprobar que cabe en lo mapeado)
+static inline ShmPort shm_port(ShmRegion *r, ShmRing *q, uint32_t data_off, uint32_t size)
+{
+    ShmPort p = {q, (uint8_t *)r + data_off, size, 0};
+    return p;
+}
+
+// Futex compartido entre procesos (sin FUTEX_PRIVATE_FLAG: la región es MAP_SHARED)
+static inline long shm_futex(uint32_t *addr, int op, uint32_t val, const struct timespec *ts)
+{
+    return syscall(SYS_futex, addr, op, val, ts, NULL, 0);
+}
+
+static inline void shm_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// Vueltas de espera activa: con una sola CPU el otro lado no puede avanzar mientras se gira
+static inline int shm_spin_count(void)
+{
+    static int spin = -1;
+    int n = __atomic_load_n(&spin, __ATOMIC_RELAXED);
+    if (n < 0)
+    {
+        n = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN : 0;
+        __atomic_store_n(&spin, n, __ATOMIC_RELAXED);
+    }
+    return n;
+}
+
+// Espera a que *pos deje de valer seen; 0 si cambió, -1 si la región se cerró, -3 si venció
+// timeout_ms (< 0 = sin tope). waiters es el indicador que el otro lado mira antes de despertar.
+static inline int shm_wait(ShmRegion *r, uint32_t *pos, uint32_t *waiters, uint32_t seen, int timeout_ms)
+{
+    for (int i = 0, spin = shm_spin_count(); i < spin; ++i)
+    {
+        if (__atomic_load_n(pos, __ATOMIC_ACQUIRE) != seen)
+            return 0;
+        shm_cpu_relax();
+    }
+    struct timespec ts = {timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000L};
+    for (;;)
+    {
+        if (__atomic_load_n(&r->closed, __ATOMIC_ACQUIRE))
+            return -1;
+        __atomic_store_n(waiters, 1, __ATOMIC_SEQ_CST);
+        // Se vuelve a mirar tras anunciarse: un publicador que no vio el indicador ya cambió pos
+        if (__atomic_load_n(pos, __ATOMIC_SEQ_CST) != seen)
+        {
+            __atomic_store_n(waiters, 0, __ATOMIC_RELAXED);
+            return 0;
+        }
+        long rc = shm_futex(pos, FUTEX_WAIT, seen, timeout_ms < 0 ? NULL : &ts);
+        __atomic_store_n(waiters, 0, __ATOMIC_RELAXED);
+        if (__atomic_load_n(pos, __ATOMIC_ACQUIRE) != seen)
+            return 0;
+        if (rc != 0 && errno == ETIMEDOUT)
+            return -3;
+    }
+}
+
+// Publica pos y despierta al otro lado sólo si está dormido
+static inline void shm_publish(uint32_t *pos, uint32_t *waiters, uint32_t value)
+{
+    __atomic_store_n(pos, value, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiters, __ATOMIC_SEQ_CST))
+        shm_futex(pos, FUTEX_WAKE, 1, NULL);
+}
+
+// Copia n bytes (n <= size) a/desde el anillo a partir de la posición lógica at (da la
+// vuelta si hace falta); sólo usa la geometría privada del extremo
+static inline void shm_copy_in(const ShmPort *p, uint32_t at, const void *src, size_t n)
+{
+    uint32_t o = at & (p->size - 1);
+    size_t first = n < p->size - o ? n : p->size - o;
+    memcpy(p->data + o, src, first);
+    memcpy(p->data, (const uint8_t *)src + first, n - first);
+}
+
+static inline void shm_copy_out(const ShmPort *p, uint32_t at, void *dst, size_t n)
+{
+    uint32_t o = at & (p->size - 1);
+    size_t first = n < p->size - o ? n : p->size - o;
+    memcpy(dst, p->data + o, first);
+    memcpy((uint8_t *)dst + first, p->data, n - first);
+}
+
+// Encola un mensaje formado por iov[0..niov). 0 si se publicó, -1 si la región se cerró o
+// el otro lado dejó una posición imposible, -2 si el mensaje no cabe en el anillo y -3 si no
+// hubo espacio en timeout_ms.
+static inline int shm_push(ShmRegion *r, ShmPort *p, const struct iovec *iov, int niov, int timeout_ms)
+{
+    size_t len = 0;
+    for (int i = 0; i < niov; ++i)
+        len += iov[i].iov_len;
+    if (len > p->size - 4)
+        return -2;
+    uint32_t need = (uint32_t)((4 + len + 3) & ~(size_t)3);
+    if (need > p->size)
+        return -2;
+    uint32_t head = p->pos;
+    for (;;)
+    {
+        uint32_t tail = __atomic_load_n(&p->q->tail, __ATOMIC_ACQUIRE);
+        if (head - tail > p->size)
+            return -1;
+        if (p->size - (head - tail) >= need)
+            break;
+        int w = shm_wait(r, &p->q->tail, &p->q->tail_waiters, tail, timeout_ms);
+        if (w != 0)
+            return w;
+    }
+    uint32_t len32 = (uint32_t)len, at = head + 4;
+    shm_copy_in(p, head, &len32, 4);
+    for (int i = 0; i < niov; ++i)
+    {
+        shm_copy_in(p, at, iov[i].iov_base, iov[i].iov_len);
+        at += (uint32_t)iov[i].iov_len;
+    }
+    p->pos = head + need;
+    shm_publish(&p->q->head, &p->q->head_waiters, p->pos);
+    return 0;
+}
+
+// Saca el siguiente mensaje a out (sin terminador). Devuelve su longitud, -1 si la región se
+// cerró o el otro lado publicó algo imposible, -2 si no cabía en cap (se descarta) y -3 si no
+// llegó nada en timeout_ms.
+static inline ssize_t shm_pop(ShmRegion *r, ShmPort *p, void *out, size_t cap, int timeout_ms)
+{
+    uint32_t tail = p->pos;
+    uint32_t head = __atomic_load_n(&p->q->head, __ATOMIC_ACQUIRE);
+    if (head == tail)
+    {
+        int w = shm_wait(r, &p->q->head, &p->q->head_waiters, tail, timeout_ms);
+        if (w != 0)
+            return w;
+        head = __atomic_load_n(&p->q->head, __ATOMIC_ACQUIRE);
+    }
+    // Lo publicado tiene que caber en el anillo y contener el mensaje entero
+    uint32_t avail = head - tail;
+    if (avail > p->size || avail < 4)
+        return -1;
+    uint32_t len;
+    shm_copy_out(p, tail, &len, 4);
+    uint64_t need = ((uint64_t)4 + len + 3) & ~(uint64_t)3;
+    if (need > avail)
+        return -1;
+    ssize_t rc = (ssize_t)len;
+    if (len > cap)
+        rc = -2;
+    else
+        shm_copy_out(p, tail + 4, out, len);
+    p->pos = tail + (uint32_t)need;
+    shm_publish(&p->q->tail, &p->q->tail_waiters, p->pos);
+    return rc;
+}
+
+// Marca la región como cerrada y despierta a quien esté dormido en cualquiera de los anillos
+static inline void shm_region_close(ShmRegion *r)
+{
+    __atomic_store_n(&r->closed, 1, __ATOMIC_SEQ_CST);
+    shm_futex(&r->req.head, FUTEX_WAKE, 1, NULL);
+    shm_futex(&r->req.tail, FUTEX_WAKE, 1, NULL);
+    shm_futex(&r->resp.head, FUTEX_WAKE, 1, NULL);
+    shm_futex(&r->resp.tail, FUTEX_WAKE, 1, NULL);
+}
+
+// ====== Biblioteca de cliente ======
+// Un anillo anunciado por el servidor es usable si su tamaño es potencia de 2 y sus datos
+// caben en los bytes mapeados sin pisar la cabecera
+static inline int shm_ring_fits(const ShmRing *q, size_t bytes)
+{
+    return q->size >= 8 && (q->size & (q->size - 1)) == 0 && q->data_off >= sizeof(ShmRegion) &&
+           (uint64_t)q->data_off + q->size <= bytes;
+}
+
+typedef struct
+{
+    int sock;     // conexión Unix con el servidor (sólo para detectar cierre)
+    ShmRegion *r; // región compartida mapeada
+    size_t bytes;
+    ShmPort req;  // este lado produce
+    ShmPort resp; // este lado consume
+} IdxShm;
+
+// Conecta al socket Unix del servidor y negocia la región; NULL si falla (errno o mensaje)
+static inline IdxShm *idx_shm_connect(const char *unix_path)
+{
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if (strlen(unix_path) >= sizeof(sa.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(sa.sun_path, unix_path);
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s < 0)
+        return NULL;
+    if (connect(s, (struct sockaddr *)&sa, sizeof(sa)) != 0 || send(s, "SHM\n", 4, MSG_NOSIGNAL) != 4)
+    {
+        close(s);
+        return NULL;
+    }
+
+    // "OK SHM <bytes>\n" con el memfd adjunto
+    char line[64];
+    union
+    {
+        struct cmsghdr h;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctl;
+    struct iovec iov = {line, sizeof(line) - 1};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    ssize_t n = recvmsg(s, &msg, MSG_CMSG_CLOEXEC);
+    struct cmsghdr *cm = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    unsigned long bytes = 0;
+    if (n > 0)
+        line[n] = '\0';
+    if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS || sscanf(line, "OK SHM %lu", &bytes) != 1)
+    {
+        if (n > 0)
+            fprintf(stderr, "idx_shm: %s", line);
+        close(s);
+        errno = EPROTO;
+        return NULL;
+    }
+    int mfd;
+    memcpy(&mfd, CMSG_DATA(cm), sizeof(int));
+    void *p = bytes >= sizeof(ShmRegion) ? mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, mfd, 0) : MAP_FAILED;
+    close(mfd);
+    IdxShm *c = (IdxShm *)calloc(1, sizeof(IdxShm));
+    if (p == MAP_FAILED || !c || memcmp(((ShmRegion *)p)->magic, SHM_MAGIC, 8) != 0 ||
+        !shm_ring_fits(&((ShmRegion *)p)->req, bytes) || !shm_ring_fits(&((ShmRegion *)p)->resp, bytes))
+    {
+        if (p != MAP_FAILED)
+            munmap(p, bytes);
+        free(c);
+        close(s);
+        return NULL;
+    }
+    c->sock = s;
+    c->r = (ShmRegion *)p;
+    c->bytes = bytes;
+    // La geometría se copia una vez; a partir de aquí no se vuelve a leer de la región
+    c->req = shm_port(c->r, &c->r->req, c->r->req.data_off, c->r->req.size);
+    c->resp = shm_port(c->r, &c->r->resp, c->r->resp.data_off, c->r->resp.size);
+    return c;
+}
+
+// Encola un comando (sin '\n'); 0 si se envió
+static inline int idx_shm_send(IdxShm *c, const char *cmd)
+{
+    struct iovec iov = {(void *)cmd, strlen(cmd)};
+    return shm_push(c->r, &c->req, &iov, 1, -1);
+}
+
+// Recoge la siguiente respuesta (sin terminador; out no se termina en '\0')
+static inline ssize_t idx_shm_recv(IdxShm *c, char *out, size_t cap)
+{
+    return shm_pop(c->r, &c->resp, out, cap, -1);
+}
+
+// Petición y respuesta de ida y vuelta
+static inline ssize_t idx_shm_call(IdxShm *c, const char *cmd, char *out, size_t cap)
+{
+    if (idx_shm_send(c, cmd) != 0)
+        return -1;
+    return idx_shm_recv(c, out, cap);
+}
+
+static inline void idx_shm_close(IdxShm *c)
+{
+    if (!c)
+        return;
+    shm_region_close(c->r);
+    munmap(c->r, c->bytes);
+    close(c->sock);
+    free(c);
+}
+
+#endif
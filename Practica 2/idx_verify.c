@@ -0,0 +1,505 @@
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "idx_crc.h"
+#include "idx_dense.h"
+
+#define TABLE_SIZE 1000
+#define BLK_FLAG (1ull << 63)     // Pair.offset apunta al almacén por bloques (pack_store)
+#define CSV_WINDOW (4u << 20)     // lectura secuencial del CSV por hilo
+#define ID_FIELD_MAX 64           // bytes mirados tras el offset para sacar el primer campo
+#define MAX_REPORTED 20           // errores detallados que se imprimen (el resto sólo se cuenta)
+
+typedef struct
+{
+    uint64_t id;
+    uint64_t offset;
+} Pair;
+
+typedef struct
+{
+    char magic[8];          // "BKIDXv02" (v01: sin tabla de checksums)
+    uint64_t table_size;    // 1000
+    uint64_t total_entries; // N
+} Header;
+
+typedef struct
+{
+    uint64_t bucket_offset; // desplazamiento en books.idx
+    uint64_t bucket_count;  // nº de pares
+} DirEntry;
+
+// Tipos de error que se cuentan por separado
+enum
+{
+    E_CRC,    // el CRC32C del bucket no coincide
+    E_ORDER,  // ids no estrictamente crecientes dentro del bucket
+    E_HASH,   // el id no pertenece a ese bucket
+    E_READ,   // bucket fuera del archivo o error de E/S
+    E_OFFSET, // el offset no es inicio de línea o cae fuera del CSV
+    E_ID,     // la línea apuntada tiene otro id en su primer campo
+    E_DUP,    // dos ids apuntan a la misma línea
+    E_DENSE,  // la tabla densa no coincide con los buckets o con su cabecera
+    E_KINDS
+};
+
+static const char *const E_NAMES[E_KINDS] = {"crc", "orden", "hash", "lectura", "offset", "id", "duplicado", "densa"};
+
+static int g_idx_fd = -1;
+static int g_csv_fd = -1;
+static uint64_t g_csv_size = 0;
+static DirEntry g_dir[TABLE_SIZE];
+static uint32_t g_crc[TABLE_SIZE + 2];
+static bool g_has_crc = false;
+static Pair *g_all = NULL;        // todos los pares; luego ordenados por offset
+static uint64_t g_base[TABLE_SIZE]; // posición de cada bucket en g_all
+static uint64_t g_errors[E_KINDS];
+static uint64_t g_reported = 0;
+static uint64_t g_packed = 0;     // offsets al almacén por bloques (no se comprueban contra el CSV)
+static uint64_t g_dead = 0;       // pares IDX_DEAD (DEL): su offset sigue siendo la última fila del id
+static uint64_t g_idx_bytes = 0;
+static uint64_t g_csv_bytes = 0;
+static unsigned g_next_bucket = 0;
+
+static inline unsigned hash_id(uint64_t id)
+{
+    return (unsigned)((id * 2654435761UL) % TABLE_SIZE);
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Uso: %s <books.idx> <books_validos.csv> [--threads=N]\n"
+            "Comprueba cabecera, directorio, CRC32C y orden de cada bucket y que cada offset\n"
+            "caiga al inicio de una línea del CSV cuyo primer campo sea su id. Si existe\n"
+            "<books.idx>.dense, también que cada id de su rango esté en su ranura (y que los\n"
+            "borrados con DEL estén libres en ella).\n"
+            "Sale con 0 si el índice está sano y con 1 si encontró errores.\n",
+            prog);
+}
+
+// Cuenta un error y lo describe mientras no se haya alcanzado MAX_REPORTED
+static void report(int kind, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void report(int kind, const char *fmt, ...)
+{
+    __atomic_add_fetch(&g_errors[kind], 1, __ATOMIC_RELAXED);
+    if (__atomic_add_fetch(&g_reported, 1, __ATOMIC_RELAXED) > MAX_REPORTED)
+        return;
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "  [%s] ", E_NAMES[kind]);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    va_end(ap);
+}
+
+static int pread_full(int fd, void *dst, size_t len, uint64_t off)
+{
+    char *p = (char *)dst;
+    while (len > 0)
+    {
+        ssize_t r = pread(fd, p, len, (off_t)off);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        p += r;
+        off += (uint64_t)r;
+        len -= (size_t)r;
+    }
+    return 0;
+}
+
+// Id del primer campo con las mismas reglas que build_index (espacios/comillas, sólo dígitos)
+static int parse_id(const char *p, size_t n, uint64_t *out)
+{
+    size_t len = 0;
+    while (len < n && p[len] != ',' && p[len] != '\n')
+        len++;
+    while (len && (*p == ' ' || *p == '\t' || *p == '"'))
+        p++, len--;
+    while (len && (p[len - 1] == ' ' || p[len - 1] == '\t' || p[len - 1] == '"' || p[len - 1] == '\r'))
+        len--;
+    if (len == 0 || len > 20)
+        return 0;
+    uint64_t v = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (p[i] < '0' || p[i] > '9')
+            return 0;
+        uint64_t nv = v * 10 + (uint64_t)(p[i] - '0');
+        if (nv / 10 != v)
+            return 0;
+        v = nv;
+    }
+    *out = v;
+    return 1;
+}
+
+// ====== Fase 1: buckets en paralelo (CRC, orden, hash) ======
+// Cada hilo toma el siguiente bucket libre y copia sus pares a g_all en su posición fija.
+static void *bucket_worker(void *arg)
+{
+    (void)arg;
+    Pair *buf = NULL;
+    size_t cap = 0;
+    for (;;)
+    {
+        unsigned b = __atomic_fetch_add(&g_next_bucket, 1, __ATOMIC_RELAXED);
+        if (b >= TABLE_SIZE)
+            break;
+        uint64_t count = g_dir[b].bucket_count;
+        if (count == 0)
+        {
+            if (g_has_crc && g_crc[b] != 0)
+                report(E_CRC, "bucket %u vacío con CRC %08x", b, g_crc[b]);
+            continue;
+        }
+        size_t bytes = (size_t)count * sizeof(Pair);
+        if (bytes > cap)
+        {
+            Pair *nb = (Pair *)realloc(buf, bytes);
+            if (!nb)
+            {
+                report(E_READ, "bucket %u: sin memoria para %zu bytes", b, bytes);
+                for (uint64_t j = 0; j < count; ++j)
+                    g_all[g_base[b] + j] = (Pair){0, UINT64_MAX};
+                continue;
+            }
+            buf = nb;
+            cap = bytes;
+        }
+        if (pread_full(g_idx_fd, buf, bytes, g_dir[b].bucket_offset) != 0)
+        {
+            report(E_READ, "bucket %u: no se pudo leer (%" PRIu64 " pares en %" PRIu64 ")", b, count,
+                   g_dir[b].bucket_offset);
+            for (uint64_t j = 0; j < count; ++j)
+                g_all[g_base[b] + j] = (Pair){0, UINT64_MAX};
+            continue;
+        }
+        __atomic_add_fetch(&g_idx_bytes, bytes, __ATOMIC_RELAXED);
+        uint32_t c;
+        if (g_has_crc && (c = crc32c(0, buf, bytes)) != g_crc[b])
+            report(E_CRC, "bucket %u: CRC %08x, esperado %08x", b, c, g_crc[b]);
+        for (uint64_t j = 0; j < count; ++j)
+        {
+            if (j > 0 && buf[j].id <= buf[j - 1].id)
+                report(E_ORDER, "bucket %u: id %" PRIu64 " tras %" PRIu64, b, buf[j].id, buf[j - 1].id);
+            if (hash_id(buf[j].id) != b)
+                report(E_HASH, "id %" PRIu64 " en el bucket %u (debería estar en %u)", buf[j].id, b, hash_id(buf[j].id));
+            if (buf[j].offset & BLK_FLAG)
+            {
+                __atomic_add_fetch(&g_packed, 1, __ATOMIC_RELAXED);
+                buf[j].offset = UINT64_MAX; // al final tras ordenar: no se miran en el CSV
+            }
+            else if (buf[j].offset & IDX_DEAD)
+                __atomic_add_fetch(&g_dead, 1, __ATOMIC_RELAXED);
+        }
+        memcpy(&g_all[g_base[b]], buf, bytes);
+    }
+    free(buf);
+    return NULL;
+}
+
+static int cmp_pair_offset(const void *a, const void *b)
+{
+    const Pair *pa = (const Pair *)a, *pb = (const Pair *)b;
+    return (pa->offset > pb->offset) - (pa->offset < pb->offset);
+}
+
+// ====== Fase 2: CSV en paralelo por tramos de offsets ordenados ======
+// Cada hilo recorre su tramo de g_all (ya ordenado por offset) leyendo el CSV hacia delante
+// en ventanas de CSV_WINDOW: lectura secuencial, sin una llamada al sistema por fila.
+typedef struct
+{
+    uint64_t from, to; // [from, to) en g_all
+} Slice;
+
+static void *csv_worker(void *arg)
+{
+    Slice *sl = (Slice *)arg;
+    char *win = (char *)malloc(CSV_WINDOW);
+    uint64_t win_start = 0, win_len = 0; // win contiene csv[win_start, win_start + win_len)
+    if (!win)
+    {
+        report(E_READ, "sin memoria para la ventana del CSV");
+        return NULL;
+    }
+    for (uint64_t i = sl->from; i < sl->to; ++i)
+    {
+        const Pair *p = &g_all[i];
+        if (p->offset == UINT64_MAX)
+            break; // empaquetados o ilegibles: siempre al final
+        if (i > 0 && g_all[i - 1].offset == p->offset)
+            report(E_DUP, "ids %" PRIu64 " y %" PRIu64 " apuntan al offset %" PRIu64, g_all[i - 1].id, p->id,
+                   p->offset);
+        if (p->offset == 0 || p->offset >= g_csv_size)
+        {
+            report(E_OFFSET, "id %" PRIu64 ": offset %" PRIu64 " fuera de las filas del CSV (%" PRIu64 " bytes)", p->id,
+                   p->offset, g_csv_size);
+            continue;
+        }
+        // Hace falta el byte anterior (debe ser '\n') y el primer campo de la línea
+        uint64_t need_from = p->offset - 1;
+        uint64_t need_to = p->offset + ID_FIELD_MAX < g_csv_size ? p->offset + ID_FIELD_MAX : g_csv_size;
+        if (need_from < win_start || need_to > win_start + win_len)
+        {
+            win_start = need_from;
+            uint64_t want = g_csv_size - win_start < CSV_WINDOW ? g_csv_size - win_start : CSV_WINDOW;
+            if (pread_full(g_csv_fd, win, (size_t)want, win_start) != 0)
+            {
+                report(E_READ, "CSV: no se pudo leer en %" PRIu64, win_start);
+                win_len = 0;
+                continue;
+            }
+            win_len = want;
+            __atomic_add_fetch(&g_csv_bytes, want, __ATOMIC_RELAXED);
+        }
+        const char *at = win + (p->offset - win_start);
+        size_t avail = (size_t)(need_to - p->offset);
+        uint64_t id;
+        if (at[-1] != '\n')
+            report(E_OFFSET, "id %" PRIu64 ": offset %" PRIu64 " no es inicio de línea", p->id, p->offset);
+        else if (!parse_id(at, avail, &id) || id != p->id)
+        {
+            int shown = 0;
+            while ((size_t)shown < avail && shown < 24 && at[shown] != ',' && at[shown] != '\n')
+                shown++;
+            report(E_ID, "id %" PRIu64 ": la línea en %" PRIu64 " empieza por \"%.*s\"", p->id, p->offset, shown, at);
+        }
+    }
+    free(win);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *idx_path = argv[1];
+    const char *csv_path = argv[2];
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 3; i < argc; ++i)
+    {
+        if (strncmp(argv[i], "--threads=", 10) == 0)
+            nthreads = atol(argv[i] + 10);
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > 256)
+        nthreads = 256;
+
+    g_idx_fd = open(idx_path, O_RDONLY | O_CLOEXEC);
+    g_csv_fd = open(csv_path, O_RDONLY | O_CLOEXEC);
+    struct stat ist, cst;
+    if (g_idx_fd < 0 || g_csv_fd < 0 || fstat(g_idx_fd, &ist) != 0 || fstat(g_csv_fd, &cst) != 0)
+    {
+        perror("No se pudo abrir la entrada");
+        return EXIT_FAILURE;
+    }
+    g_csv_size = (uint64_t)cst.st_size;
+    double t0 = now_s();
+
+    // 1) Cabecera, directorio y (v2) tabla de checksums
+    Header hdr;
+    int ver = 0;
+    if (pread_full(g_idx_fd, &hdr, sizeof(hdr), 0) != 0 || (ver = idx_version(hdr.magic)) == 0 ||
+        hdr.table_size != TABLE_SIZE || pread_full(g_idx_fd, g_dir, sizeof(g_dir), sizeof(hdr)) != 0 ||
+        (ver == 2 && pread_full(g_idx_fd, g_crc, IDX_CRC_BYTES(TABLE_SIZE), sizeof(hdr) + sizeof(g_dir)) != 0))
+    {
+        fprintf(stderr, "Índice inválido: %s\n", idx_path);
+        return EXIT_FAILURE;
+    }
+    g_has_crc = ver == 2;
+    printf("Índice %s: %.8s, %" PRIu64 " entradas, %.1f MB\n", idx_path, hdr.magic, hdr.total_entries,
+           (double)ist.st_size / 1e6);
+    bool header_ok = true;
+    if (g_has_crc)
+    {
+        uint32_t c = idx_header_crc(&hdr, sizeof(hdr), g_dir, sizeof(g_dir), g_crc, TABLE_SIZE);
+        header_ok = c == g_crc[TABLE_SIZE];
+        printf("  CRC cabecera : %s (%08x)\n", header_ok ? "ok" : "NO COINCIDE", g_crc[TABLE_SIZE]);
+    }
+    else
+        printf("  CRC cabecera : sin checksums (BKIDXv01); sólo orden, hash y offsets\n");
+
+    uint64_t sum = 0;
+    for (unsigned b = 0; b < TABLE_SIZE; ++b)
+    {
+        if (g_dir[b].bucket_count > (uint64_t)ist.st_size / sizeof(Pair) ||
+            g_dir[b].bucket_offset + g_dir[b].bucket_count * sizeof(Pair) > (uint64_t)ist.st_size)
+        {
+            report(E_READ, "bucket %u: [%" PRIu64 ", +%" PRIu64 " pares) sale del archivo", b, g_dir[b].bucket_offset,
+                   g_dir[b].bucket_count);
+            g_dir[b].bucket_count = 0;
+        }
+        g_base[b] = sum;
+        sum += g_dir[b].bucket_count;
+    }
+    if (sum != hdr.total_entries)
+        printf("  AVISO: el directorio suma %" PRIu64 " pares y la cabecera dice %" PRIu64 "\n", sum, hdr.total_entries);
+
+    g_all = (Pair *)malloc((size_t)(sum ? sum : 1) * sizeof(Pair));
+    pthread_t *th = (pthread_t *)malloc((size_t)nthreads * sizeof(pthread_t));
+    Slice *sl = (Slice *)malloc((size_t)nthreads * sizeof(Slice));
+    if (!g_all || !th || !sl)
+    {
+        perror("sin memoria");
+        return EXIT_FAILURE;
+    }
+
+    // 2) Buckets en paralelo
+    for (long t = 0; t < nthreads; ++t)
+        pthread_create(&th[t], NULL, bucket_worker, NULL);
+    for (long t = 0; t < nthreads; ++t)
+        pthread_join(th[t], NULL);
+
+    // 2b) Tabla densa: cada id de los buckets que cae en su rango debe estar en su ranura con el
+    // mismo offset, y al revés: el servidor escribe cada ADD también en su bucket, así que una
+    // ranura sin par en books.idx es un error (split_index o pack_store no verían ese id).
+    // Esas ranuras pasan además a g_all para comprobarse contra el CSV con el resto.
+    char dense_path[4096];
+    snprintf(dense_path, sizeof(dense_path), "%s.dense", idx_path);
+    size_t dense_bytes = 0;
+    DenseHeader *dense = access(dense_path, F_OK) == 0 ? dense_map(dense_path, 0, &dense_bytes) : NULL;
+    uint64_t checked = sum, dense_only = 0;
+    if (access(dense_path, F_OK) == 0 && !dense)
+        report(E_DENSE, "%s no es una tabla densa válida", dense_path);
+    // Una tabla que refleja otro tamaño de CSV no se usa (el servidor la ignora): sólo se avisa
+    if (dense && dense->csv_end != g_csv_size)
+    {
+        printf("  tabla densa  : AVISO: refleja %" PRIu64 " bytes del CSV y tiene %" PRIu64 "; el servidor la ignora\n",
+               dense->csv_end, g_csv_size);
+        munmap(dense, dense_bytes);
+        dense = NULL;
+    }
+    if (dense)
+    {
+        size_t words = dense_bits_words(dense->slots);
+        uint64_t *seen = (uint64_t *)calloc(words, sizeof(uint64_t));
+        if (!seen)
+        {
+            perror("sin memoria");
+            return EXIT_FAILURE;
+        }
+        for (uint64_t i = 0; i < sum; ++i)
+        {
+            int64_t slot = g_all[i].offset == UINT64_MAX ? -1 : dense_slot(dense, g_all[i].id);
+            if (slot < 0)
+                continue;
+            // Un id borrado lo está en los dos sitios: su ranura debe estar libre
+            if (g_all[i].offset & IDX_DEAD)
+            {
+                if (dense_bits(dense)[slot >> 6] & (1ull << (slot & 63)))
+                    report(E_DENSE, "id %" PRIu64 ": borrado en su bucket y presente en la tabla densa", g_all[i].id);
+            }
+            else if (!(dense_bits(dense)[slot >> 6] & (1ull << (slot & 63))))
+                report(E_DENSE, "id %" PRIu64 ": falta en la tabla densa", g_all[i].id);
+            else if (dense_offsets(dense)[slot] != g_all[i].offset && !(seen[slot >> 6] & (1ull << (slot & 63))))
+                report(E_DENSE, "id %" PRIu64 ": offset %" PRIu64 " en la tabla y %" PRIu64 " en su bucket", g_all[i].id,
+                       dense_offsets(dense)[slot], g_all[i].offset);
+            seen[slot >> 6] |= 1ull << (slot & 63);
+        }
+        uint64_t present = 0;
+        for (size_t w = 0; w < words; ++w)
+        {
+            present += (uint64_t)__builtin_popcountll(dense_bits(dense)[w]);
+            dense_only += (uint64_t)__builtin_popcountll(dense_bits(dense)[w] & ~seen[w]);
+        }
+        if (present != dense->count)
+            report(E_DENSE, "la tabla densa marca %" PRIu64 " ranuras y su cabecera dice %" PRIu64, present, dense->count);
+        Pair *grown = dense_only ? (Pair *)realloc(g_all, (size_t)(sum + dense_only) * sizeof(Pair)) : g_all;
+        if (!grown)
+        {
+            perror("sin memoria");
+            return EXIT_FAILURE;
+        }
+        g_all = grown;
+        for (uint64_t slot = 0; dense_only && slot < dense->slots; ++slot)
+            if ((dense_bits(dense)[slot >> 6] & ~seen[slot >> 6]) & (1ull << (slot & 63)))
+            {
+                report(E_DENSE, "id %" PRIu64 ": está en la tabla densa y falta en books.idx (REBUILD lo repone)",
+                       dense->min_id + slot);
+                g_all[checked++] = (Pair){dense->min_id + slot, dense_offsets(dense)[slot]};
+            }
+        printf("  tabla densa  : %" PRIu64 " de %" PRIu64 " ranuras desde id %" PRIu64 ", %" PRIu64 " sólo en la tabla\n",
+               present, dense->slots, dense->min_id, dense_only);
+        free(seen);
+        munmap(dense, dense_bytes);
+    }
+    // Los pares borrados se comprueban como los demás: apuntan a la última fila de su id
+    for (uint64_t i = 0; i < sum; ++i)
+        if (g_all[i].offset != UINT64_MAX)
+            g_all[i].offset &= ~IDX_DEAD;
+    double t1 = now_s();
+
+    // 3) Offsets ordenados y CSV en paralelo, cada hilo con un tramo contiguo
+    qsort(g_all, (size_t)checked, sizeof(Pair), cmp_pair_offset);
+    double t2 = now_s();
+    for (long t = 0; t < nthreads; ++t)
+    {
+        sl[t].from = checked * (uint64_t)t / (uint64_t)nthreads;
+        sl[t].to = checked * (uint64_t)(t + 1) / (uint64_t)nthreads;
+        pthread_create(&th[t], NULL, csv_worker, &sl[t]);
+    }
+    for (long t = 0; t < nthreads; ++t)
+        pthread_join(th[t], NULL);
+    double t3 = now_s();
+
+    uint64_t total_err = 0;
+    for (int k = 0; k < E_KINDS; ++k)
+        total_err += g_errors[k];
+    if (g_reported > MAX_REPORTED)
+        fprintf(stderr, "  ... (%" PRIu64 " errores más sin detallar)\n", g_reported - MAX_REPORTED);
+
+    printf("  buckets      : %.3f s, %.1f MB a %.0f MB/s (%ld hilos)\n", t1 - t0, (double)g_idx_bytes / 1e6,
+           t1 > t0 ? (double)g_idx_bytes / 1e6 / (t1 - t0) : 0.0, nthreads);
+    printf("  orden offsets: %.3f s\n", t2 - t1);
+    printf("  CSV          : %.3f s, %.1f MB a %.0f MB/s\n", t3 - t2, (double)g_csv_bytes / 1e6,
+           t3 > t2 ? (double)g_csv_bytes / 1e6 / (t3 - t2) : 0.0);
+    if (g_packed)
+        printf("  empaquetados : %" PRIu64 " offsets al almacén por bloques (no comprobados contra el CSV)\n", g_packed);
+    if (g_dead)
+        printf("  borrados     : %" PRIu64 " pares marcados por DEL (VACUUM o REBUILD los quitan)\n", g_dead);
+    printf("  errores      :");
+    for (int k = 0; k < E_KINDS; ++k)
+        printf(" %s=%" PRIu64, E_NAMES[k], g_errors[k]);
+    printf("\n%s\n", total_err == 0 && header_ok && sum == hdr.total_entries ? "OK: índice verificado"
+                                                                            : "ERROR: el índice no coincide con el CSV");
+
+    free(g_all);
+    free(th);
+    free(sl);
+    close(g_idx_fd);
+    close(g_csv_fd);
+    return total_err == 0 && header_ok && sum == hdr.total_entries ? EXIT_SUCCESS : 1;
+}
@@ -0,0 +1,415 @@
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "blk_store.h"
+#include "idx_crc.h"
+
+#define TABLE_SIZE 1000
+
+typedef struct
+{
+    uint64_t id;
+    uint64_t offset;
+} Pair;
+
+typedef struct
+{
+    char magic[8];          // "BKIDXv02" (v01: sin tabla de checksums)
+    uint64_t table_size;    // 1000
+    uint64_t total_entries; // N
+} Header;
+
+typedef struct
+{
+    uint64_t bucket_offset; // desplazamiento en books.idx
+    uint64_t bucket_count;  // nº de pares
+} DirEntry;
+
+// Offset de la fila en el CSV original -> offset empaquetado (bloque, slot)
+typedef struct
+{
+    uint64_t old_off;
+    uint64_t new_off;
+} OffMap;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Uso: %s <books.csv> <books.idx> <prefijo> [--block-kb=N] [--dict-kb=N]\n"
+            "Empaqueta las filas en bloques comprimidos y genera:\n"
+            "  <prefijo>.blk  bloques + diccionario + directorio de bloques\n"
+            "  <prefijo>.idx  índice con offsets (bloque, slot)\n"
+            "  <prefijo>.csv  sólo la cabecera: las filas nuevas (ADD) se siguen añadiendo aquí\n"
+            "  --block-kb=N   tamaño objetivo de bloque descomprimido (48)\n"
+            "  --dict-kb=N    tamaño del diccionario muestreado (32, máx. 63)\n",
+            prog);
+}
+
+// Diccionario: filas tomadas a intervalos regulares de todo el CSV
+static size_t build_dict(FILE *csv, uint64_t data_start, uint64_t csv_size, uint8_t *dict, size_t cap)
+{
+    size_t len = 0;
+    char *line = NULL;
+    size_t lcap = 0;
+    // Unas 4 filas por KB de diccionario, repartidas por todo el archivo
+    uint64_t samples = cap / 256 + 1;
+    uint64_t stride = (csv_size - data_start) / samples + 1;
+    for (uint64_t k = 0; k < samples && len < cap; ++k)
+    {
+        if (fseeko(csv, (off_t)(data_start + k * stride), SEEK_SET) != 0)
+            break;
+        // Descarta el resto de la fila en curso (salvo al inicio de los datos)
+        if (k > 0 && getline(&line, &lcap, csv) <= 0)
+            break;
+        ssize_t n = getline(&line, &lcap, csv);
+        if (n <= 0)
+            break;
+        size_t take = (size_t)n < cap - len ? (size_t)n : cap - len;
+        memcpy(dict + len, line, take);
+        len += take;
+    }
+    free(line);
+    return len;
+}
+
+typedef struct
+{
+    FILE *out;
+    uint8_t *work;     // diccionario + bloque en curso (contiguos para el compresor)
+    size_t work_cap;
+    size_t dict_len;
+    uint32_t *starts;  // inicio de cada fila dentro de los datos del bloque
+    size_t nrows;
+    size_t rows_cap;
+    size_t data_len;   // bytes de filas del bloque en curso
+    uint8_t *comp;
+    size_t comp_cap;
+    uint32_t *table;
+    BlkDirEntry *dir;
+    size_t nblocks, dir_cap;
+    uint64_t pos;      // siguiente byte libre en books.blk
+    uint64_t raw_total, comp_total;
+} Packer;
+
+static int ensure(void **p, size_t *cap, size_t need, size_t elem)
+{
+    if (need <= *cap)
+        return 0;
+    size_t ncap = *cap ? *cap : 1024;
+    while (ncap < need)
+        ncap *= 2;
+    void *np = realloc(*p, ncap * elem);
+    if (!np)
+        return -1;
+    *p = np;
+    *cap = ncap;
+    return 0;
+}
+
+// Comprime y escribe el bloque en curso
+static int flush_block(Packer *pk)
+{
+    if (pk->nrows == 0)
+        return 0;
+    // Bloque descomprimido: nrows | inicios | filas. Se arma detrás del diccionario.
+    size_t head = 4 + 4 * pk->nrows;
+    size_t raw = head + pk->data_len;
+    if (ensure((void **)&pk->work, &pk->work_cap, pk->dict_len + raw, 1) != 0 ||
+        ensure((void **)&pk->comp, &pk->comp_cap, lz_bound(raw), 1) != 0 ||
+        ensure((void **)&pk->dir, &pk->dir_cap, pk->nblocks + 1, sizeof(BlkDirEntry)) != 0)
+        return -1;
+    uint8_t *blk = pk->work + pk->dict_len;
+    memmove(blk + head, blk, pk->data_len); // las filas se acumularon al inicio
+    uint32_t n32 = (uint32_t)pk->nrows;
+    memcpy(blk, &n32, 4);
+    memcpy(blk + 4, pk->starts, 4 * pk->nrows);
+
+    size_t clen = lz_compress(pk->work, pk->dict_len, raw, pk->comp, pk->table);
+    BlkDirEntry *d = &pk->dir[pk->nblocks++];
+    d->offset = pk->pos;
+    d->raw_len = (uint32_t)raw;
+    d->nrows = n32;
+    d->flags = 0;
+    const uint8_t *src = pk->comp;
+    if (clen >= raw)
+    {
+        // No compensa: se guarda tal cual
+        clen = raw;
+        src = blk;
+        d->flags = BLK_STORED_RAW;
+    }
+    d->comp_len = (uint32_t)clen;
+    if (fwrite(src, 1, clen, pk->out) != clen)
+        return -1;
+    pk->pos += clen;
+    pk->raw_total += raw;
+    pk->comp_total += clen;
+    pk->nrows = 0;
+    pk->data_len = 0;
+    return 0;
+}
+
+static int cmp_offmap(const void *a, const void *b)
+{
+    uint64_t x = ((const OffMap *)a)->old_off, y = ((const OffMap *)b)->old_off;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *csv_path = argv[1];
+    const char *idx_path = argv[2];
+    const char *prefix = argv[3];
+    size_t block_kb = 48, dict_kb = 32;
+    for (int i = 4; i < argc; ++i)
+    {
+        if (sscanf(argv[i], "--block-kb=%zu", &block_kb) == 1 || sscanf(argv[i], "--dict-kb=%zu", &dict_kb) == 1)
+            continue;
+        fprintf(stderr, "Opción desconocida: %s\n", argv[i]);
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (block_kb < 1 || block_kb > 4096 || dict_kb > 63)
+    {
+        fprintf(stderr, "Parámetros fuera de rango\n");
+        return EXIT_FAILURE;
+    }
+    double t0 = now_s();
+
+    FILE *csv = fopen(csv_path, "rb");
+    FILE *in_idx = fopen(idx_path, "rb");
+    if (!csv || !in_idx)
+    {
+        perror("No se pudo abrir la entrada");
+        return EXIT_FAILURE;
+    }
+    Header hdr;
+    DirEntry dir[TABLE_SIZE];
+    if (fread(&hdr, sizeof(hdr), 1, in_idx) != 1 || idx_version(hdr.magic) == 0 ||
+        hdr.table_size != TABLE_SIZE || fread(dir, sizeof(DirEntry), TABLE_SIZE, in_idx) != TABLE_SIZE)
+    {
+        fprintf(stderr, "Índice inválido: %s\n", idx_path);
+        return EXIT_FAILURE;
+    }
+    struct stat st;
+    if (fstat(fileno(csv), &st) != 0)
+    {
+        perror("stat csv");
+        return EXIT_FAILURE;
+    }
+
+    // Cabecera del CSV: va tal cual al CSV nuevo
+    char *line = NULL;
+    size_t lcap = 0;
+    ssize_t head_len = getline(&line, &lcap, csv);
+    if (head_len <= 0)
+    {
+        fprintf(stderr, "CSV vacío\n");
+        return EXIT_FAILURE;
+    }
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.csv", prefix);
+    FILE *out_csv = fopen(path, "wb");
+    if (!out_csv || fwrite(line, 1, (size_t)head_len, out_csv) != (size_t)head_len || fclose(out_csv) != 0)
+    {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    // 1) Diccionario muestreado
+    Packer pk;
+    memset(&pk, 0, sizeof(pk));
+    size_t dict_cap = dict_kb * 1024 > BLK_MAX_DICT ? BLK_MAX_DICT : dict_kb * 1024;
+    pk.work_cap = dict_cap + block_kb * 1024 * 2 + 4096;
+    pk.work = (uint8_t *)malloc(pk.work_cap);
+    pk.table = (uint32_t *)malloc(sizeof(uint32_t) << LZ_HASH_BITS);
+    if (!pk.work || !pk.table)
+    {
+        perror("sin memoria");
+        return EXIT_FAILURE;
+    }
+    pk.dict_len = build_dict(csv, (uint64_t)head_len, (uint64_t)st.st_size, pk.work, dict_cap);
+
+    snprintf(path, sizeof(path), "%s.blk", prefix);
+    pk.out = fopen(path, "wb");
+    if (!pk.out)
+    {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    setvbuf(pk.out, NULL, _IOFBF, 1 << 20);
+    BlkHeader bh;
+    memset(&bh, 0, sizeof(bh));
+    memcpy(bh.magic, BLK_MAGIC, 8);
+    bh.dict_offset = sizeof(BlkHeader);
+    bh.dict_len = pk.dict_len;
+    if (fwrite(&bh, sizeof(bh), 1, pk.out) != 1 || fwrite(pk.work, 1, pk.dict_len, pk.out) != pk.dict_len)
+    {
+        perror("write blk");
+        return EXIT_FAILURE;
+    }
+    pk.pos = sizeof(BlkHeader) + pk.dict_len;
+
+    // 2) Filas en orden del CSV, agrupadas en bloques de ~block_kb
+    OffMap *map = NULL;
+    size_t nmap = 0, map_cap = 0;
+    if (fseeko(csv, (off_t)head_len, SEEK_SET) != 0)
+        return EXIT_FAILURE;
+    uint64_t off = (uint64_t)head_len;
+    ssize_t n;
+    const size_t target = block_kb * 1024;
+    while ((n = getline(&line, &lcap, csv)) > 0)
+    {
+        if (pk.nrows > 0 && (pk.data_len + (size_t)n > target || pk.nrows + 1 >= (1u << BLK_SLOT_BITS)))
+        {
+            if (flush_block(&pk) != 0)
+            {
+                perror("write block");
+                return EXIT_FAILURE;
+            }
+        }
+        if (ensure((void **)&pk.work, &pk.work_cap, pk.dict_len + 4 + 4 * (pk.nrows + 1) + pk.data_len + (size_t)n, 1) != 0 ||
+            ensure((void **)&pk.starts, &pk.rows_cap, pk.nrows + 1, sizeof(uint32_t)) != 0 ||
+            ensure((void **)&map, &map_cap, nmap + 1, sizeof(OffMap)) != 0)
+        {
+            perror("sin memoria");
+            return EXIT_FAILURE;
+        }
+        pk.starts[pk.nrows] = (uint32_t)pk.data_len;
+        memcpy(pk.work + pk.dict_len + pk.data_len, line, (size_t)n);
+        map[nmap].old_off = off;
+        map[nmap].new_off = blk_make_offset(pk.nblocks, (unsigned)pk.nrows);
+        nmap++;
+        pk.nrows++;
+        pk.data_len += (size_t)n;
+        off += (uint64_t)n;
+    }
+    if (flush_block(&pk) != 0)
+    {
+        perror("write block");
+        return EXIT_FAILURE;
+    }
+    // Los inicios se guardan relativos a los datos; el lector suma la cabecera del bloque
+
+    bh.block_count = pk.nblocks;
+    bh.rows = nmap;
+    bh.dir_offset = pk.pos;
+    if (fwrite(pk.dir, sizeof(BlkDirEntry), pk.nblocks, pk.out) != pk.nblocks || fseeko(pk.out, 0, SEEK_SET) != 0 ||
+        fwrite(&bh, sizeof(bh), 1, pk.out) != 1 || fclose(pk.out) != 0)
+    {
+        perror("write blk");
+        return EXIT_FAILURE;
+    }
+
+    // 3) Índice nuevo: mismos buckets y orden, offsets traducidos a (bloque, slot)
+    qsort(map, nmap, sizeof(OffMap), cmp_offmap); // ya viene ordenado; por seguridad
+    snprintf(path, sizeof(path), "%s.idx", prefix);
+    FILE *out_idx = fopen(path, "wb");
+    if (!out_idx)
+    {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    DirEntry ndir[TABLE_SIZE];
+    uint32_t ncrc[TABLE_SIZE + 2]; // bucket_crc, header_crc y reservado (IDX_CRC_BYTES)
+    memset(ndir, 0, sizeof(ndir));
+    memset(ncrc, 0, sizeof(ncrc));
+    memcpy(hdr.magic, IDX_MAGIC_V2, 8);
+    uint64_t ipos = sizeof(Header) + sizeof(ndir) + IDX_CRC_BYTES(TABLE_SIZE);
+    fwrite(&hdr, sizeof(hdr), 1, out_idx);
+    fwrite(ndir, sizeof(DirEntry), TABLE_SIZE, out_idx);
+    fwrite(ncrc, 1, IDX_CRC_BYTES(TABLE_SIZE), out_idx);
+    for (unsigned b = 0; b < TABLE_SIZE; ++b)
+    {
+        uint64_t count = dir[b].bucket_count;
+        if (count == 0)
+            continue;
+        Pair *pairs = (Pair *)malloc((size_t)count * sizeof(Pair));
+        if (!pairs || fseeko(in_idx, (off_t)dir[b].bucket_offset, SEEK_SET) != 0 ||
+            fread(pairs, sizeof(Pair), (size_t)count, in_idx) != count)
+        {
+            fprintf(stderr, "Error leyendo bucket %u\n", b);
+            return EXIT_FAILURE;
+        }
+        // Los ids borrados en el servidor (DEL) no pasan al índice empaquetado
+        uint64_t live = 0;
+        for (uint64_t j = 0; j < count; ++j)
+            if (!(pairs[j].offset & IDX_DEAD))
+                pairs[live++] = pairs[j];
+        hdr.total_entries -= count - live;
+        count = live;
+        if (count == 0)
+        {
+            free(pairs);
+            continue;
+        }
+        for (uint64_t j = 0; j < count; ++j)
+        {
+            OffMap key = {pairs[j].offset, 0};
+            OffMap *m = (OffMap *)bsearch(&key, map, nmap, sizeof(OffMap), cmp_offmap);
+            if (!m)
+            {
+                fprintf(stderr, "El id %" PRIu64 " apunta a un offset que no es inicio de fila\n", pairs[j].id);
+                return EXIT_FAILURE;
+            }
+            pairs[j].offset = m->new_off;
+        }
+        ndir[b].bucket_offset = ipos;
+        ndir[b].bucket_count = count;
+        ncrc[b] = crc32c(0, pairs, (size_t)count * sizeof(Pair));
+        if (fwrite(pairs, sizeof(Pair), (size_t)count, out_idx) != count)
+        {
+            perror("write idx");
+            return EXIT_FAILURE;
+        }
+        ipos += count * sizeof(Pair);
+        free(pairs);
+    }
+    ncrc[TABLE_SIZE] = idx_header_crc(&hdr, sizeof(hdr), ndir, sizeof(ndir), ncrc, TABLE_SIZE);
+    if (fseeko(out_idx, 0, SEEK_SET) != 0 || fwrite(&hdr, sizeof(hdr), 1, out_idx) != 1 ||
+        fwrite(ndir, sizeof(DirEntry), TABLE_SIZE, out_idx) != TABLE_SIZE ||
+        fwrite(ncrc, 1, IDX_CRC_BYTES(TABLE_SIZE), out_idx) != IDX_CRC_BYTES(TABLE_SIZE) || fclose(out_idx) != 0)
+    {
+        perror("write idx");
+        return EXIT_FAILURE;
+    }
+
+    printf("OK: %zu filas en %zu bloques (%s.blk)\n", nmap, pk.nblocks, prefix);
+    printf("  diccionario  : %zu bytes\n", pk.dict_len);
+    printf("  datos        : %.1f MB -> %.1f MB (%.2fx)\n", (double)pk.raw_total / 1e6,
+           (double)(pk.comp_total + pk.dict_len) / 1e6,
+           pk.comp_total ? (double)pk.raw_total / (double)(pk.comp_total + pk.dict_len) : 0.0);
+    printf("  tiempo total : %.3f s\n", now_s() - t0);
+
+    free(map);
+    free(line);
+    free(pk.work);
+    free(pk.comp);
+    free(pk.table);
+    free(pk.starts);
+    free(pk.dir);
+    fclose(csv);
+    fclose(in_idx);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,209 @@
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "idx_crc.h"
+
+#define TABLE_SIZE 1000
+
+typedef struct
+{
+    uint64_t id;
+    uint64_t offset;
+} Pair;
+
+typedef struct
+{
+    char magic[8];          // "BKIDXv02" (v01: sin tabla de checksums)
+    uint64_t table_size;    // 1000
+    uint64_t total_entries; // N
+} Header;
+
+typedef struct
+{
+    uint64_t bucket_offset; // desplazamiento en books.idx
+    uint64_t bucket_count;  // nº de pares
+} DirEntry;
+
+// Un shard: su CSV, su índice y su directorio (mismo formato que books.idx)
+typedef struct
+{
+    FILE *csv;
+    FILE *idx;
+    DirEntry dir[TABLE_SIZE];
+    uint32_t crc[TABLE_SIZE + 2]; // bucket_crc, header_crc y reservado (IDX_CRC_BYTES)
+    uint64_t entries;
+    uint64_t csv_bytes;
+} Shard;
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Uso: %s <books.idx> <books.csv> <K> <prefijo>\n"
+            "Reparte los buckets entre K shards: el bucket b va al shard b %% K.\n"
+            "Genera <prefijo>_<i>.idx y <prefijo>_<i>.csv para i = 0..K-1.\n",
+            prog);
+}
+
+// Lee la fila completa del CSV en off (sin el '\n' final en la longitud devuelta)
+static ssize_t read_row(FILE *csv, uint64_t off, char **line, size_t *cap)
+{
+    if (fseeko(csv, (off_t)off, SEEK_SET) != 0)
+        return -1;
+    ssize_t n = getline(line, cap, csv);
+    if (n <= 0)
+        return -1;
+    if ((*line)[n - 1] == '\n')
+        n--;
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 5)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *idx_path = argv[1];
+    const char *csv_path = argv[2];
+    int k = atoi(argv[3]);
+    const char *prefix = argv[4];
+    if (k < 1 || k > TABLE_SIZE)
+    {
+        fprintf(stderr, "K debe estar entre 1 y %d\n", TABLE_SIZE);
+        return EXIT_FAILURE;
+    }
+
+    FILE *in_idx = fopen(idx_path, "rb");
+    FILE *in_csv = fopen(csv_path, "rb");
+    if (!in_idx || !in_csv)
+    {
+        perror("No se pudo abrir la entrada");
+        return EXIT_FAILURE;
+    }
+    Header hdr;
+    DirEntry dir[TABLE_SIZE];
+    if (fread(&hdr, sizeof(hdr), 1, in_idx) != 1 || idx_version(hdr.magic) == 0 ||
+        hdr.table_size != TABLE_SIZE || fread(dir, sizeof(DirEntry), TABLE_SIZE, in_idx) != TABLE_SIZE)
+    {
+        fprintf(stderr, "Índice inválido: %s\n", idx_path);
+        return EXIT_FAILURE;
+    }
+
+    // Cabecera del CSV original: se copia al inicio de cada shard
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t head_len = getline(&line, &line_cap, in_csv);
+    if (head_len <= 0)
+    {
+        fprintf(stderr, "CSV vacío: %s\n", csv_path);
+        return EXIT_FAILURE;
+    }
+    char *csv_header = strdup(line);
+
+    Shard *sh = (Shard *)calloc((size_t)k, sizeof(Shard));
+    if (!sh || !csv_header)
+    {
+        perror("sin memoria");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < k; ++i)
+    {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s_%d.csv", prefix, i);
+        sh[i].csv = fopen(path, "wb");
+        snprintf(path, sizeof(path), "%s_%d.idx", prefix, i);
+        sh[i].idx = fopen(path, "w+b");
+        if (!sh[i].csv || !sh[i].idx)
+        {
+            perror(path);
+            return EXIT_FAILURE;
+        }
+        setvbuf(sh[i].csv, NULL, _IOFBF, 1 << 20);
+        fputs(csv_header, sh[i].csv);
+        sh[i].csv_bytes = strlen(csv_header);
+        // Hueco para cabecera, directorio y checksums; se reescriben al final
+        Header h0 = {{0}, TABLE_SIZE, 0};
+        fwrite(&h0, sizeof(h0), 1, sh[i].idx);
+        fwrite(sh[i].dir, sizeof(DirEntry), TABLE_SIZE, sh[i].idx);
+        fwrite(sh[i].crc, 1, IDX_CRC_BYTES(TABLE_SIZE), sh[i].idx);
+    }
+
+    // Recorre los buckets: cada fila se copia al CSV de su shard y el par se reescribe
+    // con el nuevo offset. El orden por id dentro del bucket se conserva.
+    for (unsigned b = 0; b < TABLE_SIZE; ++b)
+    {
+        Shard *s = &sh[b % (unsigned)k];
+        uint64_t count = dir[b].bucket_count;
+        if (count == 0)
+            continue;
+        Pair *pairs = (Pair *)malloc((size_t)count * sizeof(Pair));
+        if (!pairs || fseeko(in_idx, (off_t)dir[b].bucket_offset, SEEK_SET) != 0 ||
+            fread(pairs, sizeof(Pair), (size_t)count, in_idx) != count)
+        {
+            fprintf(stderr, "Error leyendo bucket %u\n", b);
+            return EXIT_FAILURE;
+        }
+        // Los ids borrados en el servidor (DEL) no pasan a los shards
+        uint64_t live = 0;
+        for (uint64_t j = 0; j < count; ++j)
+            if (!(pairs[j].offset & IDX_DEAD))
+                pairs[live++] = pairs[j];
+        count = live;
+        for (uint64_t j = 0; j < count; ++j)
+        {
+            ssize_t n = read_row(in_csv, pairs[j].offset, &line, &line_cap);
+            if (n < 0)
+            {
+                fprintf(stderr, "Error leyendo fila del id %" PRIu64 "\n", pairs[j].id);
+                return EXIT_FAILURE;
+            }
+            pairs[j].offset = s->csv_bytes;
+            fwrite(line, 1, (size_t)n, s->csv);
+            fputc('\n', s->csv);
+            s->csv_bytes += (uint64_t)n + 1;
+        }
+        fseeko(s->idx, 0, SEEK_END);
+        s->dir[b].bucket_offset = (uint64_t)ftello(s->idx);
+        s->dir[b].bucket_count = count;
+        s->crc[b] = crc32c(0, pairs, (size_t)count * sizeof(Pair));
+        s->entries += count;
+        if (fwrite(pairs, sizeof(Pair), (size_t)count, s->idx) != count)
+        {
+            perror("write idx");
+            return EXIT_FAILURE;
+        }
+        free(pairs);
+    }
+
+    int rc = EXIT_SUCCESS;
+    for (int i = 0; i < k; ++i)
+    {
+        Header h = {{0}, TABLE_SIZE, sh[i].entries};
+        memcpy(h.magic, IDX_MAGIC_V2, 8);
+        sh[i].crc[TABLE_SIZE] = idx_header_crc(&h, sizeof(h), sh[i].dir, sizeof(sh[i].dir), sh[i].crc, TABLE_SIZE);
+        fseeko(sh[i].idx, 0, SEEK_SET);
+        fwrite(&h, sizeof(h), 1, sh[i].idx);
+        fwrite(sh[i].dir, sizeof(DirEntry), TABLE_SIZE, sh[i].idx);
+        fwrite(sh[i].crc, 1, IDX_CRC_BYTES(TABLE_SIZE), sh[i].idx);
+        if (fclose(sh[i].idx) != 0 || fclose(sh[i].csv) != 0)
+        {
+            perror("close shard");
+            rc = EXIT_FAILURE;
+        }
+        printf("shard %d: %" PRIu64 " entradas, %.1f MB de CSV\n", i, sh[i].entries, (double)sh[i].csv_bytes / 1e6);
+    }
+    free(line);
+    free(csv_header);
+    free(sh);
+    fclose(in_idx);
+    fclose(in_csv);
+    return rc;
+}